@@ -0,0 +1,95 @@
+/*
+ * bench_simd - Pop throughput of SoA heaps with and without SIMD kernels.
+ * Copyright(C) 2020 Fridolin Pokorny
+ *
+ * This program is free software: you can redistribute it and / or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+/*
+ * A heapified EHeapQSoAStorage heap is popped until empty, best of 5 runs.
+ * Positions are kept in an array indexed by the payload, so that the sift
+ * cost dominates. Build twice and compare, the scalar loop is used with
+ * EHEAPQ_NO_SIMD:
+ *
+ *   g++ -std=c++17 -O2 -I fext benchmarks/bench_simd.cpp -o bench_simd
+ *   g++ -std=c++17 -O2 -DEHEAPQ_NO_SIMD -I fext benchmarks/bench_simd.cpp -o bench_scalar
+ *   ./bench_simd 100000 && ./bench_scalar 100000
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <vector>
+
+#include "eheapq.hpp"
+
+// Positions of items, indexed by their payload.
+struct ArrayPositionTraits {
+  static std::vector<size_t> positions;
+
+  template <class P>
+  static size_t & position(const EHeapQPriorityItem<P, uint32_t> & item) noexcept { return positions[item.item]; }
+};
+
+std::vector<size_t> ArrayPositionTraits::positions;
+
+template <class P, size_t Arity>
+static void run(const char * name, size_t count) {
+  typedef EHeapQPriorityItem<P, uint32_t> Item;
+  typedef EHeapQ<
+    Item,
+    EHeapQPriorityCompare<P, uint32_t>,
+    Arity,
+    EHeapQIntrusiveIndex<Item, ArrayPositionTraits>,
+    EHeapQSoAStorage<P, uint32_t>
+  > Heap;
+  std::mt19937_64 rng(1);
+  std::vector<Item> items(count);
+  double best = 1e9, sum = 0;
+
+  for (size_t i = 0; i < count; i++)
+    items[i] = {P(rng() % 1000000007), uint32_t(i)};
+
+  for (int round = 0; round < 5; round++) {
+    ArrayPositionTraits::positions.assign(count, EHEAPQ_NPOS);
+    Heap heap;
+    heap.heapify(items.begin(), items.end());
+
+    auto start = std::chrono::steady_clock::now();
+    while (heap.get_length() > 0)
+      sum += heap.pop().priority;
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    best = std::min(best, elapsed.count());
+  }
+
+  std::printf("%-7s arity %2zu  %5.1f Mpops/s  (%g)\n", name, Arity, count / best / 1e6, sum);
+}
+
+template <class P>
+static void run_arities(const char * name, size_t count) {
+  run<P, 4>(name, count);
+  run<P, 8>(name, count);
+  run<P, 16>(name, count);
+}
+
+int main(int argc, char ** argv) {
+  size_t count = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 100000;
+
+  run_arities<double>("double", count);
+  run_arities<float>("float", count);
+  run_arities<int32_t>("int32", count);
+  run_arities<int64_t>("int64", count);
+  return 0;
+}
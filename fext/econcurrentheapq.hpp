@@ -0,0 +1,258 @@
+/*
+ * econcurrentheapq - A thread-safe extended heap queue using flat combining.
+ * Copyright(C) 2020 Fridolin Pokorny
+ *
+ * This program is free software: you can redistribute it and / or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+/*
+ * EXPERIMENTAL - the heap was benchmarked only on a single CPU, where it
+ * was not faster than a mutex around EHeapQ (see
+ * benchmarks/bench_concurrent.cpp). Prefer the mutex until it is shown to
+ * scale on multiple cores.
+ *
+ * Flat combining (Hendler et al., 2010) - a thread publishes its operation
+ * in a slot and either becomes the combiner by taking the lock, executing
+ * operations published by all the threads, or waits until some other
+ * combiner executes its operation. The heap is accessed by one thread at
+ * a time, but the lock is taken once per batch of operations instead of
+ * once per operation and the heap stays in the cache of the combiner.
+ *
+ * Exceptions raised by operations are passed to the threads that
+ * published them, which costs two throws - expected misses should use
+ * try_pop() and try_remove() returning false instead. The single-threaded
+ * EHeapQ is not changed in any way.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+#include "eheapq.hpp"
+
+// Number of publication slots, more threads share slots.
+const size_t EHEAPQ_COMBINING_SLOTS = 64;
+// Passes over slots done by one combiner, later passes pick up operations published meanwhile.
+const unsigned EHEAPQ_COMBINING_PASSES = 3;
+// Spins on the own slot before a waiting thread yields.
+const unsigned EHEAPQ_COMBINING_SPINS = 128;
+
+template <
+  class T,
+  class Compare = std::less<T>,
+  size_t Arity = EHEAPQ_DEFAULT_ARITY,
+  class Index = EHeapQHashIndex<T>,
+  class Storage = EHeapQVectorStorage<T>
+>
+class EConcurrentHeapQ {
+  public:
+    typedef EHeapQ<T, Compare, Arity, Index, Storage> Heap;
+
+    EConcurrentHeapQ(size_t size = EHEAPQ_DEFAULT_SIZE, size_t arity = Arity)
+      : heap(size, arity), locked(false), slots_used(0) {}
+
+    EConcurrentHeapQ(const EConcurrentHeapQ &) = delete;
+    EConcurrentHeapQ & operator=(const EConcurrentHeapQ &) = delete;
+
+    /*
+     * Execute the operation on the heap atomically with respect to other
+     * operations, the operation is called as operation(Heap &), possibly
+     * from another thread.
+     */
+    template <class Operation>
+    void apply(Operation && operation);
+
+    void push(T item) { this->apply([&](Heap & heap) { heap.push(item); }); }
+    T pushpop(T item) { T result; this->apply([&](Heap & heap) { result = heap.pushpop(item); }); return result; }
+    T pop(void) { T result; this->apply([&](Heap & heap) { result = heap.pop(); }); return result; }
+    T replace(T item) { T result; this->apply([&](Heap & heap) { result = heap.replace(item); }); return result; }
+    void remove(T item) { this->apply([&](Heap & heap) { heap.remove(item); }); }
+    void update(T item) { this->apply([&](Heap & heap) { heap.update(item); }); }
+
+    // Pop the top item if the heap is not empty, does not raise EHeapQEmpty.
+    bool try_pop(T & item) {
+      bool popped = false;
+      this->apply([&](Heap & heap) {
+        if (heap.get_length() > 0) {
+          item = heap.pop();
+          popped = true;
+        }
+      });
+      return popped;
+    }
+
+    // Remove the item if it is stored, does not raise EHeapQNotFound.
+    bool try_remove(T item) {
+      bool removed = false;
+      this->apply([&](Heap & heap) {
+        if (heap.contains(item)) {
+          heap.remove(item);
+          removed = true;
+        }
+      });
+      return removed;
+    }
+
+    T get_top() { T result; this->apply([&](Heap & heap) { result = heap.get_top(); }); return result; }
+    T get_last() { T result; this->apply([&](Heap & heap) { result = heap.get_last(); }); return result; }
+    T get_max(void) { T result; this->apply([&](Heap & heap) { result = heap.get_max(); }); return result; }
+    size_t get_length() { size_t result; this->apply([&](Heap & heap) { result = heap.get_length(); }); return result; }
+    size_t get_size() { size_t result; this->apply([&](Heap & heap) { result = heap.get_size(); }); return result; }
+    void set_size(size_t size) { this->apply([&](Heap & heap) { heap.set_size(size); }); }
+    void reserve(size_t size) { this->apply([&](Heap & heap) { heap.reserve(size); }); }
+
+  private:
+    enum SlotState : unsigned { FREE, CLAIMED, PENDING, DONE };
+
+    struct alignas(64) Slot {
+      std::atomic<unsigned> state{FREE};
+      void (*run)(Heap &, void *);
+      void * operation;
+      std::exception_ptr error;
+    };
+
+    Heap heap;
+
+    alignas(64) std::atomic<bool> locked;
+    std::atomic<size_t> slots_used;
+    Slot slots[EHEAPQ_COMBINING_SLOTS];
+
+    /*
+     * Threads are numbered from zero, numbers of finished threads are
+     * reused, so slots used stay at the beginning of the array and
+     * combiners scan only as many slots as there are threads.
+     */
+    class ThreadNumber {
+      public:
+        ThreadNumber() {
+          std::lock_guard<std::mutex> guard(lock());
+          if (released().empty()) {
+            this->number = count()++;
+          } else {
+            this->number = released().back();
+            released().pop_back();
+          }
+        }
+
+        ~ThreadNumber() {
+          std::lock_guard<std::mutex> guard(lock());
+          released().push_back(this->number);
+        }
+
+        size_t number;
+
+      private:
+        static std::mutex & lock() { static std::mutex lock; return lock; }
+        static size_t & count() { static size_t count = 0; return count; }
+        static std::vector<size_t> & released() { static std::vector<size_t> released; return released; }
+    };
+
+    static size_t thread_slot() {
+      thread_local ThreadNumber thread;
+      return thread.number % EHEAPQ_COMBINING_SLOTS;
+    }
+
+    static void pause() noexcept {
+#if defined(__x86_64__) || defined(__i386__)
+      __builtin_ia32_pause();
+#endif
+    }
+
+    Slot & claim_slot();
+    void combine(const Slot & own) noexcept;
+};
+
+template <class T, class Compare, size_t Arity, class Index, class Storage>
+typename EConcurrentHeapQ<T, Compare, Arity, Index, Storage>::Slot &
+EConcurrentHeapQ<T, Compare, Arity, Index, Storage>::claim_slot() {
+  size_t pos = thread_slot();
+
+  for (size_t i = 0;; i++, pos = (pos + 1) % EHEAPQ_COMBINING_SLOTS) {
+    unsigned expected = FREE;
+    if (this->slots[pos].state.load(std::memory_order_relaxed) == FREE &&
+        this->slots[pos].state.compare_exchange_strong(expected, CLAIMED, std::memory_order_acquire))
+      break;
+
+    // All the slots are taken by other threads.
+    if (i > 0 && i % EHEAPQ_COMBINING_SLOTS == 0)
+      std::this_thread::yield();
+  }
+
+  // Let combiners scan only slots that were ever used.
+  size_t used = this->slots_used.load(std::memory_order_relaxed);
+  while (used <= pos && !this->slots_used.compare_exchange_weak(used, pos + 1, std::memory_order_relaxed));
+
+  return this->slots[pos];
+}
+
+template <class T, class Compare, size_t Arity, class Index, class Storage>
+void EConcurrentHeapQ<T, Compare, Arity, Index, Storage>::combine(const Slot & own) noexcept {
+  for (unsigned pass = 0; pass < EHEAPQ_COMBINING_PASSES; pass++) {
+    // Scan again only if other threads are publishing.
+    bool found = false;
+    size_t used = this->slots_used.load(std::memory_order_relaxed);
+
+    for (size_t i = 0; i < used; i++) {
+      Slot & slot = this->slots[i];
+      if (slot.state.load(std::memory_order_acquire) != PENDING)
+        continue;
+
+      try {
+        slot.run(this->heap, slot.operation);
+      } catch (...) {
+        slot.error = std::current_exception();
+      }
+
+      slot.state.store(DONE, std::memory_order_release);
+      found |= &slot != &own;
+    }
+
+    if (!found)
+      break;
+  }
+}
+
+template <class T, class Compare, size_t Arity, class Index, class Storage>
+template <class Operation>
+void EConcurrentHeapQ<T, Compare, Arity, Index, Storage>::apply(Operation && operation) {
+  typedef typename std::remove_reference<Operation>::type Op;
+  Slot & slot = this->claim_slot();
+
+  slot.run = [](Heap & heap, void * operation) { (*static_cast<Op *>(operation))(heap); };
+  slot.operation = const_cast<void *>(static_cast<const void *>(&operation));
+  slot.state.store(PENDING, std::memory_order_release);
+
+  for (unsigned spins = 0; slot.state.load(std::memory_order_acquire) != DONE; spins++) {
+    if (!this->locked.load(std::memory_order_relaxed) && !this->locked.exchange(true, std::memory_order_acquire)) {
+      // The own operation is pending, so it is executed by this combiner.
+      this->combine(slot);
+      this->locked.store(false, std::memory_order_release);
+    } else if (spins < EHEAPQ_COMBINING_SPINS) {
+      pause();
+    } else {
+      std::this_thread::yield();
+    }
+  }
+
+  std::exception_ptr error = std::move(slot.error);
+  slot.error = nullptr;
+  slot.state.store(FREE, std::memory_order_release);
+
+  if (error)
+    std::rethrow_exception(error);
+}
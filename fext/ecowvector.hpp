@@ -0,0 +1,197 @@
+/*
+ * ecowvector - A chunked copy-on-write vector.
+ * Copyright(C) 2020 Fridolin Pokorny
+ *
+ * This program is free software: you can redistribute it and / or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+/*
+ * Items are kept in fixed size chunks shared between copies of the
+ * vector. Copying the vector copies only pointers to chunks, a chunk is
+ * cloned on the first write through a copy sharing it (a non-const
+ * operator[], push_back(), ...), so copies pay only for chunks they
+ * modify. Reads through const references never clone chunks.
+ *
+ * The interface follows the subset of std::vector used by EFlatMap, index
+ * and storage policies. Writes done by noexcept functions of these (e.g.
+ * moving an item in the index) terminate the program if a chunk cannot be
+ * cloned for the lack of memory. Copies of a vector can be used by
+ * different threads only if no copy is written to.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <iterator>
+#include <memory>
+#include <utility>
+#include <vector>
+
+// Number of items in a chunk, a power of two.
+const size_t ECOWVECTOR_CHUNK_SIZE = 256;
+
+template <class T, class Allocator = std::allocator<T>>
+class ECowVector {
+  public:
+    typedef T value_type;
+    typedef Allocator allocator_type;
+
+    class const_iterator {
+      public:
+        typedef std::forward_iterator_tag iterator_category;
+        typedef T value_type;
+        typedef std::ptrdiff_t difference_type;
+        typedef const T * pointer;
+        typedef const T & reference;
+
+        const_iterator(const ECowVector * vector, size_t pos) : vector(vector), pos(pos) {}
+
+        const T & operator*() const noexcept { return (*this->vector)[this->pos]; }
+        const_iterator & operator++() noexcept { this->pos++; return *this; }
+        const_iterator operator++(int) noexcept { const_iterator result = *this; this->pos++; return result; }
+        bool operator==(const const_iterator & other) const noexcept { return this->pos == other.pos; }
+        bool operator!=(const const_iterator & other) const noexcept { return this->pos != other.pos; }
+
+      private:
+        const ECowVector * vector;
+        size_t pos;
+    };
+
+    ECowVector() : length(0) {}
+    explicit ECowVector(const Allocator & allocator)
+      : length(0), allocator(allocator), chunks(ChunkRefAllocator(allocator)) {}
+    ECowVector(size_t count, const Allocator & allocator = Allocator()) : ECowVector(allocator) { this->resize(count); }
+
+    ECowVector(const ECowVector & other) : length(other.length), allocator(other.allocator), chunks(other.chunks) {
+      other.share();
+      this->share();
+    }
+
+    ECowVector & operator=(const ECowVector & other) {
+      if (this != &other) {
+        this->length = other.length;
+        this->chunks = other.chunks;
+        other.share();
+        this->share();
+      }
+      return *this;
+    }
+
+    ECowVector(ECowVector && other) = default;
+    ECowVector & operator=(ECowVector && other) = default;
+
+    size_t size() const noexcept { return this->length; }
+    bool empty() const noexcept { return this->length == 0; }
+    allocator_type get_allocator() const { return this->allocator; }
+
+    const T & operator[](size_t pos) const noexcept { return this->chunks[pos / ECOWVECTOR_CHUNK_SIZE].chunk->items[pos % ECOWVECTOR_CHUNK_SIZE]; }
+    T & operator[](size_t pos) { return this->own(pos / ECOWVECTOR_CHUNK_SIZE).items[pos % ECOWVECTOR_CHUNK_SIZE]; }
+    const T & back() const noexcept { return (*this)[this->length - 1]; }
+    T & back() { return (*this)[this->length - 1]; }
+
+    void push_back(const T & item) { this->append() = item; }
+    void push_back(T && item) { this->append() = std::move(item); }
+    void pop_back();
+
+    void resize(size_t size);
+    void reserve(size_t size) { this->chunks.reserve((size + ECOWVECTOR_CHUNK_SIZE - 1) / ECOWVECTOR_CHUNK_SIZE); }
+    void clear() noexcept {
+      this->chunks.clear();
+      this->length = 0;
+    }
+
+    const_iterator begin() const noexcept { return const_iterator(this, 0); }
+    const_iterator end() const noexcept { return const_iterator(this, this->length); }
+
+    // Number of chunks shared with other copies.
+    size_t get_shared_count() const noexcept {
+      size_t count = 0;
+      for (auto & ref : this->chunks)
+        count += ref.chunk.use_count() > 1;
+      return count;
+    }
+
+  private:
+    struct Chunk {
+      T items[ECOWVECTOR_CHUNK_SIZE];
+    };
+
+    /*
+     * The owned flag caches that the chunk is not shared, so that writes do
+     * not touch the reference counter of the chunk. Flags are reset in both
+     * vectors when a vector is copied.
+     */
+    struct ChunkRef {
+      std::shared_ptr<Chunk> chunk;
+      mutable bool owned;
+    };
+
+    typedef typename std::allocator_traits<Allocator>::template rebind_alloc<Chunk> ChunkAllocator;
+    typedef typename std::allocator_traits<Allocator>::template rebind_alloc<ChunkRef> ChunkRefAllocator;
+
+    size_t length;
+    Allocator allocator;
+    std::vector<ChunkRef, ChunkRefAllocator> chunks;
+
+    void share() const noexcept {
+      for (auto & ref : this->chunks)
+        ref.owned = false;
+    }
+
+    // The chunk, cloned first if it is shared.
+    Chunk & own(size_t chunk) {
+      ChunkRef & ref = this->chunks[chunk];
+
+      if (!ref.owned) {
+        if (ref.chunk.use_count() != 1)
+          ref.chunk = std::allocate_shared<Chunk>(ChunkAllocator(this->allocator), *ref.chunk);
+        ref.owned = true;
+      }
+
+      return *ref.chunk;
+    }
+
+    // A writable item past the last one.
+    T & append() {
+      size_t chunk = this->length / ECOWVECTOR_CHUNK_SIZE;
+
+      if (chunk == this->chunks.size())
+        this->chunks.push_back({std::allocate_shared<Chunk>(ChunkAllocator(this->allocator)), true});
+
+      T & item = this->own(chunk).items[this->length % ECOWVECTOR_CHUNK_SIZE];
+      this->length++;
+      return item;
+    }
+};
+
+template <class T, class Allocator>
+void ECowVector<T, Allocator>::pop_back() {
+  this->length--;
+
+  size_t chunk = this->length / ECOWVECTOR_CHUNK_SIZE;
+  if (this->length % ECOWVECTOR_CHUNK_SIZE == 0) {
+    this->chunks.pop_back();
+  } else if (this->chunks[chunk].owned || this->chunks[chunk].chunk.use_count() == 1) {
+    // Release resources held by the item, a shared chunk keeps it for other copies.
+    this->chunks[chunk].chunk->items[this->length % ECOWVECTOR_CHUNK_SIZE] = T();
+  }
+}
+
+template <class T, class Allocator>
+void ECowVector<T, Allocator>::resize(size_t size) {
+  while (this->length > size)
+    this->pop_back();
+
+  while (this->length < size)
+    this->append() = T();
+}
@@ -0,0 +1,239 @@
+/*
+ * eflatmap - A flat open-addressing hash map used for heap indexes.
+ * Copyright(C) 2020 Fridolin Pokorny
+ *
+ * This program is free software: you can redistribute it and / or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+/*
+ * The map keeps all entries in one contiguous array and resolves
+ * collisions using Robin Hood linear probing with backward shift deletion.
+ * Hashes are mixed using Fibonacci hashing so that identity hashes of
+ * pointers (as used by std::hash) spread well across a power of two sized
+ * table. Compared to std::unordered_map there is no allocation per
+ * inserted key and lookups mostly stay within one or two cache lines.
+ *
+ * Entries are kept in the Table container, std::vector by default. The
+ * map reads entries only through const references to the table, so
+ * a copy-on-write table (see ecowvector.hpp) is shared by copies of the
+ * map until they are changed.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <limits>
+#include <memory>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+const size_t EFLATMAP_MIN_CAPACITY = 16;
+const size_t EFLATMAP_NPOS = std::numeric_limits<size_t>::max();
+
+template <
+  class K,
+  class V,
+  class Hash = std::hash<K>,
+  class KeyEqual = std::equal_to<K>,
+  class Allocator = std::allocator<std::pair<const K, V>>,
+  template <class, class> class Table = std::vector
+>
+class EFlatMap {
+  public:
+    EFlatMap() : count(0), shift(64) {}
+    // The table is allocated using the allocator rebound to the entry type.
+    explicit EFlatMap(const Allocator & allocator) : entries(EntryAllocator(allocator)), count(0), shift(64) {}
+
+    size_t size() const noexcept { return this->count; }
+    size_t capacity() const noexcept { return this->entries.size(); }
+
+    V * find(const K & key) noexcept {
+      size_t idx = this->locate(key);
+      return idx == EFLATMAP_NPOS ? nullptr : &this->entries[idx].value;
+    }
+    const V * find(const K & key) const noexcept {
+      size_t idx = this->locate(key);
+      return idx == EFLATMAP_NPOS ? nullptr : &this->entries[idx].value;
+    }
+    bool contains(const K & key) const noexcept { return this->locate(key) != EFLATMAP_NPOS; }
+
+    V & at(const K & key) {
+      V * value = this->find(key);
+      if (!value)
+        throw std::out_of_range("EFlatMap::at");
+      return *value;
+    }
+
+    bool insert(const K & key, V value);
+    bool erase(const K & key) noexcept;
+    void reserve(size_t size);
+    void clear() noexcept;
+
+  private:
+    struct Entry {
+      K key;
+      V value;
+      // Distance from the home bucket plus one, zero marks an empty entry.
+      uint32_t dist;
+    };
+
+    typedef typename std::allocator_traits<Allocator>::template rebind_alloc<Entry> EntryAllocator;
+
+    Table<Entry, EntryAllocator> entries;
+    size_t count;
+    unsigned shift;
+
+    Hash hash;
+    KeyEqual equal;
+
+    size_t bucket(const K & key) const noexcept {
+      return size_t((uint64_t(this->hash(key)) * UINT64_C(0x9E3779B97F4A7C15)) >> this->shift);
+    }
+
+    size_t locate(const K & key) const noexcept;
+    bool place(Entry entry, bool unique) noexcept;
+    void rehash(size_t capacity);
+};
+
+template <class K, class V, class Hash, class KeyEqual, class Allocator, template <class, class> class Table>
+size_t EFlatMap<K, V, Hash, KeyEqual, Allocator, Table>::locate(const K & key) const noexcept {
+  if (this->count == 0)
+    return EFLATMAP_NPOS;
+
+  size_t mask = this->entries.size() - 1;
+  size_t idx = this->bucket(key);
+  uint32_t dist = 1;
+
+  for (;;) {
+    const Entry & entry = this->entries[idx];
+
+    // Robin Hood invariant - the key would have been placed here if present.
+    if (entry.dist < dist)
+      return EFLATMAP_NPOS;
+
+    if (entry.dist == dist && this->equal(entry.key, key))
+      return idx;
+
+    dist++;
+    idx = (idx + 1) & mask;
+  }
+}
+
+/*
+ * Place the given entry into the table. If unique is set, the key is
+ * checked not to be present (in the same pass) and false is returned if it
+ * is. The table has to have a free slot.
+ */
+template <class K, class V, class Hash, class KeyEqual, class Allocator, template <class, class> class Table>
+bool EFlatMap<K, V, Hash, KeyEqual, Allocator, Table>::place(Entry entry, bool unique) noexcept {
+  size_t mask = this->entries.size() - 1;
+  size_t idx = this->bucket(entry.key);
+
+  entry.dist = 1;
+  for (;;) {
+    // Entries are written only when needed, so that shared tables are not copied on reads.
+    const Entry & slot = static_cast<const Table<Entry, EntryAllocator> &>(this->entries)[idx];
+
+    if (slot.dist == 0) {
+      this->entries[idx] = std::move(entry);
+      return true;
+    }
+
+    // Equal keys share the home bucket, so they can only meet at the same distance.
+    if (unique && slot.dist == entry.dist && this->equal(slot.key, entry.key))
+      return false;
+
+    if (slot.dist < entry.dist) {
+      // Displace the richer entry, the key being inserted cannot be found past this point.
+      std::swap(this->entries[idx], entry);
+      unique = false;
+    }
+
+    entry.dist++;
+    idx = (idx + 1) & mask;
+  }
+}
+
+template <class K, class V, class Hash, class KeyEqual, class Allocator, template <class, class> class Table>
+bool EFlatMap<K, V, Hash, KeyEqual, Allocator, Table>::insert(const K & key, V value) {
+  // Keep the load factor at most 7/8.
+  if ((this->count + 1) * 8 > this->entries.size() * 7)
+    this->rehash(std::max(EFLATMAP_MIN_CAPACITY, this->entries.size() * 2));
+
+  if (!this->place(Entry{key, value, 0}, true))
+    return false;
+
+  this->count++;
+  return true;
+}
+
+template <class K, class V, class Hash, class KeyEqual, class Allocator, template <class, class> class Table>
+bool EFlatMap<K, V, Hash, KeyEqual, Allocator, Table>::erase(const K & key) noexcept {
+  size_t idx = this->locate(key);
+  if (idx == EFLATMAP_NPOS)
+    return false;
+
+  const Table<Entry, EntryAllocator> & table = this->entries;
+  size_t mask = this->entries.size() - 1;
+  size_t next = (idx + 1) & mask;
+
+  // Shift following entries of the probe sequence back by one.
+  while (table[next].dist > 1) {
+    this->entries[idx] = std::move(this->entries[next]);
+    this->entries[idx].dist--;
+    idx = next;
+    next = (next + 1) & mask;
+  }
+
+  this->entries[idx].dist = 0;
+  this->count--;
+  return true;
+}
+
+template <class K, class V, class Hash, class KeyEqual, class Allocator, template <class, class> class Table>
+void EFlatMap<K, V, Hash, KeyEqual, Allocator, Table>::rehash(size_t capacity) {
+  Table<Entry, EntryAllocator> entries(capacity, this->entries.get_allocator());
+
+  std::swap(this->entries, entries);
+  this->shift = 64;
+  while (capacity > 1) {
+    capacity >>= 1;
+    this->shift--;
+  }
+
+  for (size_t i = 0; i < entries.size(); i++)
+    if (entries[i].dist != 0)
+      this->place(std::move(entries[i]), false);
+}
+
+template <class K, class V, class Hash, class KeyEqual, class Allocator, template <class, class> class Table>
+void EFlatMap<K, V, Hash, KeyEqual, Allocator, Table>::reserve(size_t size) {
+  size_t capacity = std::max(EFLATMAP_MIN_CAPACITY, this->entries.size());
+
+  while (size * 8 > capacity * 7)
+    capacity *= 2;
+
+  if (capacity != this->entries.size())
+    this->rehash(capacity);
+}
+
+template <class K, class V, class Hash, class KeyEqual, class Allocator, template <class, class> class Table>
+void EFlatMap<K, V, Hash, KeyEqual, Allocator, Table>::clear() noexcept {
+  for (size_t i = 0; i < this->entries.size(); i++)
+    this->entries[i].dist = 0;
+
+  this->count = 0;
+}
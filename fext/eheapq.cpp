@@ -32,14 +32,21 @@ extern "C" {
 #include "structmember.h"
 }
 
+#include <algorithm>
+#include <cmath>
+#include <cstring>
 #include <iostream>
 #include <limits>
-#include <unordered_map>
 #include <vector>
 
 #include "eheapq.hpp"
+#include "eminmaxheapq.hpp"
+#include "emultiheapq.hpp"
+#include "eradixheapq.hpp"
 
 const bool _DEFAULT_WEAKREF = false;
+// Nesting of tuples inspected when checking whether a key of an item removed lazily is stable.
+const int EHEAPQ_STABLE_KEY_DEPTH = 16;
 
 class ObjCmpErr: public std::exception {
   public:
@@ -48,36 +55,231 @@ class ObjCmpErr: public std::exception {
     }
 } ObjCmpErrExc;
 
-struct PyObjectRichCmp {
-    bool operator()(PyObject * a, PyObject * b) {
-        Py_INCREF(a);
-        Py_INCREF(b);
-        auto cmp = PyObject_RichCompareBool(a, b, Py_LT);
-        Py_DECREF(a);
-        Py_DECREF(b);
+// A Python callback raised an exception, the Python error is set.
+class PyCallErr: public std::exception {
+  public:
+    virtual const char* what() const throw() {
+      return "Python callback failed";
+    }
+} PyCallErrExc;
+
+static inline bool py_rich_lt(PyObject * a, PyObject * b) {
+  Py_INCREF(a);
+  Py_INCREF(b);
+  auto cmp = PyObject_RichCompareBool(a, b, Py_LT);
+  Py_DECREF(a);
+  Py_DECREF(b);
+
+  if (cmp < 0)
+    throw ObjCmpErrExc;
+
+  return bool(cmp);
+}
+
+/*
+ * Kinds of objects the heap knows how to compare without going through
+ * the rich comparison protocol.
+ */
+enum PyObjectCmpKind {
+  PY_CMP_UNSET = 0,
+  PY_CMP_RICH,
+  PY_CMP_FLOAT,
+  PY_CMP_LONG,
+  PY_CMP_UNICODE,
+  PY_CMP_TUPLE,
+};
+
+static PyObjectCmpKind py_cmp_kind(PyObject * item) {
+  int overflow;
+
+  if (PyFloat_CheckExact(item))
+    return PY_CMP_FLOAT;
+
+  if (PyLong_CheckExact(item)) {
+    PyLong_AsLongAndOverflow(item, &overflow);
+    return overflow == 0 ? PY_CMP_LONG : PY_CMP_RICH;
+  }
+
+  if (PyUnicode_CheckExact(item))
+    return PyUnicode_READY(item) == 0 ? PY_CMP_UNICODE : PY_CMP_RICH;
+
+  if (PyTuple_CheckExact(item) && PyTuple_GET_SIZE(item) > 0)
+    return PY_CMP_TUPLE;
+
+  return PY_CMP_RICH;
+}
+
+static inline long py_long_value(PyObject * item) {
+#if PY_VERSION_HEX >= 0x030C0000
+  if (PyUnstable_Long_IsCompact((PyLongObject *)item))
+    return (long)PyUnstable_Long_CompactValue((PyLongObject *)item);
+#else
+  const digit * digits = ((PyLongObject *)item)->ob_digit;
+  switch (Py_SIZE(item)) {
+    case 0:
+      return 0;
+    case 1:
+      return (long)digits[0];
+    case -1:
+      return -(long)digits[0];
+  }
+#endif
+  return PyLong_AsLong(item);
+}
+
+static inline int py_unicode_cmp(PyObject * a, PyObject * b) {
+  if (PyUnicode_KIND(a) == PyUnicode_1BYTE_KIND && PyUnicode_KIND(b) == PyUnicode_1BYTE_KIND) {
+    Py_ssize_t len_a = PyUnicode_GET_LENGTH(a);
+    Py_ssize_t len_b = PyUnicode_GET_LENGTH(b);
+    int cmp = memcmp(PyUnicode_DATA(a), PyUnicode_DATA(b), std::min(len_a, len_b));
+    if (cmp != 0)
+      return cmp;
+
+    return (len_a > len_b) - (len_a < len_b);
+  }
+
+  return PyUnicode_Compare(a, b);
+}
+
+/*
+ * Compare Python objects stored in the heap. Similarly to the pre-check
+ * done in list.sort(), the heap tracks types of items pushed and if all
+ * of them are floats, ints fitting into a machine word, strings or tuples
+ * with the first items of one of these types, the comparison is done
+ * directly on the underlying C values. Once an item of any other type is
+ * pushed, the comparison falls back to the rich comparison until the heap
+ * is emptied.
+ */
+struct PyObjectCmp {
+    PyObjectCmpKind kind = PY_CMP_UNSET;
+    PyObjectCmpKind tuple_kind = PY_CMP_UNSET;
+
+    void track(PyObject * item, bool empty) {
+      PyObjectCmpKind item_kind, item_tuple_kind = PY_CMP_UNSET;
+
+      if (!empty && this->kind == PY_CMP_RICH)
+        return;
 
-        if (cmp < 0)
-          throw ObjCmpErrExc;
+      item_kind = py_cmp_kind(item);
+      if (item_kind == PY_CMP_TUPLE) {
+        item_tuple_kind = py_cmp_kind(PyTuple_GET_ITEM(item, 0));
+        if (item_tuple_kind == PY_CMP_RICH || item_tuple_kind == PY_CMP_TUPLE)
+          item_kind = PY_CMP_RICH;
+      }
 
-        return bool(cmp);
+      if (empty) {
+        this->kind = item_kind;
+        this->tuple_kind = item_tuple_kind;
+      } else if (item_kind != this->kind || item_tuple_kind != this->tuple_kind) {
+        this->kind = PY_CMP_RICH;
+      }
+    }
+
+    bool operator()(PyObject * a, PyObject * b) const {
+      switch (this->kind) {
+        case PY_CMP_FLOAT:
+        case PY_CMP_LONG:
+        case PY_CMP_UNICODE:
+          return compare(this->kind, a, b) < 0;
+        case PY_CMP_TUPLE: {
+          int cmp = compare(this->tuple_kind, PyTuple_GET_ITEM(a, 0), PyTuple_GET_ITEM(b, 0));
+          if (cmp != 0)
+            return cmp < 0;
+          // First items are equal (or not ordered, e.g. NaNs), compare whole tuples.
+          return py_rich_lt(a, b);
+        }
+        default:
+          return py_rich_lt(a, b);
+      }
+    }
+
+  private:
+    static inline int compare(PyObjectCmpKind kind, PyObject * a, PyObject * b) {
+      switch (kind) {
+        case PY_CMP_FLOAT: {
+          double x = PyFloat_AS_DOUBLE(a), y = PyFloat_AS_DOUBLE(b);
+          return (x > y) - (x < y);
+        }
+        case PY_CMP_LONG: {
+          long x = py_long_value(a), y = py_long_value(b);
+          return (x > y) - (x < y);
+        }
+        default:
+          return py_unicode_cmp(a, b);
+      }
+    }
+};
+
+/*
+ * An item stored in ExtHeapQueue, the slot is assigned by the handle index.
+ * Items are compared by identity.
+ *
+ * Moving an item out clears it. A rich comparison run during a sift can
+ * trigger the garbage collector, the hole left in the heap must not be
+ * seen as another reference to the object being sifted.
+ */
+struct PyHeapItem {
+  PyObject * item;
+  uint32_t eheapq_slot;
+
+  PyHeapItem(PyObject * item = NULL, uint32_t eheapq_slot = 0) noexcept : item(item), eheapq_slot(eheapq_slot) {}
+  PyHeapItem(const PyHeapItem & other) = default;
+  PyHeapItem(PyHeapItem && other) noexcept : item(other.item), eheapq_slot(other.eheapq_slot) { other.item = NULL; }
+
+  PyHeapItem & operator=(const PyHeapItem & other) = default;
+  PyHeapItem & operator=(PyHeapItem && other) noexcept {
+    this->item = other.item;
+    this->eheapq_slot = other.eheapq_slot;
+    other.item = NULL;
+    return *this;
+  }
+
+  bool operator==(const PyHeapItem & other) const noexcept { return this->item == other.item; }
+};
+
+namespace std {
+  template <>
+  struct hash<PyHeapItem> {
+    size_t operator()(const PyHeapItem & item) const noexcept { return hash<PyObject *>()(item.item); }
+  };
+}
+
+struct PyHeapItemCmp: PyObjectCmp {
+    bool operator()(const PyHeapItem & a, const PyHeapItem & b) const {
+      return PyObjectCmp::operator()(a.item, b.item);
     }
 };
 
+/*
+ * Plain vectors are used for the storage and the index, copy-on-write
+ * policies would make sifts of all heaps slower while a copy has to take
+ * a reference to each item anyway.
+ */
+typedef EHeapQ<PyHeapItem, PyHeapItemCmp, EHEAPQ_DYNAMIC_ARITY, EHeapQHandleIndex<PyHeapItem>> PyHeapQ;
+
 typedef struct {
   PyObject_HEAD
-  EHeapQ<PyObject *, PyObjectRichCmp> * heap;
+  PyHeapQ * heap;
 } ExtHeapQueue;
 
+static inline void ExtHeapQueue_track(ExtHeapQueue *self, PyObject *item) {
+  self->heap->get_compare().track(item, self->heap->get_length() == 0);
+}
+
 static int ExtHeapQueue_traverse(ExtHeapQueue *self, visitproc visit, void *arg) {
   for (auto i : *(self->heap->get_items()))
-    Py_VISIT(i);
+    Py_VISIT(i.item);
 
   return 0;
 }
 
 static int ExtHeapQueue_clear(ExtHeapQueue *self) {
-  for (auto i : *(self->heap->get_items()))
-    Py_CLEAR(i);
+  std::vector<PyHeapItem> items;
+
+  // Items are detached first, so that finalizers run by Py_DECREF see a consistent heap.
+  self->heap->detach(items);
+  for (auto & i : items)
+    Py_DECREF(i.item);
 
   return 0;
 }
@@ -89,19 +291,79 @@ static void ExtHeapQueue_dealloc(ExtHeapQueue *self) {
   Py_TYPE(self)->tp_free((PyObject *)self);
 }
 
+// Release an item removed lazily once it is dropped from the heap.
+static void ExtHeapQueue_dispose(PyHeapItem & item) {
+  Py_DECREF(item.item);
+}
+
+// Whether the object cannot change, tuples nested too deep are not inspected.
+static bool ExtHeapQueue_is_immutable(PyObject *obj, int depth = 0) {
+  if (PyLong_CheckExact(obj) || PyFloat_CheckExact(obj) || PyUnicode_CheckExact(obj) || PyBytes_CheckExact(obj) ||
+      PyBool_Check(obj) || obj == Py_None)
+    return true;
+
+  if (!PyTuple_CheckExact(obj) || depth >= EHEAPQ_STABLE_KEY_DEPTH)
+    return false;
+
+  for (Py_ssize_t i = 0; i < PyTuple_GET_SIZE(obj); i++) {
+    if (!ExtHeapQueue_is_immutable(PyTuple_GET_ITEM(obj, i), depth + 1))
+      return false;
+  }
+
+  return true;
+}
+
+/*
+ * Other objects can be mutated (and updated) while they are left in the heap
+ * as tombstones, so they are removed right away even in the lazy mode.
+ */
+static bool ExtHeapQueue_stable_key(const PyHeapItem & item) {
+  return ExtHeapQueue_is_immutable(item.item);
+}
+
 static PyObject * ExtHeapQueue_new(PyTypeObject *type, PyObject *args, PyObject *kwds) {
+  static char *kwlist[] = {"size", "arity", "unique", "lazy", "compaction_threshold", NULL};
   ExtHeapQueue *self;
+
+  size_t size = EHEAPQ_DEFAULT_SIZE;
+  size_t arity = EHEAPQ_DEFAULT_ARITY;
+  int unique = 1;
+  int lazy = 0;
+  double compaction_threshold = EHEAPQ_DEFAULT_COMPACTION_THRESHOLD;
+
+  if (!PyArg_ParseTupleAndKeywords(args, kwds, "|kkppd", kwlist, &size, &arity, &unique, &lazy, &compaction_threshold))
+    return NULL;
+
+  if (arity < 2 || arity > EHEAPQ_MAX_ARITY) {
+    PyErr_SetString(PyExc_ValueError, EHeapQInvalidArityExc.what());
+    return NULL;
+  }
+
+  if (!(compaction_threshold > 0 && compaction_threshold <= 1)) {
+    PyErr_SetString(PyExc_ValueError, EHeapQInvalidThresholdExc.what());
+    return NULL;
+  }
+
   self = (ExtHeapQueue *)type->tp_alloc(type, 0);
-  self->heap = new EHeapQ<PyObject *, PyObjectRichCmp>;
+  self->heap = new PyHeapQ(size, arity);
+  self->heap->get_index().set_unique(unique);
+  self->heap->set_dispose(ExtHeapQueue_dispose);
+  self->heap->set_stable_key(ExtHeapQueue_stable_key);
+  self->heap->set_lazy(lazy, compaction_threshold);
   return (PyObject *)self;
 }
 
 static int ExtHeapQueue_init(ExtHeapQueue *self, PyObject *args, PyObject *kwds) {
-  static char *kwlist[] = {"size", NULL};
+  static char *kwlist[] = {"size", "arity", "unique", "lazy", "compaction_threshold", NULL};
 
   size_t size = self->heap->get_size();
+  size_t arity = self->heap->get_arity();
+  int unique = self->heap->get_index().get_unique();
+  int lazy = self->heap->get_lazy();
+  double compaction_threshold = self->heap->get_compaction_threshold();
 
-  if (!PyArg_ParseTupleAndKeywords(args, kwds, "|k", kwlist, &size))
+  // Arity, uniqueness and the removal mode are handled when the heap is created in ExtHeapQueue_new.
+  if (!PyArg_ParseTupleAndKeywords(args, kwds, "|kkppd", kwlist, &size, &arity, &unique, &lazy, &compaction_threshold))
     return -1;
 
   self->heap->set_size(size);
@@ -112,7 +374,7 @@ static PyObject * ExtHeapQueue_top(ExtHeapQueue *self) {
     PyObject * item;
 
     try {
-      item = self->heap->get_top();
+      item = self->heap->get_top().item;
     } catch (EHeapQEmpty & exc) {
         PyErr_SetString(PyExc_KeyError, exc.what());
         return NULL;
@@ -126,7 +388,7 @@ static PyObject * ExtHeapQueue_last(ExtHeapQueue *self) {
   PyObject * item;
 
   try {
-      item = self->heap->get_last();
+      item = self->heap->get_last().item;
   } catch (EHeapQNoLast & exc) {
       Py_RETURN_NONE;
   } catch (EHeapQEmpty & exc) {
@@ -144,8 +406,10 @@ static PyObject * ExtHeapQueue_pushpop(ExtHeapQueue *self, PyObject *args) {
   if (!PyArg_ParseTuple(args, "O", &item))
     return NULL;
 
+  ExtHeapQueue_track(self, item);
+
   try {
-     to_return = self->heap->pushpop(item);
+     to_return = self->heap->pushpop({item, 0}).item;
   } catch (ObjCmpErr & exc) {
       PyErr_SetString(PyExc_ValueError, exc.what());
       return NULL;
@@ -154,36 +418,99 @@ static PyObject * ExtHeapQueue_pushpop(ExtHeapQueue *self, PyObject *args) {
       return NULL;
   }
 
-  Py_INCREF(item);
-  Py_INCREF(to_return);
+  // The item is returned right away if it is the smallest one, otherwise the reference held by the heap is passed to the caller.
+  if (to_return == item)
+    Py_INCREF(to_return);
+  else
+    Py_INCREF(item);
+
   return to_return;
 }
 
+/*
+ * Push the item onto the heap, taking care of reference counts of the item
+ * pushed and the item evicted from a full heap. The handle of the item is
+ * stored to handle, EHEAPQ_NO_HANDLE if the heap is full and the item was
+ * not pushed. Returns -1 with an exception set on failure.
+ */
+static int ExtHeapQueue_push_handle_impl(ExtHeapQueue *self, PyObject *item, EHeapQHandle *handle) {
+  PyHeapItem evicted = {NULL, 0};
+
+  ExtHeapQueue_track(self, item);
+
+  try {
+      *handle = self->heap->push_handle({item, 0}, &evicted);
+  } catch (ObjCmpErr & exc) {
+      PyErr_SetString(PyExc_ValueError, exc.what());
+      return -1;
+  } catch (EHeapQAlreadyPresent & exc) {
+      PyErr_SetString(PyExc_ValueError, exc.what());
+      return -1;
+  }
+
+  if (*handle != EHEAPQ_NO_HANDLE)
+    Py_INCREF(item);
+
+  Py_XDECREF(evicted.item);
+  return 0;
+}
+
 static PyObject * ExtHeapQueue_push(ExtHeapQueue *self, PyObject *args) {
   PyObject *item;
+  EHeapQHandle handle;
+
+  if (!PyArg_ParseTuple(args, "O", &item))
+    return NULL;
+
+  if (ExtHeapQueue_push_handle_impl(self, item, &handle) < 0)
+    return NULL;
+
+  Py_RETURN_NONE;
+}
+
+static PyObject * ExtHeapQueue_would_accept(ExtHeapQueue *self, PyObject *args) {
+  PyObject *item;
+  bool accept;
 
   if (!PyArg_ParseTuple(args, "O", &item))
     return NULL;
 
+  ExtHeapQueue_track(self, item);
+
   try {
-      self->heap->push(item);
+      accept = self->heap->would_accept({item, 0});
   } catch (ObjCmpErr & exc) {
       PyErr_SetString(PyExc_ValueError, exc.what());
       return NULL;
-  } catch (EHeapQAlreadyPresent & exc) {
-      PyErr_SetString(PyExc_ValueError, exc.what());
-      return NULL;
   }
 
-  Py_INCREF(item);
-  Py_RETURN_NONE;
+  return PyBool_FromLong(long(accept));
+}
+
+static PyObject * ExtHeapQueue_push_handle(ExtHeapQueue *self, PyObject *args) {
+  PyObject *item;
+  EHeapQHandle handle;
+
+  if (!PyArg_ParseTuple(args, "O", &item))
+    return NULL;
+
+  if (ExtHeapQueue_push_handle_impl(self, item, &handle) < 0)
+    return NULL;
+
+  if (handle == EHEAPQ_NO_HANDLE)
+    Py_RETURN_NONE;
+
+  return PyLong_FromUnsignedLongLong(handle);
 }
 
 static PyObject * ExtHeapQueue_pop(ExtHeapQueue *self) {
   PyObject * item;
 
   try {
-      item = self->heap->pop();
+      item = self->heap->pop().item;
+  } catch (ObjCmpErr & exc) {
+      PyErr_SetString(PyExc_ValueError, exc.what());
+      return NULL;
   } catch (EHeapQEmpty & exc) {
       PyErr_SetString(PyExc_KeyError, exc.what());
       return NULL;
@@ -197,8 +524,16 @@ static PyObject *ExtHeapQueue_remove(ExtHeapQueue *self, PyObject *args) {
   if (!PyArg_ParseTuple(args, "O", &item))
     return NULL;
 
+  if (!self->heap->get_index().get_unique()) {
+    PyErr_SetString(PyExc_ValueError, "items of a heap with non-unique items can be removed only using handles");
+    return NULL;
+  }
+
   try {
-      self->heap->remove(item);
+      self->heap->remove({item, 0});
+  } catch (ObjCmpErr & exc) {
+      PyErr_SetString(PyExc_ValueError, exc.what());
+      return NULL;
   } catch (EHeapQEmpty & exc) {
       PyErr_SetString(PyExc_KeyError, exc.what());
       return NULL;
@@ -207,118 +542,2019 @@ static PyObject *ExtHeapQueue_remove(ExtHeapQueue *self, PyObject *args) {
       return NULL;
   }
 
-  Py_DECREF(item);
+  // Items removed lazily are released by ExtHeapQueue_dispose.
+  if (!self->heap->get_lazy())
+    Py_DECREF(item);
   Py_RETURN_NONE;
 }
 
-static PyObject *ExtHeapQueue_replace(ExtHeapQueue *self, PyObject *args) {
-  PyObject *item;
-  PyObject * result;
+static int ExtHeapQueue_parse_handle(PyObject *args, EHeapQHandle *handle) {
+  unsigned long long value;
 
-  if (!PyArg_ParseTuple(args, "O", &item))
-    return NULL;
+  if (!PyArg_ParseTuple(args, "K", &value))
+    return -1;
 
-  Py_INCREF(item);
+  *handle = value;
+  return 0;
+}
+
+static PyObject *ExtHeapQueue_remove_handle(ExtHeapQueue *self, PyObject *args) {
+  EHeapQHandle handle;
+  PyObject *item = NULL;
+
+  if (ExtHeapQueue_parse_handle(args, &handle) < 0)
+    return NULL;
 
   try {
-      result = self->heap->replace(item);
+      if (self->heap->get_lazy()) {
+        // The reference held by the heap is released by ExtHeapQueue_dispose, possibly right away.
+        item = self->heap->get_item(handle).item;
+        Py_INCREF(item);
+        self->heap->remove_handle(handle);
+      } else {
+        // The reference held by the heap is passed to the caller.
+        item = self->heap->remove_handle(handle).item;
+      }
   } catch (ObjCmpErr & exc) {
       PyErr_SetString(PyExc_ValueError, exc.what());
-      return NULL;
-  } catch (EHeapQEmpty & exc) {
-      PyErr_SetString(PyExc_KeyError, exc.what());
+      if (self->heap->get_lazy())
+        Py_XDECREF(item);
       return NULL;
   } catch (EHeapQNotFound & exc) {
       PyErr_SetString(PyExc_ValueError, exc.what());
       return NULL;
-  } catch (EHeapQAlreadyPresent & exc) {
+  }
+
+  return item;
+}
+
+static PyObject *ExtHeapQueue_update(ExtHeapQueue *self, PyObject *args) {
+  PyObject *item;
+  if (!PyArg_ParseTuple(args, "O", &item))
+    return NULL;
+
+  if (!self->heap->get_index().get_unique()) {
+    PyErr_SetString(PyExc_ValueError, "items of a heap with non-unique items can be updated only using handles");
+    return NULL;
+  }
+
+  try {
+      self->heap->update({item, 0});
+  } catch (ObjCmpErr & exc) {
+      PyErr_SetString(PyExc_ValueError, exc.what());
+      return NULL;
+  } catch (EHeapQNotFound & exc) {
       PyErr_SetString(PyExc_ValueError, exc.what());
       return NULL;
   }
 
-  return result;
+  Py_RETURN_NONE;
 }
 
-static PyObject *ExtHeapQueue_max(ExtHeapQueue *self) {
-    PyObject * item;
+static PyObject *ExtHeapQueue_update_handle(ExtHeapQueue *self, PyObject *args) {
+  EHeapQHandle handle;
 
-    try {
-        item = self->heap->get_max();
-    } catch (EHeapQEmpty & exc) {
-        PyErr_SetString(PyExc_KeyError, exc.what());
-        return NULL;
-    }
+  if (ExtHeapQueue_parse_handle(args, &handle) < 0)
+    return NULL;
 
-    Py_INCREF(item);
-    return item;
-}
+  try {
+      self->heap->update_handle(handle, self->heap->get_item(handle));
+  } catch (ObjCmpErr & exc) {
+      PyErr_SetString(PyExc_ValueError, exc.what());
+      return NULL;
+  } catch (EHeapQNotFound & exc) {
+      PyErr_SetString(PyExc_ValueError, exc.what());
+      return NULL;
+  }
 
-static PyObject *ExtHeapQueue_getsize(ExtHeapQueue *self) {
-  return PyLong_FromUnsignedLong(self->heap->get_size());
+  Py_RETURN_NONE;
 }
 
-static long int ExtHeapQueue_len(PyObject *self) {
-  return ((ExtHeapQueue *)self)->heap->get_length();
-}
+// Copy the heap, the copy holds its own references to items (including items removed lazily).
+static PyObject *ExtHeapQueue_copy(ExtHeapQueue *self) {
+  ExtHeapQueue *copy;
+  PyHeapQ *heap;
 
-static PySequenceMethods ExtHeapQueue_sequence_methods[] = {
-    ExtHeapQueue_len, // sq_length
-    {NULL}
-};
+  try {
+    heap = new PyHeapQ(*self->heap);
+  } catch (std::bad_alloc & exc) {
+    return PyErr_NoMemory();
+  }
 
-static PyMethodDef ExtHeapQueue_methods[] = {
-    {"push", (PyCFunction)ExtHeapQueue_push, METH_VARARGS, "Push item onto heap, maintaining the heap invariant."},
-    {"pushpop", (PyCFunction)ExtHeapQueue_pushpop, METH_VARARGS,
-     "Push item on the heap, then pop and return the smallest item from the "
-     "heap. The combined action runs more efficiently than heappush() followed "
-     "by a separate call tprint(a.get_size())o heappop()."},
-    {"pop", (PyCFunction)ExtHeapQueue_pop, METH_NOARGS, "Pops top item from the heap."},
-    {"replace", (PyCFunction)ExtHeapQueue_replace, METH_VARARGS, "Pops top item, and adds new item; the heap size is unchanged."},
-    {"get_top", (PyCFunction)ExtHeapQueue_top, METH_NOARGS, "Gets top item from the heap, the heap is untouched."},
-    {"get_last", (PyCFunction)ExtHeapQueue_last, METH_NOARGS, "Get last item added, if the item is still present in the heap."},
-    {"get_max", (PyCFunction)ExtHeapQueue_max, METH_NOARGS, "Retrieve maximum stored in the min-heapq, in O(N/2)."},
-    {"remove", (PyCFunction)ExtHeapQueue_remove, METH_VARARGS, "Remove the given item, in O(log(N))."},
-    {NULL}
-};
+  copy = (ExtHeapQueue *)Py_TYPE(self)->tp_alloc(Py_TYPE(self), 0);
+  if (!copy) {
+    delete heap;
+    return NULL;
+  }
 
-static PyGetSetDef ExtHeapQueue_getsetters[] = {
-    {"size", (getter)ExtHeapQueue_getsize, NULL, "Max size of the heap.", NULL},
-    {NULL} /* Sentinel */
-};
+  copy->heap = heap;
+  for (auto i : *(copy->heap->get_items()))
+    Py_XINCREF(i.item);
 
-PyMODINIT_FUNC PyInit_eheapq(void) {
-  static PyTypeObject ExtMinHeapQueueType = {PyVarObject_HEAD_INIT(NULL, 0)};
-  ExtMinHeapQueueType.tp_name = "eheapq.ExtHeapQueue";
-  ExtMinHeapQueueType.tp_doc = "Extended heap queue algorithm.";
-  ExtMinHeapQueueType.tp_basicsize = sizeof(ExtHeapQueue);
-  ExtMinHeapQueueType.tp_itemsize = 0;
-  ExtMinHeapQueueType.tp_flags = Py_TPFLAGS_DEFAULT | Py_TPFLAGS_BASETYPE | Py_TPFLAGS_HAVE_GC;
-  ExtMinHeapQueueType.tp_new = ExtHeapQueue_new;
-  ExtMinHeapQueueType.tp_as_sequence = ExtHeapQueue_sequence_methods;
-  ExtMinHeapQueueType.tp_init = (initproc)ExtHeapQueue_init;
-  ExtMinHeapQueueType.tp_dealloc = (destructor)ExtHeapQueue_dealloc;
-  ExtMinHeapQueueType.tp_traverse = (traverseproc)ExtHeapQueue_traverse;
-  ExtMinHeapQueueType.tp_clear = (inquiry)ExtHeapQueue_clear;
-  ExtMinHeapQueueType.tp_methods = ExtHeapQueue_methods;
-  ExtMinHeapQueueType.tp_getset = ExtHeapQueue_getsetters;
+  return (PyObject *)copy;
+}
 
-  static PyModuleDef eheapq = {PyModuleDef_HEAD_INIT};
-  eheapq.m_name = "eheapq";
-  eheapq.m_doc = "Implementation of extended heap queues.";
-  eheapq.m_size = -1;
+/*
+ * Pickle live items in the order of the heap storage, so that unpickling
+ * does not compare them unless items were removed lazily. Handles are not
+ * preserved.
+ */
+static PyObject *ExtHeapQueue_reduce_ex(ExtHeapQueue *self, PyObject *args) {
+  auto storage = self->heap->get_items();
+  PyObject *items, *last = NULL;
+  Py_ssize_t last_pos = -1, pos = 0;
+  int protocol;
 
-  PyObject *m;
-  if (PyType_Ready(&ExtMinHeapQueueType) < 0)
+  if (!PyArg_ParseTuple(args, "i", &protocol))
     return NULL;
 
-  m = PyModule_Create(&eheapq);
-  if (!m)
+  try {
+    last = self->heap->get_last().item;
+  } catch (EHeapQException & exc) {
+    // No last item to restore.
+  }
+
+  items = PyList_New(self->heap->get_length());
+  if (!items)
     return NULL;
 
-  Py_INCREF(&ExtMinHeapQueueType);
-  if (PyModule_AddObject(m, "ExtHeapQueue", (PyObject *)&ExtMinHeapQueueType) <
-      0) {
-    Py_DECREF(&ExtMinHeapQueueType);
+  for (size_t i = 0; i < storage->size(); i++) {
+    if (!self->heap->is_live(i))
+      continue;
+
+    PyObject * item = storage->get(i).item;
+    if (item == last && last_pos < 0)
+      last_pos = pos;
+
+    Py_INCREF(item);
+    PyList_SET_ITEM(items, pos++, item);
+  }
+
+  return Py_BuildValue("O(kkOOd)(NnO)", Py_TYPE(self), self->heap->get_size(), self->heap->get_arity(),
+                       self->heap->get_index().get_unique() ? Py_True : Py_False,
+                       self->heap->get_lazy() ? Py_True : Py_False, self->heap->get_compaction_threshold(),
+                       items, last_pos, self->heap->get_dead_count() == 0 ? Py_True : Py_False);
+}
+
+static PyObject *ExtHeapQueue_setstate(ExtHeapQueue *self, PyObject *state) {
+  PyObject *items;
+  Py_ssize_t last_pos;
+  int ordered;
+
+  if (!PyArg_ParseTuple(state, "O!np", &PyList_Type, &items, &last_pos, &ordered))
+    return NULL;
+
+  if (size_t(PyList_GET_SIZE(items)) > self->heap->get_size()) {
+    PyErr_SetString(PyExc_ValueError, "the state does not fit the heap size");
+    return NULL;
+  }
+
+  // Checked before the comparison of items stored is reset by tracking new ones.
+  if (self->heap->get_items()->size() != 0) {
+    PyErr_SetString(PyExc_ValueError, EHeapQNotEmptyExc.what());
+    return NULL;
+  }
+
+  for (Py_ssize_t i = 0; i < PyList_GET_SIZE(items); i++)
+    self->heap->get_compare().track(PyList_GET_ITEM(items, i), i == 0);
+
+  // References are borrowed from the list until the heap is restored.
+  PyObject ** first = PySequence_Fast_ITEMS(items);
+  size_t arity = self->heap->get_arity();
+
+  /*
+   * The state is not trusted to be in the heap order, it is rebuilt if it
+   * is not. If items fail to compare, restoring reports it (or finds
+   * duplicate items first).
+   */
+  try {
+    for (Py_ssize_t i = 1; ordered && i < PyList_GET_SIZE(items); i++) {
+      if (self->heap->get_compare()(first[i], first[(i - 1) / arity]))
+        ordered = false;
+    }
+  } catch (ObjCmpErr & exc) {
+    PyErr_Clear();
+    ordered = false;
+  }
+
+  self->heap->set_dispose(nullptr);
+  try {
+    self->heap->restore(first, first + PyList_GET_SIZE(items), ordered, last_pos < 0 ? EHEAPQ_NPOS : size_t(last_pos));
+  } catch (ObjCmpErr & exc) {
+    self->heap->set_dispose(ExtHeapQueue_dispose);
+    PyErr_SetString(PyExc_ValueError, exc.what());
+    return NULL;
+  } catch (EHeapQException & exc) {
+    self->heap->set_dispose(ExtHeapQueue_dispose);
+    PyErr_SetString(PyExc_ValueError, exc.what());
+    return NULL;
+  }
+
+  self->heap->set_dispose(ExtHeapQueue_dispose);
+  for (auto i : *(self->heap->get_items()))
+    Py_INCREF(i.item);
+
+  Py_RETURN_NONE;
+}
+
+static PyObject *ExtHeapQueue_get_item(ExtHeapQueue *self, PyObject *args) {
+  EHeapQHandle handle;
+  PyObject * item;
+
+  if (ExtHeapQueue_parse_handle(args, &handle) < 0)
+    return NULL;
+
+  try {
+      item = self->heap->get_item(handle).item;
+  } catch (EHeapQNotFound & exc) {
+      PyErr_SetString(PyExc_ValueError, exc.what());
+      return NULL;
+  }
+
+  Py_INCREF(item);
+  return item;
+}
+
+static PyObject *ExtHeapQueue_replace(ExtHeapQueue *self, PyObject *args) {
+  PyObject *item;
+  PyObject * result;
+
+  if (!PyArg_ParseTuple(args, "O", &item))
+    return NULL;
+
+  ExtHeapQueue_track(self, item);
+
+  try {
+      result = self->heap->replace({item, 0}).item;
+  } catch (ObjCmpErr & exc) {
+      PyErr_SetString(PyExc_ValueError, exc.what());
+      return NULL;
+  } catch (EHeapQEmpty & exc) {
+      PyErr_SetString(PyExc_KeyError, exc.what());
+      return NULL;
+  } catch (EHeapQNotFound & exc) {
+      PyErr_SetString(PyExc_ValueError, exc.what());
+      return NULL;
+  } catch (EHeapQAlreadyPresent & exc) {
+      PyErr_SetString(PyExc_ValueError, exc.what());
+      return NULL;
+  }
+
+  // The reference held by the heap is passed to the caller.
+  Py_INCREF(item);
+  return result;
+}
+
+static PyObject *ExtHeapQueue_max(ExtHeapQueue *self) {
+    PyObject * item;
+
+    try {
+        item = self->heap->get_max().item;
+    } catch (EHeapQEmpty & exc) {
+        PyErr_SetString(PyExc_KeyError, exc.what());
+        return NULL;
+    }
+
+    Py_INCREF(item);
+    return item;
+}
+
+/*
+ * Add items of the given sequence to the heap using push_many(), batches at
+ * least as large as the heap are added using heapify(), smaller ones item
+ * by item. Returns -1 with an exception set on failure, no item is added
+ * then.
+ */
+static int ExtHeapQueue_push_many_impl(ExtHeapQueue *self, PyObject *seq) {
+  std::vector<PyHeapItem> items, evicted;
+  bool empty = self->heap->get_length() == 0;
+
+  items.reserve(PySequence_Fast_GET_SIZE(seq));
+  for (Py_ssize_t i = 0; i < PySequence_Fast_GET_SIZE(seq); i++) {
+    PyObject *item = PySequence_Fast_GET_ITEM(seq, i);
+
+    self->heap->get_compare().track(item, empty && i == 0);
+    Py_INCREF(item);
+    items.push_back({item, 0});
+  }
+
+  try {
+      self->heap->push_many(items.begin(), items.end(), &evicted);
+  } catch (ObjCmpErr & exc) {
+      PyErr_SetString(PyExc_ValueError, exc.what());
+      for (auto i : items)
+        Py_DECREF(i.item);
+      return -1;
+  } catch (EHeapQAlreadyPresent & exc) {
+      PyErr_SetString(PyExc_ValueError, exc.what());
+      for (auto i : items)
+        Py_DECREF(i.item);
+      return -1;
+  }
+
+  for (auto i : evicted)
+    Py_DECREF(i.item);
+
+  return 0;
+}
+
+static PyObject *ExtHeapQueue_from_iterable(PyObject *cls, PyObject *args, PyObject *kwds) {
+  static char *kwlist[] = {"iterable", "size", "arity", "unique", "lazy", "compaction_threshold", NULL};
+  PyObject *iterable, *seq, *result;
+
+  size_t size = EHEAPQ_DEFAULT_SIZE;
+  size_t arity = EHEAPQ_DEFAULT_ARITY;
+  int unique = 1;
+  int lazy = 0;
+  double compaction_threshold = EHEAPQ_DEFAULT_COMPACTION_THRESHOLD;
+
+  if (!PyArg_ParseTupleAndKeywords(args, kwds, "O|kkppd", kwlist, &iterable, &size, &arity, &unique, &lazy,
+                                   &compaction_threshold))
+    return NULL;
+
+  seq = PySequence_Fast(iterable, "expected an iterable");
+  if (!seq)
+    return NULL;
+
+  result = PyObject_CallFunction(cls, "kkOOd", size, arity, unique ? Py_True : Py_False, lazy ? Py_True : Py_False,
+                                 compaction_threshold);
+  if (result && ExtHeapQueue_push_many_impl((ExtHeapQueue *)result, seq) < 0)
+    Py_CLEAR(result);
+
+  Py_DECREF(seq);
+  return result;
+}
+
+static PyObject *ExtHeapQueue_push_many(ExtHeapQueue *self, PyObject *args) {
+  PyObject *iterable, *seq;
+  int ret;
+
+  if (!PyArg_ParseTuple(args, "O", &iterable))
+    return NULL;
+
+  seq = PySequence_Fast(iterable, "expected an iterable");
+  if (!seq)
+    return NULL;
+
+  ret = ExtHeapQueue_push_many_impl(self, seq);
+  Py_DECREF(seq);
+  if (ret < 0)
+    return NULL;
+
+  Py_RETURN_NONE;
+}
+
+static PyObject *ExtHeapQueue_pop_many(ExtHeapQueue *self, PyObject *args) {
+  Py_ssize_t count;
+  PyObject *result;
+
+  if (!PyArg_ParseTuple(args, "n", &count))
+    return NULL;
+
+  if (count < 0) {
+    PyErr_SetString(PyExc_ValueError, "count cannot be negative");
+    return NULL;
+  }
+
+  count = std::min(count, Py_ssize_t(self->heap->get_length()));
+  result = PyList_New(count);
+  if (!result)
+    return NULL;
+
+  // The references held by the heap are passed to the list, no item is popped if a comparison fails.
+  try {
+      Py_ssize_t i = 0;
+      for (auto item : self->heap->pop_many(count))
+        PyList_SET_ITEM(result, i++, item.item);
+  } catch (ObjCmpErr & exc) {
+      PyErr_SetString(PyExc_ValueError, exc.what());
+      Py_DECREF(result);
+      return NULL;
+  }
+
+  return result;
+}
+
+static PyObject *ExtHeapQueue_peek_n(ExtHeapQueue *self, PyObject *args) {
+  Py_ssize_t count;
+  PyObject *result;
+  std::vector<PyHeapItem> items;
+
+  if (!PyArg_ParseTuple(args, "n", &count))
+    return NULL;
+
+  if (count < 0) {
+    PyErr_SetString(PyExc_ValueError, "count cannot be negative");
+    return NULL;
+  }
+
+  try {
+      items = self->heap->top_k(count);
+  } catch (ObjCmpErr & exc) {
+      PyErr_SetString(PyExc_ValueError, exc.what());
+      return NULL;
+  }
+
+  result = PyList_New(items.size());
+  if (!result)
+    return NULL;
+
+  for (size_t i = 0; i < items.size(); i++) {
+    Py_INCREF(items[i].item);
+    PyList_SET_ITEM(result, i, items[i].item);
+  }
+
+  return result;
+}
+
+/*
+ * An iterator over live items of ExtHeapQueue, either in the order of the
+ * heap storage or, with the cursor set, in the order items would be popped.
+ * Items are not copied, the iterator holds a reference to the heap.
+ */
+typedef struct {
+  PyObject_HEAD
+  ExtHeapQueue * heap;
+  PyHeapQ::SortedCursor * cursor;
+  size_t pos;
+  // Modifications of the heap when the iteration started, any change of the heap ends the iteration.
+  size_t modifications;
+} ExtHeapQueueIterator;
+
+static PyTypeObject ExtHeapQueueIteratorType = {PyVarObject_HEAD_INIT(NULL, 0)};
+
+static PyObject * ExtHeapQueueIterator_create(ExtHeapQueue *heap, bool sorted) {
+  ExtHeapQueueIterator *self = PyObject_GC_New(ExtHeapQueueIterator, &ExtHeapQueueIteratorType);
+  if (!self)
+    return NULL;
+
+  Py_INCREF(heap);
+  self->heap = heap;
+  self->cursor = sorted ? new PyHeapQ::SortedCursor(heap->heap->iter_sorted()) : NULL;
+  self->pos = 0;
+  self->modifications = heap->heap->get_modifications();
+
+  PyObject_GC_Track(self);
+  return (PyObject *)self;
+}
+
+static int ExtHeapQueueIterator_traverse(ExtHeapQueueIterator *self, visitproc visit, void *arg) {
+  Py_VISIT(self->heap);
+  return 0;
+}
+
+// Release the heap once the iteration is done.
+static void ExtHeapQueueIterator_finish(ExtHeapQueueIterator *self) {
+  delete self->cursor;
+  self->cursor = NULL;
+  Py_CLEAR(self->heap);
+}
+
+static void ExtHeapQueueIterator_dealloc(ExtHeapQueueIterator *self) {
+  PyObject_GC_UnTrack(self);
+  ExtHeapQueueIterator_finish(self);
+  PyObject_GC_Del(self);
+}
+
+static PyObject * ExtHeapQueueIterator_next(ExtHeapQueueIterator *self) {
+  PyHeapItem item;
+
+  if (!self->heap)
+    return NULL;
+
+  auto storage = self->heap->heap->get_items();
+  if (self->heap->heap->get_modifications() != self->modifications) {
+    ExtHeapQueueIterator_finish(self);
+    PyErr_SetString(PyExc_RuntimeError, "the heap changed during iteration");
+    return NULL;
+  }
+
+  if (self->cursor) {
+    try {
+      if (!self->cursor->next(item)) {
+        ExtHeapQueueIterator_finish(self);
+        return NULL;
+      }
+    } catch (ObjCmpErr & exc) {
+      ExtHeapQueueIterator_finish(self);
+      PyErr_SetString(PyExc_ValueError, exc.what());
+      return NULL;
+    }
+  } else {
+    while (self->pos < storage->size() && !self->heap->heap->is_live(self->pos))
+      self->pos++;
+
+    if (self->pos == storage->size()) {
+      ExtHeapQueueIterator_finish(self);
+      return NULL;
+    }
+
+    item = storage->get(self->pos++);
+  }
+
+  Py_INCREF(item.item);
+  return item.item;
+}
+
+static PyObject *ExtHeapQueue_iter(ExtHeapQueue *self) {
+  return ExtHeapQueueIterator_create(self, false);
+}
+
+static PyObject *ExtHeapQueue_iter_sorted(ExtHeapQueue *self) {
+  return ExtHeapQueueIterator_create(self, true);
+}
+
+static PyObject *ExtHeapQueue_compact(ExtHeapQueue *self) {
+  try {
+      self->heap->compact();
+  } catch (ObjCmpErr & exc) {
+      PyErr_SetString(PyExc_ValueError, exc.what());
+      return NULL;
+  }
+
+  Py_RETURN_NONE;
+}
+
+static PyTypeObject ExtMinHeapQueueType = {PyVarObject_HEAD_INIT(NULL, 0)};
+
+/*
+ * Move items of the other heap to this heap, references are moved along
+ * with them. Items that did not fit into the heap are released.
+ */
+static PyObject *ExtHeapQueue_merge(ExtHeapQueue *self, PyObject *args) {
+  ExtHeapQueue *other;
+  std::vector<PyHeapItem> evicted;
+  int ret = 0;
+
+  if (!PyArg_ParseTuple(args, "O!", &ExtMinHeapQueueType, &other))
+    return NULL;
+
+  if (other == self)
+    Py_RETURN_NONE;
+
+  auto storage = other->heap->get_items();
+  bool empty = self->heap->get_length() == 0;
+  for (size_t i = 0; i < storage->size(); i++) {
+    if (other->heap->is_live(i)) {
+      self->heap->get_compare().track(storage->get(i).item, empty);
+      empty = false;
+    }
+  }
+
+  try {
+      self->heap->merge(*other->heap, &evicted);
+  } catch (ObjCmpErr & exc) {
+      PyErr_SetString(PyExc_ValueError, exc.what());
+      ret = -1;
+  } catch (EHeapQAlreadyPresent & exc) {
+      PyErr_SetString(PyExc_ValueError, exc.what());
+      ret = -1;
+  }
+
+  for (auto i : evicted)
+    Py_DECREF(i.item);
+
+  if (ret < 0)
+    return NULL;
+
+  Py_RETURN_NONE;
+}
+
+static PyObject *ExtHeapQueue_getsize(ExtHeapQueue *self) {
+  return PyLong_FromUnsignedLong(self->heap->get_size());
+}
+
+static PyObject *ExtHeapQueue_getarity(ExtHeapQueue *self) {
+  return PyLong_FromSize_t(self->heap->get_arity());
+}
+
+static PyObject *ExtHeapQueue_getunique(ExtHeapQueue *self) {
+  return PyBool_FromLong(long(self->heap->get_index().get_unique()));
+}
+
+static PyObject *ExtHeapQueue_getlazy(ExtHeapQueue *self) {
+  return PyBool_FromLong(long(self->heap->get_lazy()));
+}
+
+static long int ExtHeapQueue_len(PyObject *self) {
+  return ((ExtHeapQueue *)self)->heap->get_length();
+}
+
+static PySequenceMethods ExtHeapQueue_sequence_methods[] = {
+    ExtHeapQueue_len, // sq_length
+    {NULL}
+};
+
+static PyMethodDef ExtHeapQueue_methods[] = {
+    {"from_iterable", (PyCFunction)(void (*)(void))ExtHeapQueue_from_iterable, METH_VARARGS | METH_KEYWORDS | METH_CLASS,
+     "Create a heap from items of the given iterable in O(N), only the largest items are kept if size is given."},
+    {"push", (PyCFunction)ExtHeapQueue_push, METH_VARARGS, "Push item onto heap, maintaining the heap invariant."},
+    {"push_handle", (PyCFunction)ExtHeapQueue_push_handle, METH_VARARGS,
+     "Push item onto heap and return its handle, None if the heap is full and the item was not pushed."},
+    {"would_accept", (PyCFunction)ExtHeapQueue_would_accept, METH_VARARGS,
+     "Check whether the item would be pushed - the heap is not full or the item is larger than the top item."},
+    {"pushpop", (PyCFunction)ExtHeapQueue_pushpop, METH_VARARGS,
+     "Push item on the heap, then pop and return the smallest item from the "
+     "heap. The combined action runs more efficiently than heappush() followed "
+     "by a separate call tprint(a.get_size())o heappop()."},
+    {"pop", (PyCFunction)ExtHeapQueue_pop, METH_NOARGS, "Pops top item from the heap."},
+    {"push_many", (PyCFunction)ExtHeapQueue_push_many, METH_VARARGS, "Push all items of the given iterable onto heap."},
+    {"merge", (PyCFunction)ExtHeapQueue_merge, METH_VARARGS,
+     "Move all items of the given heap to this heap, the other heap is left empty. In O(N + M), or O(M) on average if the other heap is smaller."},
+    {"pop_many", (PyCFunction)ExtHeapQueue_pop_many, METH_VARARGS,
+     "Pop up to the given number of top items from the heap, returned as a list."},
+    {"replace", (PyCFunction)ExtHeapQueue_replace, METH_VARARGS, "Pops top item, and adds new item; the heap size is unchanged."},
+    {"get_top", (PyCFunction)ExtHeapQueue_top, METH_NOARGS, "Gets top item from the heap, the heap is untouched."},
+    {"peek_n", (PyCFunction)ExtHeapQueue_peek_n, METH_VARARGS,
+     "Get up to the given number of top items in the order they would be popped, the heap is untouched."},
+    {"iter_sorted", (PyCFunction)ExtHeapQueue_iter_sorted, METH_NOARGS,
+     "Iterate over items in the order they would be popped, the heap is untouched. The first k items take O(k*log(k))."},
+    {"get_last", (PyCFunction)ExtHeapQueue_last, METH_NOARGS, "Get last item added, if the item is still present in the heap."},
+    {"get_max", (PyCFunction)ExtHeapQueue_max, METH_NOARGS, "Retrieve maximum stored in the min-heapq, in O(N/2)."},
+    {"get_item", (PyCFunction)ExtHeapQueue_get_item, METH_VARARGS, "Get item with the given handle, in O(1)."},
+    {"remove", (PyCFunction)ExtHeapQueue_remove, METH_VARARGS, "Remove the given item, in O(log(N)) or amortized O(1) if removed lazily."},
+    {"remove_handle", (PyCFunction)ExtHeapQueue_remove_handle, METH_VARARGS,
+     "Remove and return item with the given handle, in O(log(N))."},
+    {"compact", (PyCFunction)ExtHeapQueue_compact, METH_NOARGS, "Drop items removed lazily and rebuild the heap, in O(N)."},
+    {"update", (PyCFunction)ExtHeapQueue_update, METH_VARARGS,
+     "Restore the heap invariant after the given item was changed, in O(log(N))."},
+    {"update_handle", (PyCFunction)ExtHeapQueue_update_handle, METH_VARARGS,
+     "Restore the heap invariant after item with the given handle was changed, in O(log(N))."},
+    {"copy", (PyCFunction)ExtHeapQueue_copy, METH_NOARGS,
+     "Copy the heap in O(N). Handles are valid in both heaps."},
+    {"__copy__", (PyCFunction)ExtHeapQueue_copy, METH_NOARGS, "Same as copy()."},
+    {"__reduce_ex__", (PyCFunction)ExtHeapQueue_reduce_ex, METH_VARARGS, "Pickle items in the heap order."},
+    {"__setstate__", (PyCFunction)ExtHeapQueue_setstate, METH_O, "Restore pickled items into the empty heap, in O(N)."},
+    {NULL}
+};
+
+static PyGetSetDef ExtHeapQueue_getsetters[] = {
+    {"size", (getter)ExtHeapQueue_getsize, NULL, "Max size of the heap.", NULL},
+    {"arity", (getter)ExtHeapQueue_getarity, NULL, "Number of children of each node in the heap.", NULL},
+    {"unique", (getter)ExtHeapQueue_getunique, NULL, "Flag whether items stored in the heap are unique.", NULL},
+    {"lazy", (getter)ExtHeapQueue_getlazy, NULL, "Flag whether items are removed lazily.", NULL},
+    {NULL} /* Sentinel */
+};
+
+typedef EHeapQPriorityItem<double, PyObject *> PyPriorityItem;
+
+typedef struct {
+  PyObject_HEAD
+  EHeapQ<PyPriorityItem, EHeapQPriorityCompare<double, PyObject *>, EHEAPQ_DYNAMIC_ARITY> * heap;
+} ExtPriorityQueue;
+
+static inline PyObject * ExtPriorityQueue_pack(PyPriorityItem item) {
+  return Py_BuildValue("(dO)", item.priority, item.item);
+}
+
+/* Pack an item removed from the heap, the reference held by the heap is passed to the caller. */
+static inline PyObject * ExtPriorityQueue_pack_owned(PyPriorityItem item) {
+  return Py_BuildValue("(dN)", item.priority, item.item);
+}
+
+static int ExtPriorityQueue_parse(PyObject *args, PyPriorityItem * item) {
+  if (!PyArg_ParseTuple(args, "dO", &item->priority, &item->item))
+    return -1;
+
+  if (std::isnan(item->priority)) {
+    PyErr_SetString(PyExc_ValueError, "priority cannot be NaN");
+    return -1;
+  }
+
+  return 0;
+}
+
+static int ExtPriorityQueue_traverse(ExtPriorityQueue *self, visitproc visit, void *arg) {
+  for (auto i : *(self->heap->get_items()))
+    Py_VISIT(i.item);
+
+  return 0;
+}
+
+static int ExtPriorityQueue_clear(ExtPriorityQueue *self) {
+  std::vector<PyPriorityItem> items;
+
+  // Items are detached first, so that finalizers run by Py_DECREF see a consistent heap.
+  self->heap->detach(items);
+  for (auto & i : items)
+    Py_DECREF(i.item);
+
+  return 0;
+}
+
+static void ExtPriorityQueue_dealloc(ExtPriorityQueue *self) {
+  PyObject_GC_UnTrack(self);
+  ExtPriorityQueue_clear(self);
+  delete self->heap;
+  Py_TYPE(self)->tp_free((PyObject *)self);
+}
+
+static PyObject * ExtPriorityQueue_new(PyTypeObject *type, PyObject *args, PyObject *kwds) {
+  static char *kwlist[] = {"size", "arity", NULL};
+  ExtPriorityQueue *self;
+
+  size_t size = EHEAPQ_DEFAULT_SIZE;
+  size_t arity = EHEAPQ_DEFAULT_ARITY;
+
+  if (!PyArg_ParseTupleAndKeywords(args, kwds, "|kk", kwlist, &size, &arity))
+    return NULL;
+
+  if (arity < 2 || arity > EHEAPQ_MAX_ARITY) {
+    PyErr_SetString(PyExc_ValueError, EHeapQInvalidArityExc.what());
+    return NULL;
+  }
+
+  self = (ExtPriorityQueue *)type->tp_alloc(type, 0);
+  self->heap = new EHeapQ<PyPriorityItem, EHeapQPriorityCompare<double, PyObject *>, EHEAPQ_DYNAMIC_ARITY>(size, arity);
+  return (PyObject *)self;
+}
+
+static int ExtPriorityQueue_init(ExtPriorityQueue *self, PyObject *args, PyObject *kwds) {
+  static char *kwlist[] = {"size", "arity", NULL};
+
+  size_t size = self->heap->get_size();
+  size_t arity = self->heap->get_arity();
+
+  // Arity is handled when the heap is created in ExtPriorityQueue_new.
+  if (!PyArg_ParseTupleAndKeywords(args, kwds, "|kk", kwlist, &size, &arity))
+    return -1;
+
+  self->heap->set_size(size);
+  return 0;
+}
+
+static PyObject * ExtPriorityQueue_top(ExtPriorityQueue *self) {
+  try {
+    return ExtPriorityQueue_pack(self->heap->get_top());
+  } catch (EHeapQEmpty & exc) {
+    PyErr_SetString(PyExc_KeyError, exc.what());
+    return NULL;
+  }
+}
+
+static PyObject * ExtPriorityQueue_last(ExtPriorityQueue *self) {
+  try {
+    return ExtPriorityQueue_pack(self->heap->get_last());
+  } catch (EHeapQNoLast & exc) {
+    Py_RETURN_NONE;
+  } catch (EHeapQEmpty & exc) {
+    PyErr_SetString(PyExc_KeyError, exc.what());
+    return NULL;
+  }
+}
+
+static PyObject * ExtPriorityQueue_pushpop(ExtPriorityQueue *self, PyObject *args) {
+  PyPriorityItem item, to_return;
+
+  if (ExtPriorityQueue_parse(args, &item) < 0)
+    return NULL;
+
+  try {
+    to_return = self->heap->pushpop(item);
+  } catch (EHeapQAlreadyPresent & exc) {
+    PyErr_SetString(PyExc_ValueError, exc.what());
+    return NULL;
+  }
+
+  if (to_return.item == item.item)
+    return ExtPriorityQueue_pack(to_return);
+
+  Py_INCREF(item.item);
+  return ExtPriorityQueue_pack_owned(to_return);
+}
+
+static PyObject * ExtPriorityQueue_push(ExtPriorityQueue *self, PyObject *args) {
+  PyPriorityItem item, evicted = {0.0, NULL};
+
+  if (ExtPriorityQueue_parse(args, &item) < 0)
+    return NULL;
+
+  try {
+    // A full heap rejects items not better than the top one before hashing them.
+    if (!self->heap->push(item, &evicted))
+      Py_RETURN_NONE;
+  } catch (EHeapQAlreadyPresent & exc) {
+    PyErr_SetString(PyExc_ValueError, exc.what());
+    return NULL;
+  }
+
+  Py_XDECREF(evicted.item);
+  Py_INCREF(item.item);
+  Py_RETURN_NONE;
+}
+
+static PyObject * ExtPriorityQueue_would_accept(ExtPriorityQueue *self, PyObject *args) {
+  PyPriorityItem item = {0.0, NULL};
+
+  if (!PyArg_ParseTuple(args, "d", &item.priority))
+    return NULL;
+
+  if (std::isnan(item.priority)) {
+    PyErr_SetString(PyExc_ValueError, "priority cannot be NaN");
+    return NULL;
+  }
+
+  return PyBool_FromLong(long(self->heap->would_accept(item)));
+}
+
+/*
+ * The priority an item has to exceed to be stored, the priority of the top
+ * item of a full heap. None if the heap is not full.
+ */
+static PyObject * ExtPriorityQueue_getadmission_threshold(ExtPriorityQueue *self) {
+  if (self->heap->get_length() < self->heap->get_size())
+    Py_RETURN_NONE;
+
+  if (self->heap->get_length() == 0)
+    return PyFloat_FromDouble(std::numeric_limits<double>::infinity());
+
+  return PyFloat_FromDouble(self->heap->get_top().priority);
+}
+
+static PyObject * ExtPriorityQueue_pop(ExtPriorityQueue *self) {
+  try {
+    return ExtPriorityQueue_pack_owned(self->heap->pop());
+  } catch (EHeapQEmpty & exc) {
+    PyErr_SetString(PyExc_KeyError, exc.what());
+    return NULL;
+  }
+}
+
+static PyObject *ExtPriorityQueue_remove(ExtPriorityQueue *self, PyObject *args) {
+  PyPriorityItem item = {0.0, NULL};
+
+  if (!PyArg_ParseTuple(args, "O", &item.item))
+    return NULL;
+
+  try {
+    self->heap->remove(item);
+  } catch (EHeapQNotFound & exc) {
+    PyErr_SetString(PyExc_ValueError, exc.what());
+    return NULL;
+  }
+
+  Py_DECREF(item.item);
+  Py_RETURN_NONE;
+}
+
+static PyObject *ExtPriorityQueue_update(ExtPriorityQueue *self, PyObject *args) {
+  PyPriorityItem item;
+
+  if (ExtPriorityQueue_parse(args, &item) < 0)
+    return NULL;
+
+  try {
+    self->heap->update(item);
+  } catch (EHeapQNotFound & exc) {
+    PyErr_SetString(PyExc_ValueError, exc.what());
+    return NULL;
+  }
+
+  Py_RETURN_NONE;
+}
+
+static PyObject *ExtPriorityQueue_replace(ExtPriorityQueue *self, PyObject *args) {
+  PyPriorityItem item, result;
+
+  if (ExtPriorityQueue_parse(args, &item) < 0)
+    return NULL;
+
+  try {
+    result = self->heap->replace(item);
+  } catch (EHeapQEmpty & exc) {
+    PyErr_SetString(PyExc_KeyError, exc.what());
+    return NULL;
+  } catch (EHeapQAlreadyPresent & exc) {
+    PyErr_SetString(PyExc_ValueError, exc.what());
+    return NULL;
+  }
+
+  Py_INCREF(item.item);
+  return ExtPriorityQueue_pack_owned(result);
+}
+
+static PyObject *ExtPriorityQueue_max(ExtPriorityQueue *self) {
+  try {
+    return ExtPriorityQueue_pack(self->heap->get_max());
+  } catch (EHeapQEmpty & exc) {
+    PyErr_SetString(PyExc_KeyError, exc.what());
+    return NULL;
+  }
+}
+
+/*
+ * A snapshot record of ExtPriorityQueue, the item is serialized to the
+ * payload section of the snapshot.
+ */
+struct PyPriorityRecord {
+  double priority;
+  uint64_t offset;
+  uint64_t length;
+};
+
+// Release an item decoded from a snapshot that failed to load.
+static void ExtPriorityQueue_dispose(PyPriorityItem & item) {
+  Py_DECREF(item.item);
+}
+
+/*
+ * The given callback or the pickle function of the given name if the
+ * callback is None, returns a new reference.
+ */
+static PyObject * ExtPriorityQueue_serializer(PyObject * callback, const char * name) {
+  PyObject *pickle, *result;
+
+  if (callback && callback != Py_None) {
+    Py_INCREF(callback);
+    return callback;
+  }
+
+  pickle = PyImport_ImportModule("pickle");
+  if (!pickle)
+    return NULL;
+
+  result = PyObject_GetAttrString(pickle, name);
+  Py_DECREF(pickle);
+  return result;
+}
+
+// Set the Python exception for a failed save or load, called from a catch block.
+static void ExtPriorityQueue_snapshot_error(PyObject * path) {
+  try {
+    throw;
+  } catch (PyCallErr & exc) {
+    // Already set.
+  } catch (std::system_error & exc) {
+    errno = exc.code().value();
+    PyErr_SetFromErrnoWithFilenameObject(PyExc_OSError, path);
+  } catch (EHeapQException & exc) {
+    PyErr_SetString(PyExc_ValueError, exc.what());
+  } catch (std::bad_alloc & exc) {
+    PyErr_NoMemory();
+  } catch (std::exception & exc) {
+    PyErr_SetString(PyExc_RuntimeError, exc.what());
+  }
+}
+
+static PyObject *ExtPriorityQueue_dump(ExtPriorityQueue *self, PyObject *args, PyObject *kwds) {
+  static char *kwlist[] = {"path", "serializer", NULL};
+  PyObject *path, *encoded_path, *serializer = NULL;
+
+  if (!PyArg_ParseTupleAndKeywords(args, kwds, "O|O", kwlist, &path, &serializer))
+    return NULL;
+
+  if (!PyUnicode_FSConverter(path, &encoded_path))
+    return NULL;
+
+  serializer = ExtPriorityQueue_serializer(serializer, "dumps");
+  if (!serializer) {
+    Py_DECREF(encoded_path);
+    return NULL;
+  }
+
+  try {
+    self->heap->save<PyPriorityRecord>(PyBytes_AS_STRING(encoded_path), [serializer](const PyPriorityItem & item, EHeapQSnapshotWriter & writer) {
+      PyPriorityRecord record = {item.priority, 0, 0};
+      PyObject * data = PyObject_CallFunctionObjArgs(serializer, item.item, NULL);
+
+      if (!data)
+        throw PyCallErrExc;
+
+      if (!PyBytes_Check(data)) {
+        Py_DECREF(data);
+        PyErr_SetString(PyExc_TypeError, "the serializer has to return bytes");
+        throw PyCallErrExc;
+      }
+
+      record.length = PyBytes_GET_SIZE(data);
+      try {
+        record.offset = writer.write_payload(PyBytes_AS_STRING(data), record.length);
+      } catch (...) {
+        Py_DECREF(data);
+        throw;
+      }
+
+      Py_DECREF(data);
+      return record;
+    });
+  } catch (...) {
+    ExtPriorityQueue_snapshot_error(path);
+    Py_DECREF(serializer);
+    Py_DECREF(encoded_path);
+    return NULL;
+  }
+
+  Py_DECREF(serializer);
+  Py_DECREF(encoded_path);
+  Py_RETURN_NONE;
+}
+
+static PyObject *ExtPriorityQueue_load(PyObject *cls, PyObject *args, PyObject *kwds) {
+  static char *kwlist[] = {"path", "deserializer", NULL};
+  PyObject *path, *encoded_path, *deserializer = NULL;
+  ExtPriorityQueue *result;
+
+  if (!PyArg_ParseTupleAndKeywords(args, kwds, "O|O", kwlist, &path, &deserializer))
+    return NULL;
+
+  if (!PyUnicode_FSConverter(path, &encoded_path))
+    return NULL;
+
+  deserializer = ExtPriorityQueue_serializer(deserializer, "loads");
+  if (!deserializer) {
+    Py_DECREF(encoded_path);
+    return NULL;
+  }
+
+  // The size and the arity are restored from the snapshot.
+  result = (ExtPriorityQueue *)PyObject_CallObject(cls, NULL);
+  if (!result) {
+    Py_DECREF(deserializer);
+    Py_DECREF(encoded_path);
+    return NULL;
+  }
+
+  result->heap->set_dispose(ExtPriorityQueue_dispose);
+  try {
+    result->heap->load<PyPriorityRecord>(PyBytes_AS_STRING(encoded_path), [deserializer](const PyPriorityRecord & record, const EHeapQSnapshotReader & reader) {
+      PyObject *data, *item;
+
+      if (record.offset > reader.get_payload_length() || record.length > reader.get_payload_length() - record.offset ||
+          std::isnan(record.priority))
+        throw EHeapQInvalidSnapshotExc;
+
+      data = PyBytes_FromStringAndSize(reader.get_payload() + record.offset, record.length);
+      if (!data)
+        throw PyCallErrExc;
+
+      item = PyObject_CallFunctionObjArgs(deserializer, data, NULL);
+      Py_DECREF(data);
+      if (!item)
+        throw PyCallErrExc;
+
+      return PyPriorityItem{record.priority, item};
+    });
+  } catch (...) {
+    ExtPriorityQueue_snapshot_error(path);
+    Py_CLEAR(result);
+  }
+
+  if (result)
+    result->heap->set_dispose(nullptr);
+
+  Py_DECREF(deserializer);
+  Py_DECREF(encoded_path);
+  return (PyObject *)result;
+}
+
+/*
+ * Pickle priorities as an array of doubles and items as a list, both in
+ * the heap order. With protocol 5, the array is passed as a PickleBuffer,
+ * so it can be transferred out-of-band without copying.
+ */
+static PyObject *ExtPriorityQueue_reduce_ex(ExtPriorityQueue *self, PyObject *args) {
+  auto storage = self->heap->get_items();
+  PyObject *priorities, *items, *last = NULL;
+  Py_ssize_t last_pos = -1, pos = 0;
+  int protocol;
+
+  if (!PyArg_ParseTuple(args, "i", &protocol))
+    return NULL;
+
+  try {
+    last = self->heap->get_last().item;
+  } catch (EHeapQException & exc) {
+    // No last item to restore.
+  }
+
+  priorities = PyBytes_FromStringAndSize(NULL, storage->size() * sizeof(double));
+  items = PyList_New(storage->size());
+  if (!priorities || !items) {
+    Py_XDECREF(priorities);
+    Py_XDECREF(items);
+    return NULL;
+  }
+
+  double * priority = (double *)PyBytes_AS_STRING(priorities);
+  for (auto i : *storage) {
+    if (i.item == last)
+      last_pos = pos;
+
+    priority[pos] = i.priority;
+    Py_INCREF(i.item);
+    PyList_SET_ITEM(items, pos++, i.item);
+  }
+
+#if PY_VERSION_HEX >= 0x03080000
+  if (protocol >= 5) {
+    PyObject * buffer = PyPickleBuffer_FromObject(priorities);
+    Py_DECREF(priorities);
+    if (!buffer) {
+      Py_DECREF(items);
+      return NULL;
+    }
+    priorities = buffer;
+  }
+#endif
+
+  return Py_BuildValue("O(kk)(NNn)", Py_TYPE(self), self->heap->get_size(), self->heap->get_arity(),
+                       priorities, items, last_pos);
+}
+
+static PyObject *ExtPriorityQueue_setstate(ExtPriorityQueue *self, PyObject *state) {
+  std::vector<PyPriorityItem> restored;
+  PyObject *priorities, *items;
+  Py_ssize_t last_pos, length;
+  size_t arity = self->heap->get_arity();
+  bool ordered = true;
+  Py_buffer view;
+
+  if (!PyArg_ParseTuple(state, "OO!n", &priorities, &PyList_Type, &items, &last_pos))
+    return NULL;
+
+  if (PyObject_GetBuffer(priorities, &view, PyBUF_SIMPLE) < 0)
+    return NULL;
+
+  length = PyList_GET_SIZE(items);
+  if (view.len != length * Py_ssize_t(sizeof(double)) || size_t(length) > self->heap->get_size()) {
+    PyBuffer_Release(&view);
+    PyErr_SetString(PyExc_ValueError, "the state does not fit the heap size");
+    return NULL;
+  }
+
+  restored.resize(length);
+  for (Py_ssize_t i = 0; i < length; i++) {
+    // The buffer received out-of-band does not have to be aligned.
+    memcpy(&restored[i].priority, (const char *)view.buf + i * sizeof(double), sizeof(double));
+    restored[i].item = PyList_GET_ITEM(items, i);
+
+    if (std::isnan(restored[i].priority)) {
+      PyBuffer_Release(&view);
+      PyErr_SetString(PyExc_ValueError, "priority cannot be NaN");
+      return NULL;
+    }
+
+    // Checking the heap order is cheap with native priorities, a state not in the heap order is rebuilt.
+    if (i > 0 && restored[i].priority < restored[(i - 1) / arity].priority)
+      ordered = false;
+  }
+  PyBuffer_Release(&view);
+
+  // References are borrowed from the list until the heap is restored.
+  try {
+    self->heap->restore(restored.begin(), restored.end(), ordered, last_pos < 0 ? EHEAPQ_NPOS : size_t(last_pos));
+  } catch (EHeapQException & exc) {
+    PyErr_SetString(PyExc_ValueError, exc.what());
+    return NULL;
+  }
+
+  for (auto i : restored)
+    Py_INCREF(i.item);
+
+  Py_RETURN_NONE;
+}
+
+static PyObject *ExtPriorityQueue_getsize(ExtPriorityQueue *self) {
+  return PyLong_FromUnsignedLong(self->heap->get_size());
+}
+
+static PyObject *ExtPriorityQueue_getarity(ExtPriorityQueue *self) {
+  return PyLong_FromSize_t(self->heap->get_arity());
+}
+
+static long int ExtPriorityQueue_len(PyObject *self) {
+  return ((ExtPriorityQueue *)self)->heap->get_length();
+}
+
+static PySequenceMethods ExtPriorityQueue_sequence_methods[] = {
+    ExtPriorityQueue_len, // sq_length
+    {NULL}
+};
+
+static PyMethodDef ExtPriorityQueue_methods[] = {
+    {"push", (PyCFunction)ExtPriorityQueue_push, METH_VARARGS, "Push item with the given priority onto heap, maintaining the heap invariant."},
+    {"would_accept", (PyCFunction)ExtPriorityQueue_would_accept, METH_VARARGS,
+     "Check whether an item with the given priority would be pushed, so that rejected items do not need to be built."},
+    {"pushpop", (PyCFunction)ExtPriorityQueue_pushpop, METH_VARARGS,
+     "Push item with the given priority on the heap, then pop and return the (priority, item) "
+     "pair with the smallest priority."},
+    {"pop", (PyCFunction)ExtPriorityQueue_pop, METH_NOARGS, "Pops top (priority, item) pair from the heap."},
+    {"replace", (PyCFunction)ExtPriorityQueue_replace, METH_VARARGS, "Pops top (priority, item) pair, and adds new item; the heap size is unchanged."},
+    {"get_top", (PyCFunction)ExtPriorityQueue_top, METH_NOARGS, "Gets top (priority, item) pair from the heap, the heap is untouched."},
+    {"get_last", (PyCFunction)ExtPriorityQueue_last, METH_NOARGS, "Get last (priority, item) pair added, if the item is still present in the heap."},
+    {"get_max", (PyCFunction)ExtPriorityQueue_max, METH_NOARGS, "Retrieve (priority, item) pair with the highest priority, in O(N/2)."},
+    {"remove", (PyCFunction)ExtPriorityQueue_remove, METH_VARARGS, "Remove the given item, in O(log(N))."},
+    {"update", (PyCFunction)ExtPriorityQueue_update, METH_VARARGS,
+     "Change priority of the given item, in O(log(N))."},
+    {"dump", (PyCFunction)(void (*)(void))ExtPriorityQueue_dump, METH_VARARGS | METH_KEYWORDS,
+     "Save the heap to a snapshot file, items are converted to bytes by the serializer (pickle.dumps by default)."},
+    {"load", (PyCFunction)(void (*)(void))ExtPriorityQueue_load, METH_VARARGS | METH_KEYWORDS | METH_CLASS,
+     "Create a heap from a snapshot file, items are restored by the deserializer (pickle.loads by default), in O(N)."},
+    {"__reduce_ex__", (PyCFunction)ExtPriorityQueue_reduce_ex, METH_VARARGS,
+     "Pickle the heap, priorities are passed as a PickleBuffer with protocol 5."},
+    {"__setstate__", (PyCFunction)ExtPriorityQueue_setstate, METH_O, "Restore pickled items into the empty heap, in O(N)."},
+    {NULL}
+};
+
+static PyGetSetDef ExtPriorityQueue_getsetters[] = {
+    {"size", (getter)ExtPriorityQueue_getsize, NULL, "Max size of the heap.", NULL},
+    {"arity", (getter)ExtPriorityQueue_getarity, NULL, "Number of children of each node in the heap.", NULL},
+    {"admission_threshold", (getter)ExtPriorityQueue_getadmission_threshold, NULL,
+     "Priority an item has to exceed to be pushed to the full heap, None if the heap is not full.", NULL},
+    {NULL} /* Sentinel */
+};
+
+typedef EMinMaxHeapQ<PyHeapItem, PyHeapItemCmp> PyMinMaxHeapQ;
+
+typedef struct {
+  PyObject_HEAD
+  PyMinMaxHeapQ * heap;
+} ExtMinMaxHeapQueue;
+
+static inline void ExtMinMaxHeapQueue_track(ExtMinMaxHeapQueue *self, PyObject *item) {
+  self->heap->get_compare().track(item, self->heap->get_length() == 0);
+}
+
+static int ExtMinMaxHeapQueue_traverse(ExtMinMaxHeapQueue *self, visitproc visit, void *arg) {
+  for (auto i : *(self->heap->get_items()))
+    Py_VISIT(i.item);
+
+  return 0;
+}
+
+static int ExtMinMaxHeapQueue_clear(ExtMinMaxHeapQueue *self) {
+  std::vector<PyHeapItem> items;
+
+  // Items are detached first, so that finalizers run by Py_DECREF see a consistent heap.
+  self->heap->detach(items);
+  for (auto & i : items)
+    Py_DECREF(i.item);
+
+  return 0;
+}
+
+static void ExtMinMaxHeapQueue_dealloc(ExtMinMaxHeapQueue *self) {
+  PyObject_GC_UnTrack(self);
+  ExtMinMaxHeapQueue_clear(self);
+  delete self->heap;
+  Py_TYPE(self)->tp_free((PyObject *)self);
+}
+
+static PyObject * ExtMinMaxHeapQueue_new(PyTypeObject *type, PyObject *args, PyObject *kwds) {
+  static char *kwlist[] = {"size", NULL};
+  ExtMinMaxHeapQueue *self;
+
+  size_t size = EHEAPQ_DEFAULT_SIZE;
+
+  if (!PyArg_ParseTupleAndKeywords(args, kwds, "|k", kwlist, &size))
+    return NULL;
+
+  self = (ExtMinMaxHeapQueue *)type->tp_alloc(type, 0);
+  self->heap = new PyMinMaxHeapQ(size);
+  return (PyObject *)self;
+}
+
+static int ExtMinMaxHeapQueue_init(ExtMinMaxHeapQueue *self, PyObject *args, PyObject *kwds) {
+  static char *kwlist[] = {"size", NULL};
+
+  size_t size = self->heap->get_size();
+
+  if (!PyArg_ParseTupleAndKeywords(args, kwds, "|k", kwlist, &size))
+    return -1;
+
+  // Items that do not fit are popped here, so that references held by the heap are released.
+  try {
+    while (self->heap->get_length() > size)
+      Py_DECREF(self->heap->pop().item);
+  } catch (ObjCmpErr & exc) {
+    PyErr_SetString(PyExc_ValueError, exc.what());
+    return -1;
+  }
+
+  self->heap->set_size(size);
+  return 0;
+}
+
+static PyObject * ExtMinMaxHeapQueue_top(ExtMinMaxHeapQueue *self) {
+  PyObject * item;
+
+  try {
+    item = self->heap->get_top().item;
+  } catch (EHeapQEmpty & exc) {
+    PyErr_SetString(PyExc_KeyError, exc.what());
+    return NULL;
+  }
+
+  Py_INCREF(item);
+  return item;
+}
+
+static PyObject * ExtMinMaxHeapQueue_max(ExtMinMaxHeapQueue *self) {
+  PyObject * item;
+
+  try {
+    item = self->heap->get_max().item;
+  } catch (EHeapQEmpty & exc) {
+    PyErr_SetString(PyExc_KeyError, exc.what());
+    return NULL;
+  }
+
+  Py_INCREF(item);
+  return item;
+}
+
+static PyObject * ExtMinMaxHeapQueue_last(ExtMinMaxHeapQueue *self) {
+  PyObject * item;
+
+  try {
+    item = self->heap->get_last().item;
+  } catch (EHeapQNoLast & exc) {
+    Py_RETURN_NONE;
+  } catch (EHeapQEmpty & exc) {
+    PyErr_SetString(PyExc_KeyError, exc.what());
+    return NULL;
+  }
+
+  Py_INCREF(item);
+  return item;
+}
+
+static PyObject * ExtMinMaxHeapQueue_push(ExtMinMaxHeapQueue *self, PyObject *args) {
+  PyObject * item;
+  PyHeapItem evicted = {NULL, 0};
+  bool pushed;
+
+  if (!PyArg_ParseTuple(args, "O", &item))
+    return NULL;
+
+  ExtMinMaxHeapQueue_track(self, item);
+
+  try {
+    pushed = self->heap->push({item, 0}, &evicted);
+  } catch (ObjCmpErr & exc) {
+    PyErr_SetString(PyExc_ValueError, exc.what());
+    return NULL;
+  } catch (EHeapQAlreadyPresent & exc) {
+    PyErr_SetString(PyExc_ValueError, exc.what());
+    return NULL;
+  }
+
+  if (pushed)
+    Py_INCREF(item);
+
+  Py_XDECREF(evicted.item);
+  Py_RETURN_NONE;
+}
+
+static PyObject * ExtMinMaxHeapQueue_pushpop(ExtMinMaxHeapQueue *self, PyObject *args) {
+  PyObject * item, * result;
+
+  if (!PyArg_ParseTuple(args, "O", &item))
+    return NULL;
+
+  ExtMinMaxHeapQueue_track(self, item);
+
+  try {
+    result = self->heap->pushpop({item, 0}).item;
+  } catch (ObjCmpErr & exc) {
+    PyErr_SetString(PyExc_ValueError, exc.what());
+    return NULL;
+  } catch (EHeapQAlreadyPresent & exc) {
+    PyErr_SetString(PyExc_ValueError, exc.what());
+    return NULL;
+  }
+
+  // The reference held by the heap is passed to the caller.
+  if (result == item)
+    Py_INCREF(result);
+  else
+    Py_INCREF(item);
+
+  return result;
+}
+
+static PyObject * ExtMinMaxHeapQueue_pop(ExtMinMaxHeapQueue *self) {
+  try {
+    // The reference held by the heap is passed to the caller.
+    return self->heap->pop().item;
+  } catch (ObjCmpErr & exc) {
+    PyErr_SetString(PyExc_ValueError, exc.what());
+    return NULL;
+  } catch (EHeapQEmpty & exc) {
+    PyErr_SetString(PyExc_KeyError, exc.what());
+    return NULL;
+  }
+}
+
+static PyObject * ExtMinMaxHeapQueue_pop_max(ExtMinMaxHeapQueue *self) {
+  try {
+    return self->heap->pop_max().item;
+  } catch (ObjCmpErr & exc) {
+    PyErr_SetString(PyExc_ValueError, exc.what());
+    return NULL;
+  } catch (EHeapQEmpty & exc) {
+    PyErr_SetString(PyExc_KeyError, exc.what());
+    return NULL;
+  }
+}
+
+static PyObject * ExtMinMaxHeapQueue_replace(ExtMinMaxHeapQueue *self, PyObject *args) {
+  PyObject * item;
+  PyObject * result;
+
+  if (!PyArg_ParseTuple(args, "O", &item))
+    return NULL;
+
+  ExtMinMaxHeapQueue_track(self, item);
+
+  try {
+    result = self->heap->replace({item, 0}).item;
+  } catch (ObjCmpErr & exc) {
+    PyErr_SetString(PyExc_ValueError, exc.what());
+    return NULL;
+  } catch (EHeapQEmpty & exc) {
+    PyErr_SetString(PyExc_KeyError, exc.what());
+    return NULL;
+  } catch (EHeapQAlreadyPresent & exc) {
+    PyErr_SetString(PyExc_ValueError, exc.what());
+    return NULL;
+  }
+
+  Py_INCREF(item);
+  return result;
+}
+
+static PyObject * ExtMinMaxHeapQueue_remove(ExtMinMaxHeapQueue *self, PyObject *args) {
+  PyObject * item;
+
+  if (!PyArg_ParseTuple(args, "O", &item))
+    return NULL;
+
+  try {
+    self->heap->remove({item, 0});
+  } catch (ObjCmpErr & exc) {
+    PyErr_SetString(PyExc_ValueError, exc.what());
+    return NULL;
+  } catch (EHeapQNotFound & exc) {
+    PyErr_SetString(PyExc_ValueError, exc.what());
+    return NULL;
+  }
+
+  Py_DECREF(item);
+  Py_RETURN_NONE;
+}
+
+static PyObject * ExtMinMaxHeapQueue_update(ExtMinMaxHeapQueue *self, PyObject *args) {
+  PyObject * item;
+
+  if (!PyArg_ParseTuple(args, "O", &item))
+    return NULL;
+
+  try {
+    self->heap->update({item, 0});
+  } catch (ObjCmpErr & exc) {
+    PyErr_SetString(PyExc_ValueError, exc.what());
+    return NULL;
+  } catch (EHeapQNotFound & exc) {
+    PyErr_SetString(PyExc_ValueError, exc.what());
+    return NULL;
+  }
+
+  Py_RETURN_NONE;
+}
+
+static PyObject * ExtMinMaxHeapQueue_getsize(ExtMinMaxHeapQueue *self) {
+  return PyLong_FromUnsignedLong(self->heap->get_size());
+}
+
+static long int ExtMinMaxHeapQueue_len(PyObject *self) {
+  return ((ExtMinMaxHeapQueue *)self)->heap->get_length();
+}
+
+static PySequenceMethods ExtMinMaxHeapQueue_sequence_methods[] = {
+    ExtMinMaxHeapQueue_len, // sq_length
+    {NULL}
+};
+
+static PyMethodDef ExtMinMaxHeapQueue_methods[] = {
+    {"push", (PyCFunction)ExtMinMaxHeapQueue_push, METH_VARARGS,
+     "Push item onto heap, the smallest item is evicted if the heap is full."},
+    {"pushpop", (PyCFunction)ExtMinMaxHeapQueue_pushpop, METH_VARARGS,
+     "Push item on the heap, then pop and return the smallest item from the heap."},
+    {"pop", (PyCFunction)ExtMinMaxHeapQueue_pop, METH_NOARGS, "Pops the smallest item from the heap, in O(log(N))."},
+    {"pop_max", (PyCFunction)ExtMinMaxHeapQueue_pop_max, METH_NOARGS, "Pops the largest item from the heap, in O(log(N))."},
+    {"replace", (PyCFunction)ExtMinMaxHeapQueue_replace, METH_VARARGS,
+     "Pops the smallest item, and adds new item; the heap size is unchanged."},
+    {"get_top", (PyCFunction)ExtMinMaxHeapQueue_top, METH_NOARGS, "Gets the smallest item from the heap, in O(1)."},
+    {"get_max", (PyCFunction)ExtMinMaxHeapQueue_max, METH_NOARGS, "Gets the largest item from the heap, in O(1)."},
+    {"get_last", (PyCFunction)ExtMinMaxHeapQueue_last, METH_NOARGS,
+     "Get last item added, if the item is still present in the heap."},
+    {"remove", (PyCFunction)ExtMinMaxHeapQueue_remove, METH_VARARGS, "Remove the given item, in O(log(N))."},
+    {"update", (PyCFunction)ExtMinMaxHeapQueue_update, METH_VARARGS,
+     "Restore the heap invariant after the given item was changed, in O(log(N))."},
+    {NULL}
+};
+
+static PyGetSetDef ExtMinMaxHeapQueue_getsetters[] = {
+    {"size", (getter)ExtMinMaxHeapQueue_getsize, NULL, "Max size of the heap.", NULL},
+    {NULL} /* Sentinel */
+};
+
+typedef ERadixHeapQ<PyObject *> PyRadixHeapQ;
+typedef PyRadixHeapQ::T PyRadixItem;
+
+typedef struct {
+  PyObject_HEAD
+  PyRadixHeapQ * heap;
+} ExtRadixHeapQueue;
+
+static inline PyObject * ExtRadixHeapQueue_pack(PyRadixItem item) {
+  return Py_BuildValue("(KO)", (unsigned long long)item.priority, item.item);
+}
+
+/* Pack an item removed from the heap, the reference held by the heap is passed to the caller. */
+static inline PyObject * ExtRadixHeapQueue_pack_owned(PyRadixItem item) {
+  return Py_BuildValue("(KN)", (unsigned long long)item.priority, item.item);
+}
+
+static int ExtRadixHeapQueue_parse(PyObject *args, PyRadixItem * item) {
+  PyObject *priority;
+
+  if (!PyArg_ParseTuple(args, "O!O", &PyLong_Type, &priority, &item->item))
+    return -1;
+
+  // Unlike the "K" format, negative values and overflows are reported.
+  item->priority = PyLong_AsUnsignedLongLong(priority);
+  if (PyErr_Occurred())
+    return -1;
+
+  return 0;
+}
+
+static int ExtRadixHeapQueue_traverse(ExtRadixHeapQueue *self, visitproc visit, void *arg) {
+  for (size_t i = 0; i < ERADIXHEAPQ_BUCKETS; i++)
+    for (auto item : self->heap->get_bucket(i))
+      Py_VISIT(item.item);
+
+  return 0;
+}
+
+static int ExtRadixHeapQueue_clear(ExtRadixHeapQueue *self) {
+  std::vector<PyRadixItem> items;
+
+  // Items are detached first, so that finalizers run by Py_DECREF see a consistent heap.
+  self->heap->detach(items);
+  for (auto & item : items)
+    Py_DECREF(item.item);
+
+  return 0;
+}
+
+static void ExtRadixHeapQueue_dealloc(ExtRadixHeapQueue *self) {
+  PyObject_GC_UnTrack(self);
+  ExtRadixHeapQueue_clear(self);
+  delete self->heap;
+  Py_TYPE(self)->tp_free((PyObject *)self);
+}
+
+static PyObject * ExtRadixHeapQueue_new(PyTypeObject *type, PyObject *args, PyObject *kwds) {
+  static char *kwlist[] = {"size", NULL};
+  ExtRadixHeapQueue *self;
+
+  size_t size = EHEAPQ_DEFAULT_SIZE;
+
+  if (!PyArg_ParseTupleAndKeywords(args, kwds, "|k", kwlist, &size))
+    return NULL;
+
+  self = (ExtRadixHeapQueue *)type->tp_alloc(type, 0);
+  self->heap = new PyRadixHeapQ(size);
+  return (PyObject *)self;
+}
+
+static int ExtRadixHeapQueue_init(ExtRadixHeapQueue *self, PyObject *args, PyObject *kwds) {
+  static char *kwlist[] = {"size", NULL};
+
+  size_t size = self->heap->get_size();
+
+  if (!PyArg_ParseTupleAndKeywords(args, kwds, "|k", kwlist, &size))
+    return -1;
+
+  for (size_t length = self->heap->get_length(); length > size; length--)
+    Py_DECREF(self->heap->pop().item);
+
+  self->heap->set_size(size);
+  return 0;
+}
+
+static PyObject * ExtRadixHeapQueue_top(ExtRadixHeapQueue *self) {
+  try {
+    return ExtRadixHeapQueue_pack(self->heap->get_top());
+  } catch (EHeapQEmpty & exc) {
+    PyErr_SetString(PyExc_KeyError, exc.what());
+    return NULL;
+  }
+}
+
+static PyObject * ExtRadixHeapQueue_push(ExtRadixHeapQueue *self, PyObject *args) {
+  PyRadixItem item, evicted = {0, NULL};
+  bool pushed;
+
+  if (ExtRadixHeapQueue_parse(args, &item) < 0)
+    return NULL;
+
+  try {
+    pushed = self->heap->push(item, &evicted);
+  } catch (ERadixHeapQNotMonotone & exc) {
+    PyErr_SetString(PyExc_ValueError, exc.what());
+    return NULL;
+  } catch (EHeapQAlreadyPresent & exc) {
+    PyErr_SetString(PyExc_ValueError, exc.what());
+    return NULL;
+  }
+
+  if (pushed)
+    Py_INCREF(item.item);
+
+  Py_XDECREF(evicted.item);
+  Py_RETURN_NONE;
+}
+
+static PyObject * ExtRadixHeapQueue_pop(ExtRadixHeapQueue *self) {
+  try {
+    return ExtRadixHeapQueue_pack_owned(self->heap->pop());
+  } catch (EHeapQEmpty & exc) {
+    PyErr_SetString(PyExc_KeyError, exc.what());
+    return NULL;
+  }
+}
+
+static PyObject *ExtRadixHeapQueue_remove(ExtRadixHeapQueue *self, PyObject *args) {
+  PyRadixItem item = {0, NULL};
+
+  if (!PyArg_ParseTuple(args, "O", &item.item))
+    return NULL;
+
+  try {
+    self->heap->remove(item);
+  } catch (EHeapQNotFound & exc) {
+    PyErr_SetString(PyExc_ValueError, exc.what());
+    return NULL;
+  }
+
+  Py_DECREF(item.item);
+  Py_RETURN_NONE;
+}
+
+static PyObject *ExtRadixHeapQueue_update(ExtRadixHeapQueue *self, PyObject *args) {
+  PyRadixItem item;
+
+  if (ExtRadixHeapQueue_parse(args, &item) < 0)
+    return NULL;
+
+  try {
+    self->heap->update(item);
+  } catch (ERadixHeapQNotMonotone & exc) {
+    PyErr_SetString(PyExc_ValueError, exc.what());
+    return NULL;
+  } catch (EHeapQNotFound & exc) {
+    PyErr_SetString(PyExc_ValueError, exc.what());
+    return NULL;
+  }
+
+  Py_RETURN_NONE;
+}
+
+static PyObject *ExtRadixHeapQueue_getsize(ExtRadixHeapQueue *self) {
+  return PyLong_FromUnsignedLong(self->heap->get_size());
+}
+
+static PyObject *ExtRadixHeapQueue_getlastpriority(ExtRadixHeapQueue *self) {
+  return PyLong_FromUnsignedLongLong(self->heap->get_last_priority());
+}
+
+static long int ExtRadixHeapQueue_len(PyObject *self) {
+  return ((ExtRadixHeapQueue *)self)->heap->get_length();
+}
+
+static PySequenceMethods ExtRadixHeapQueue_sequence_methods[] = {
+    ExtRadixHeapQueue_len, // sq_length
+    {NULL}
+};
+
+static PyMethodDef ExtRadixHeapQueue_methods[] = {
+    {"push", (PyCFunction)ExtRadixHeapQueue_push, METH_VARARGS,
+     "Push item with the given non-negative integer priority, not smaller than the last popped one."},
+    {"pop", (PyCFunction)ExtRadixHeapQueue_pop, METH_NOARGS, "Pops top (priority, item) pair from the heap, in amortized O(1)."},
+    {"get_top", (PyCFunction)ExtRadixHeapQueue_top, METH_NOARGS, "Gets top (priority, item) pair from the heap, the heap is untouched."},
+    {"remove", (PyCFunction)ExtRadixHeapQueue_remove, METH_VARARGS, "Remove the given item, in O(1)."},
+    {"update", (PyCFunction)ExtRadixHeapQueue_update, METH_VARARGS,
+     "Change priority of the given item, the priority cannot be smaller than the last popped one."},
+    {NULL}
+};
+
+static PyGetSetDef ExtRadixHeapQueue_getsetters[] = {
+    {"size", (getter)ExtRadixHeapQueue_getsize, NULL, "Max size of the heap.", NULL},
+    {"last_priority", (getter)ExtRadixHeapQueue_getlastpriority, NULL, "Smallest priority that can be pushed.", NULL},
+    {NULL} /* Sentinel */
+};
+
+typedef EMultiHeapQ<PyPriorityItem, EHeapQPriorityCompare<double, PyObject *>, EHEAPQ_DYNAMIC_ARITY> PyMultiHeapQ;
+
+typedef struct {
+  PyObject_HEAD
+  PyMultiHeapQ * heap;
+} ExtMultiQueue;
+
+static int ExtMultiQueue_traverse(ExtMultiQueue *self, visitproc visit, void *arg) {
+  int result = 0;
+
+  self->heap->for_each([&](const PyPriorityItem & item) {
+    if (!result && item.item)
+      result = visit(item.item, arg);
+  });
+
+  return result;
+}
+
+static int ExtMultiQueue_clear(ExtMultiQueue *self) {
+  PyPriorityItem item;
+
+  // Items are popped first, so that finalizers run by Py_DECREF see a consistent queue.
+  while (self->heap->try_pop(item))
+    Py_DECREF(item.item);
+
+  return 0;
+}
+
+static void ExtMultiQueue_dealloc(ExtMultiQueue *self) {
+  PyObject_GC_UnTrack(self);
+  ExtMultiQueue_clear(self);
+  delete self->heap;
+  Py_TYPE(self)->tp_free((PyObject *)self);
+}
+
+static PyObject * ExtMultiQueue_new(PyTypeObject *type, PyObject *args, PyObject *kwds) {
+  static char *kwlist[] = {"threads", "factor", "arity", NULL};
+  ExtMultiQueue *self;
+  PyMultiHeapQ *heap;
+
+  size_t threads = 0;
+  size_t factor = EMULTIHEAPQ_DEFAULT_FACTOR;
+  size_t arity = EHEAPQ_DEFAULT_ARITY;
+
+  if (!PyArg_ParseTupleAndKeywords(args, kwds, "|kkk", kwlist, &threads, &factor, &arity))
+    return NULL;
+
+  if (arity < 2 || arity > EHEAPQ_MAX_ARITY) {
+    PyErr_SetString(PyExc_ValueError, EHeapQInvalidArityExc.what());
+    return NULL;
+  }
+
+  if (factor < 1) {
+    PyErr_SetString(PyExc_ValueError, "relaxation factor has to be at least 1");
+    return NULL;
+  }
+
+  try {
+    heap = new PyMultiHeapQ(threads, factor, arity);
+  } catch (EMultiHeapQTooManyQueues & exc) {
+    PyErr_SetString(PyExc_ValueError, exc.what());
+    return NULL;
+  } catch (std::bad_alloc & exc) {
+    PyErr_NoMemory();
+    return NULL;
+  }
+
+  self = (ExtMultiQueue *)type->tp_alloc(type, 0);
+  if (!self) {
+    delete heap;
+    return NULL;
+  }
+
+  self->heap = heap;
+  return (PyObject *)self;
+}
+
+static int ExtMultiQueue_init(ExtMultiQueue *, PyObject *args, PyObject *kwds) {
+  static char *kwlist[] = {"threads", "factor", "arity", NULL};
+
+  size_t threads = 0, factor = 0, arity = 0;
+
+  // All the arguments are handled when the queue is created in ExtMultiQueue_new.
+  if (!PyArg_ParseTupleAndKeywords(args, kwds, "|kkk", kwlist, &threads, &factor, &arity))
+    return -1;
+
+  return 0;
+}
+
+static PyObject * ExtMultiQueue_push(ExtMultiQueue *self, PyObject *args) {
+  PyPriorityItem item;
+
+  if (ExtPriorityQueue_parse(args, &item) < 0)
+    return NULL;
+
+  Py_INCREF(item.item);
+
+  // Priorities are native, other threads can run while waiting for the lock.
+  Py_BEGIN_ALLOW_THREADS
+  self->heap->push(item);
+  Py_END_ALLOW_THREADS
+
+  Py_RETURN_NONE;
+}
+
+static PyObject * ExtMultiQueue_pop(ExtMultiQueue *self) {
+  PyPriorityItem item;
+  bool popped;
+
+  Py_BEGIN_ALLOW_THREADS
+  popped = self->heap->try_pop(item);
+  Py_END_ALLOW_THREADS
+
+  if (!popped) {
+    PyErr_SetString(PyExc_KeyError, EHeapQEmptyExc.what());
+    return NULL;
+  }
+
+  return ExtPriorityQueue_pack_owned(item);
+}
+
+static PyObject *ExtMultiQueue_getqueues(ExtMultiQueue *self) {
+  return PyLong_FromSize_t(self->heap->get_queue_count());
+}
+
+static PyObject *ExtMultiQueue_getarity(ExtMultiQueue *self) {
+  return PyLong_FromSize_t(self->heap->get_arity());
+}
+
+static long int ExtMultiQueue_len(PyObject *self) {
+  return ((ExtMultiQueue *)self)->heap->get_length();
+}
+
+static PySequenceMethods ExtMultiQueue_sequence_methods[] = {
+    ExtMultiQueue_len, // sq_length
+    {NULL}
+};
+
+static PyMethodDef ExtMultiQueue_methods[] = {
+    {"push", (PyCFunction)ExtMultiQueue_push, METH_VARARGS, "Push item with the given priority to a random heap."},
+    {"pop", (PyCFunction)ExtMultiQueue_pop, METH_NOARGS,
+     "Pops (priority, item) pair with approximately the smallest priority - the better top of two random heaps."},
+    {NULL}
+};
+
+static PyGetSetDef ExtMultiQueue_getsetters[] = {
+    {"queues", (getter)ExtMultiQueue_getqueues, NULL, "Number of heaps, the rank error grows linearly with it.", NULL},
+    {"arity", (getter)ExtMultiQueue_getarity, NULL, "Number of children of each node in the heaps.", NULL},
+    {NULL} /* Sentinel */
+};
+
+PyMODINIT_FUNC PyInit_eheapq(void) {
+  ExtMinHeapQueueType.tp_name = "eheapq.ExtHeapQueue";
+  ExtMinHeapQueueType.tp_doc = "Extended heap queue algorithm.";
+  ExtMinHeapQueueType.tp_basicsize = sizeof(ExtHeapQueue);
+  ExtMinHeapQueueType.tp_itemsize = 0;
+  ExtMinHeapQueueType.tp_flags = Py_TPFLAGS_DEFAULT | Py_TPFLAGS_BASETYPE | Py_TPFLAGS_HAVE_GC;
+  ExtMinHeapQueueType.tp_new = ExtHeapQueue_new;
+  ExtMinHeapQueueType.tp_as_sequence = ExtHeapQueue_sequence_methods;
+  ExtMinHeapQueueType.tp_init = (initproc)ExtHeapQueue_init;
+  ExtMinHeapQueueType.tp_dealloc = (destructor)ExtHeapQueue_dealloc;
+  ExtMinHeapQueueType.tp_traverse = (traverseproc)ExtHeapQueue_traverse;
+  ExtMinHeapQueueType.tp_clear = (inquiry)ExtHeapQueue_clear;
+  ExtMinHeapQueueType.tp_methods = ExtHeapQueue_methods;
+  ExtMinHeapQueueType.tp_getset = ExtHeapQueue_getsetters;
+  ExtMinHeapQueueType.tp_iter = (getiterfunc)ExtHeapQueue_iter;
+
+  ExtHeapQueueIteratorType.tp_name = "eheapq.ExtHeapQueueIterator";
+  ExtHeapQueueIteratorType.tp_doc = "Iterator over items of ExtHeapQueue.";
+  ExtHeapQueueIteratorType.tp_basicsize = sizeof(ExtHeapQueueIterator);
+  ExtHeapQueueIteratorType.tp_itemsize = 0;
+  ExtHeapQueueIteratorType.tp_flags = Py_TPFLAGS_DEFAULT | Py_TPFLAGS_HAVE_GC;
+  ExtHeapQueueIteratorType.tp_dealloc = (destructor)ExtHeapQueueIterator_dealloc;
+  ExtHeapQueueIteratorType.tp_traverse = (traverseproc)ExtHeapQueueIterator_traverse;
+  ExtHeapQueueIteratorType.tp_iter = PyObject_SelfIter;
+  ExtHeapQueueIteratorType.tp_iternext = (iternextfunc)ExtHeapQueueIterator_next;
+
+  static PyTypeObject ExtPriorityQueueType = {PyVarObject_HEAD_INIT(NULL, 0)};
+  ExtPriorityQueueType.tp_name = "eheapq.ExtPriorityQueue";
+  ExtPriorityQueueType.tp_doc = "Extended heap queue algorithm with native priorities.";
+  ExtPriorityQueueType.tp_basicsize = sizeof(ExtPriorityQueue);
+  ExtPriorityQueueType.tp_itemsize = 0;
+  ExtPriorityQueueType.tp_flags = Py_TPFLAGS_DEFAULT | Py_TPFLAGS_BASETYPE | Py_TPFLAGS_HAVE_GC;
+  ExtPriorityQueueType.tp_new = ExtPriorityQueue_new;
+  ExtPriorityQueueType.tp_as_sequence = ExtPriorityQueue_sequence_methods;
+  ExtPriorityQueueType.tp_init = (initproc)ExtPriorityQueue_init;
+  ExtPriorityQueueType.tp_dealloc = (destructor)ExtPriorityQueue_dealloc;
+  ExtPriorityQueueType.tp_traverse = (traverseproc)ExtPriorityQueue_traverse;
+  ExtPriorityQueueType.tp_clear = (inquiry)ExtPriorityQueue_clear;
+  ExtPriorityQueueType.tp_methods = ExtPriorityQueue_methods;
+  ExtPriorityQueueType.tp_getset = ExtPriorityQueue_getsetters;
+
+  static PyTypeObject ExtMinMaxHeapQueueType = {PyVarObject_HEAD_INIT(NULL, 0)};
+  ExtMinMaxHeapQueueType.tp_name = "eheapq.ExtMinMaxHeapQueue";
+  ExtMinMaxHeapQueueType.tp_doc = "Extended heap queue algorithm with O(1) access to both the smallest and the largest item.";
+  ExtMinMaxHeapQueueType.tp_basicsize = sizeof(ExtMinMaxHeapQueue);
+  ExtMinMaxHeapQueueType.tp_itemsize = 0;
+  ExtMinMaxHeapQueueType.tp_flags = Py_TPFLAGS_DEFAULT | Py_TPFLAGS_BASETYPE | Py_TPFLAGS_HAVE_GC;
+  ExtMinMaxHeapQueueType.tp_new = ExtMinMaxHeapQueue_new;
+  ExtMinMaxHeapQueueType.tp_as_sequence = ExtMinMaxHeapQueue_sequence_methods;
+  ExtMinMaxHeapQueueType.tp_init = (initproc)ExtMinMaxHeapQueue_init;
+  ExtMinMaxHeapQueueType.tp_dealloc = (destructor)ExtMinMaxHeapQueue_dealloc;
+  ExtMinMaxHeapQueueType.tp_traverse = (traverseproc)ExtMinMaxHeapQueue_traverse;
+  ExtMinMaxHeapQueueType.tp_clear = (inquiry)ExtMinMaxHeapQueue_clear;
+  ExtMinMaxHeapQueueType.tp_methods = ExtMinMaxHeapQueue_methods;
+  ExtMinMaxHeapQueueType.tp_getset = ExtMinMaxHeapQueue_getsetters;
+
+  static PyTypeObject ExtRadixHeapQueueType = {PyVarObject_HEAD_INIT(NULL, 0)};
+  ExtRadixHeapQueueType.tp_name = "eheapq.ExtRadixHeapQueue";
+  ExtRadixHeapQueueType.tp_doc = "Radix heap for monotone non-negative integer priorities.";
+  ExtRadixHeapQueueType.tp_basicsize = sizeof(ExtRadixHeapQueue);
+  ExtRadixHeapQueueType.tp_itemsize = 0;
+  ExtRadixHeapQueueType.tp_flags = Py_TPFLAGS_DEFAULT | Py_TPFLAGS_BASETYPE | Py_TPFLAGS_HAVE_GC;
+  ExtRadixHeapQueueType.tp_new = ExtRadixHeapQueue_new;
+  ExtRadixHeapQueueType.tp_as_sequence = ExtRadixHeapQueue_sequence_methods;
+  ExtRadixHeapQueueType.tp_init = (initproc)ExtRadixHeapQueue_init;
+  ExtRadixHeapQueueType.tp_dealloc = (destructor)ExtRadixHeapQueue_dealloc;
+  ExtRadixHeapQueueType.tp_traverse = (traverseproc)ExtRadixHeapQueue_traverse;
+  ExtRadixHeapQueueType.tp_clear = (inquiry)ExtRadixHeapQueue_clear;
+  ExtRadixHeapQueueType.tp_methods = ExtRadixHeapQueue_methods;
+  ExtRadixHeapQueueType.tp_getset = ExtRadixHeapQueue_getsetters;
+
+  static PyTypeObject ExtMultiQueueType = {PyVarObject_HEAD_INIT(NULL, 0)};
+  ExtMultiQueueType.tp_name = "eheapq.ExtMultiQueue";
+  ExtMultiQueueType.tp_doc = "Relaxed priority queue with native priorities for concurrent producers and consumers.";
+  ExtMultiQueueType.tp_basicsize = sizeof(ExtMultiQueue);
+  ExtMultiQueueType.tp_itemsize = 0;
+  ExtMultiQueueType.tp_flags = Py_TPFLAGS_DEFAULT | Py_TPFLAGS_BASETYPE | Py_TPFLAGS_HAVE_GC;
+  ExtMultiQueueType.tp_new = ExtMultiQueue_new;
+  ExtMultiQueueType.tp_as_sequence = ExtMultiQueue_sequence_methods;
+  ExtMultiQueueType.tp_init = (initproc)ExtMultiQueue_init;
+  ExtMultiQueueType.tp_dealloc = (destructor)ExtMultiQueue_dealloc;
+  ExtMultiQueueType.tp_traverse = (traverseproc)ExtMultiQueue_traverse;
+  ExtMultiQueueType.tp_clear = (inquiry)ExtMultiQueue_clear;
+  ExtMultiQueueType.tp_methods = ExtMultiQueue_methods;
+  ExtMultiQueueType.tp_getset = ExtMultiQueue_getsetters;
+
+  static PyModuleDef eheapq = {PyModuleDef_HEAD_INIT};
+  eheapq.m_name = "eheapq";
+  eheapq.m_doc = "Implementation of extended heap queues.";
+  eheapq.m_size = -1;
+
+  PyObject *m;
+  if (PyType_Ready(&ExtMinHeapQueueType) < 0)
+    return NULL;
+
+  if (PyType_Ready(&ExtHeapQueueIteratorType) < 0)
+    return NULL;
+
+  if (PyType_Ready(&ExtPriorityQueueType) < 0)
+    return NULL;
+
+  if (PyType_Ready(&ExtMinMaxHeapQueueType) < 0)
+    return NULL;
+
+  if (PyType_Ready(&ExtRadixHeapQueueType) < 0)
+    return NULL;
+
+  if (PyType_Ready(&ExtMultiQueueType) < 0)
+    return NULL;
+
+  m = PyModule_Create(&eheapq);
+  if (!m)
+    return NULL;
+
+  Py_INCREF(&ExtMinHeapQueueType);
+  if (PyModule_AddObject(m, "ExtHeapQueue", (PyObject *)&ExtMinHeapQueueType) <
+      0) {
+    Py_DECREF(&ExtMinHeapQueueType);
+    Py_DECREF(m);
+    return NULL;
+  }
+
+  Py_INCREF(&ExtPriorityQueueType);
+  if (PyModule_AddObject(m, "ExtPriorityQueue", (PyObject *)&ExtPriorityQueueType) < 0) {
+    Py_DECREF(&ExtPriorityQueueType);
+    Py_DECREF(m);
+    return NULL;
+  }
+
+  Py_INCREF(&ExtMinMaxHeapQueueType);
+  if (PyModule_AddObject(m, "ExtMinMaxHeapQueue", (PyObject *)&ExtMinMaxHeapQueueType) < 0) {
+    Py_DECREF(&ExtMinMaxHeapQueueType);
+    Py_DECREF(m);
+    return NULL;
+  }
+
+  Py_INCREF(&ExtRadixHeapQueueType);
+  if (PyModule_AddObject(m, "ExtRadixHeapQueue", (PyObject *)&ExtRadixHeapQueueType) < 0) {
+    Py_DECREF(&ExtRadixHeapQueueType);
+    Py_DECREF(m);
+    return NULL;
+  }
+
+  Py_INCREF(&ExtMultiQueueType);
+  if (PyModule_AddObject(m, "ExtMultiQueue", (PyObject *)&ExtMultiQueueType) < 0) {
+    Py_DECREF(&ExtMultiQueueType);
     Py_DECREF(m);
     return NULL;
   }
@@ -18,12 +18,29 @@
 
 #pragma once
 
-#include <unordered_map>
+#include <algorithm>
 #include <vector>
 #include <functional>
 #include <exception>
+#include <iterator>
+#include <limits>
+
+#include "eheapqindex.hpp"
+#include "eheapqsnapshot.hpp"
+#include "eheapqstorage.hpp"
 
 const long unsigned int EHEAPQ_DEFAULT_SIZE = std::numeric_limits<long unsigned int>::max();
+const size_t EHEAPQ_DEFAULT_ARITY = 2;
+// Arity of the heap is not known at compile time, it is passed to the constructor instead.
+const size_t EHEAPQ_DYNAMIC_ARITY = 0;
+// Larger arities do not pay off, the bound keeps child positions from overflowing.
+const size_t EHEAPQ_MAX_ARITY = 1024;
+// Ratio of lazily removed items in the heap storage that triggers compaction.
+const double EHEAPQ_DEFAULT_COMPACTION_THRESHOLD = 0.5;
+// Position an item is indexed on while it is held out of the storage during a sift.
+const size_t EHEAPQ_HOLE = EHEAPQ_NPOS - 1;
+// Changes kept in the journal of operations, see EHeapQ::start_operation(), between operations.
+const size_t EHEAPQ_JOURNAL_CAPACITY = 64;
 
 class EHeapQException: public std:: exception {
 };
@@ -56,13 +73,109 @@ class EHeapQNoLast: public EHeapQException {
     }
 } EHeapQNoLastExc;
 
-template <class T, class Compare = std::less<T>>
+class EHeapQInvalidArity: public EHeapQException {
+  public:
+    virtual const char* what() const throw() {
+      return "heap arity has to be at least 2 and at most 1024";
+    }
+} EHeapQInvalidArityExc;
+
+class EHeapQInvalidThreshold: public EHeapQException {
+  public:
+    virtual const char* what() const throw() {
+      return "compaction threshold has to be in (0, 1]";
+    }
+} EHeapQInvalidThresholdExc;
+
+class EHeapQNotEmpty: public EHeapQException {
+  public:
+    virtual const char* what() const throw() {
+      return "the heap is not empty";
+    }
+} EHeapQNotEmptyExc;
+
+class EHeapQInvalidSnapshot: public EHeapQException {
+  public:
+    virtual const char* what() const throw() {
+      return "invalid or incompatible heap snapshot";
+    }
+} EHeapQInvalidSnapshotExc;
+
+/*
+ * An item stored in the heap together with its priority. Items are ordered
+ * solely by their priorities, the index map uses the item itself so an item
+ * can be looked up (e.g. on removal) regardless of its priority.
+ */
+template <class P, class V>
+struct EHeapQPriorityItem {
+    P priority;
+    V item;
+
+    bool operator==(const EHeapQPriorityItem<P, V> & other) const noexcept { return this->item == other.item; }
+};
+
+template <class P, class V, class Compare = std::less<P>>
+struct EHeapQPriorityCompare {
+    Compare comp;
+
+    bool operator()(const EHeapQPriorityItem<P, V> & a, const EHeapQPriorityItem<P, V> & b) {
+      return this->comp(a.priority, b.priority);
+    }
+};
+
+namespace std {
+  template <class P, class V>
+  struct hash<EHeapQPriorityItem<P, V>> {
+    size_t operator()(const EHeapQPriorityItem<P, V> & item) const noexcept { return hash<V>()(item.item); }
+  };
+}
+
+/*
+ * A d-ary min-heap with O(log(N)) removal of arbitrary items. The arity is
+ * given by the Arity template parameter, EHEAPQ_DYNAMIC_ARITY makes it
+ * configurable on construction. Positions of items are tracked by the Index
+ * policy, see eheapqindex.hpp, the array of items is kept by the Storage
+ * policy, see eheapqstorage.hpp.
+ */
+template <
+  class T,
+  class Compare = std::less<T>,
+  size_t Arity = EHEAPQ_DEFAULT_ARITY,
+  class Index = EHeapQHashIndex<T>,
+  class Storage = EHeapQVectorStorage<T>
+>
 class EHeapQ {
+  static_assert(Arity != 1, "heap arity has to be at least 2");
+  static_assert(Arity <= EHEAPQ_MAX_ARITY, "heap arity has to be at most EHEAPQ_MAX_ARITY");
+
   public:
-    EHeapQ(size_t size = EHEAPQ_DEFAULT_SIZE);
+    EHeapQ(size_t size = EHEAPQ_DEFAULT_SIZE, size_t arity = Arity);
+    /*
+     * Allocate the storage and the index using the given allocator (e.g.
+     * std::pmr::polymorphic_allocator or std::pmr::memory_resource *, see
+     * eheapqpmr.hpp), the policies have to be parametrized by a compatible
+     * allocator type.
+     */
+    template <class Allocator>
+    EHeapQ(size_t size, size_t arity, const Allocator & allocator) : index(allocator) {
+      this->init(size, arity);
+      this->heap = new Storage(allocator);
+    }
+    // Build the heap from the given range in O(N), see heapify().
+    template <class InputIt, class = typename std::iterator_traits<InputIt>::iterator_category>
+    EHeapQ(InputIt first, InputIt last, size_t size = EHEAPQ_DEFAULT_SIZE, size_t arity = Arity)
+      : EHeapQ(size, arity) { this->heapify(first, last); }
+    /*
+     * Copy the heap, in O(N) with the vector storage. With the copy-on-write
+     * storage and an index kept in ECowVector containers, the copy takes
+     * O(N / ECOWVECTOR_CHUNK_SIZE) and the copies share memory until they
+     * are changed.
+     */
+    EHeapQ(const EHeapQ & other);
+    EHeapQ & operator=(const EHeapQ & other) = delete;
     ~EHeapQ();
 
-    T get_top() const { this->throw_on_empty(); return this->heap->at(0); }
+    T get_top() const { this->throw_on_empty(); return this->heap->get(0); }
     T get_last() const {
         if (this->heap->size() == 0) {
            throw EHeapQEmptyExc;
@@ -75,23 +188,180 @@ class EHeapQ {
         return this->last_item;
     }
     void set_size(size_t size);
+    void reserve(size_t size) { this->heap->reserve(size); this->index.reserve(size); }
     size_t get_size() const noexcept { return this->size; }
-    size_t get_length() const noexcept { return this->heap->size(); }
-    const std::vector<T> * get_items() const { return this->heap; }
+    size_t get_length() const noexcept { return this->heap->size() - this->dead_count; }
+    size_t get_arity() const noexcept { return Arity == EHEAPQ_DYNAMIC_ARITY ? this->arity : Arity; }
+    // Items stored, including items removed lazily - see is_live().
+    const Storage * get_items() const { return this->heap; }
+    // Changes of the heap so far - any operation that can change items or their order counts, even a failed one.
+    size_t get_modifications() const noexcept { return this->modifications; }
+    Compare & get_compare() noexcept { return this->comp; }
+
+    /*
+     * Whether the item would be stored if pushed - the heap is not full or
+     * the item is larger than the top item. Presence of the item is not
+     * checked. Callers can skip building items that would be rejected.
+     */
+    bool would_accept(const T & item) {
+      return this->get_length() < this->size || (this->heap->size() > 0 && this->comp(this->heap->get(0), item));
+    }
 
     T get_max(void);
-    void push(T item);
+    // Whether the item is stored (and not removed lazily).
+    bool contains(const T & item) const noexcept { return this->locate(item) != EHEAPQ_NPOS; }
+    void push(const T & item) { T pushed = item; this->push_item(pushed, nullptr); }
+    void push(T && item) { this->push_item(item, nullptr); }
+    // Returns false if the heap is full and the item was rejected, the evicted top item is stored to evicted.
+    bool push(const T & item, T * evicted) { T pushed = item; return this->push_item(pushed, evicted); }
+    template <class... Args>
+    void emplace(Args &&... args) { T item(std::forward<Args>(args)...); this->push_item(item, nullptr); }
     T pushpop(T);
     T pop(void);
     T replace(T item);
     void remove(T item);
+    void update(T item);
+    template <class InputIt>
+    void heapify(InputIt first, InputIt last, std::vector<T> * evicted = nullptr);
+    template <class ForwardIt>
+    void push_many(ForwardIt first, ForwardIt last, std::vector<T> * evicted = nullptr);
+    void merge(EHeapQ & other, std::vector<T> * evicted = nullptr);
+    std::vector<T> pop_many(size_t count);
+    std::vector<T> top_k(size_t count);
+    /*
+     * Move all the items stored (items removed lazily too) to items and
+     * leave the heap empty. Items are not compared nor passed to the
+     * dispose function, so the caller can release them once the heap is
+     * consistent.
+     */
+    void detach(std::vector<T> & items);
+
+    /*
+     * Visits live items in the order they would be popped without changing
+     * the heap, the first k items in O(k*log(k)). The implicit tree is
+     * walked from the root keeping candidate positions (children of items
+     * already visited) in an auxiliary heap, so only O(k*arity) items are
+     * inspected. Any change of the heap invalidates the cursor (see
+     * get_modifications()), so does an exception raised by the comparison.
+     */
+    class SortedCursor {
+      public:
+        explicit SortedCursor(EHeapQ & heap) : heap(&heap) {
+          if (heap.heap->size() > 0)
+            this->frontier.push_back(0);
+        }
+
+        // Store the next item to item, false if all items were visited.
+        bool next(T & item);
+
+      private:
+        EHeapQ * heap;
+        std::vector<size_t> frontier;
+    };
+
+    SortedCursor iter_sorted() { return SortedCursor(*this); }
+
+    /*
+     * Operations on handles, available with index policies handing out
+     * handles (see EHeapQHandleIndex). If the heap is full, push_handle()
+     * evicts the top item (stored to evicted if given) or returns
+     * EHEAPQ_NO_HANDLE if the pushed item itself does not fit.
+     */
+    EHeapQHandle push_handle(T item, T * evicted = nullptr) {
+      return this->push_item(item, evicted, false) ? this->index.handle(item) : EHEAPQ_NO_HANDLE;
+    }
+    T get_item(EHeapQHandle handle) const { return this->heap->get(this->locate_handle(handle)); }
+    T remove_handle(EHeapQHandle handle) { return this->remove_at(this->locate_handle(handle)); }
+    void update_handle(EHeapQHandle handle, T item) { this->update_at(this->locate_handle(handle), item); }
+    Index & get_index() noexcept { return this->index; }
+
+    /*
+     * In the lazy removal mode, remove() only marks the item as removed
+     * (it is erased from the index) and the item stays in the heap as
+     * a tombstone until it gets to the top or until the ratio of tombstones
+     * exceeds the compaction threshold (in (0, 1]) and the heap is rebuilt.
+     * Tombstones are passed to the dispose function (if set) once dropped,
+     * after the operation dropping them is finished.
+     */
+    void set_lazy(bool lazy, double compaction_threshold = EHEAPQ_DEFAULT_COMPACTION_THRESHOLD);
+    bool get_lazy() const noexcept { return this->lazy; }
+    double get_compaction_threshold() const noexcept { return this->compaction_threshold; }
+    void set_dispose(void (*dispose)(T &)) noexcept { this->dispose = dispose; }
+    /*
+     * Tombstones keep being compared with live items, so an item whose key
+     * can change while it is stored (e.g. a pointer to an object mutated
+     * after the removal, or pushed again and updated) would break the heap
+     * order as a tombstone. Items the predicate rejects are removed right
+     * away even in the lazy mode. All keys are stable if no predicate is set.
+     */
+    void set_stable_key(bool (*stable_key)(const T &)) noexcept { this->stable_key = stable_key; }
+    size_t get_dead_count() const noexcept { return this->dead_count; }
+    bool is_live(size_t pos) const noexcept {
+      return this->dead_count == 0 || this->index.contains(this->heap->get(pos), pos);
+    }
+    void compact();
+
+    /*
+     * Save the heap to a snapshot file, see eheapqsnapshot.hpp. Items are
+     * stored in the order of the storage, so loading does not compare
+     * items; if items were removed lazily, only live items are saved and
+     * the heap is rebuilt on load. T has to be trivially copyable, other
+     * items are converted to trivially copyable records by the encode
+     * function, called as encode(item, writer) - data the record refers to
+     * can be stored using writer.write_payload().
+     */
+    void save(const char * path) const {
+      this->save<T>(path, [](const T & item, EHeapQSnapshotWriter &) { return item; });
+    }
+    template <class Record, class Encode>
+    void save(const char * path, Encode encode) const;
+    /*
+     * Load items of a snapshot file into the empty heap, in O(N). The size
+     * bound, the last and the max item are restored, the arity too if it
+     * is dynamic. The heap has to use the same comparison as the heap
+     * saved. Records are converted to items by decode(record, reader). If
+     * loading fails, the heap is left empty and items decoded are passed
+     * to the dispose function.
+     */
+    void load(const char * path) {
+      this->load<T>(path, [](const T & record, const EHeapQSnapshotReader &) { return record; });
+    }
+    template <class Record, class Decode>
+    void load(const char * path, Decode decode);
+    /*
+     * Fill the empty heap with items of the range in O(N). If ordered, the
+     * items are already in the heap order for the arity of this heap (e.g.
+     * live items of get_items() of a heap without lazily removed items)
+     * and they are not compared, otherwise the heap is rebuilt. The
+     * position of the last item within the range can be given. If
+     * restoring fails, the heap is left empty and items stored are passed
+     * to the dispose function.
+     */
+    template <class ForwardIt>
+    void restore(ForwardIt first, ForwardIt last, bool ordered, size_t last_pos = EHEAPQ_NPOS);
 
   private:
-    std::vector<T> * heap;
+    Storage * heap;
 
     long unsigned int size;
     Compare comp;
 
+    size_t arity;
+    // Shift used instead of division if the dynamic arity is a power of two, 0 otherwise.
+    unsigned arity_shift;
+
+    size_t parent_pos(size_t pos) const noexcept {
+      if (Arity == EHEAPQ_DYNAMIC_ARITY && this->arity_shift)
+        return (pos - 1) >> this->arity_shift;
+      return (pos - 1) / this->get_arity();
+    }
+
+    size_t child_pos(size_t pos) const noexcept {
+      if (Arity == EHEAPQ_DYNAMIC_ARITY && this->arity_shift)
+        return (pos << this->arity_shift) + 1;
+      return pos * this->get_arity() + 1;
+    }
+
     T last_item;
     bool last_item_set;
 
@@ -103,194 +373,485 @@ class EHeapQ {
         throw EHeapQEmptyExc;
     }
 
-    std::unordered_map<T, size_t> * index_map;
+    Index index;
+
+    bool lazy;
+    double compaction_threshold;
+    size_t dead_count;
+    void (*dispose)(T &);
+    bool (*stable_key)(const T &);
+    size_t modifications;
+
+    // Position of the given item in this heap, EHEAPQ_NPOS if not present.
+    size_t locate(const T & item) const noexcept {
+      size_t pos = this->index.find(item);
+      if (pos >= this->heap->size() || !(this->heap->get(pos) == item))
+        return EHEAPQ_NPOS;
+      return pos;
+    }
 
-    void siftdown(size_t start_pos, size_t pos);
-    void siftup(size_t pod);
+    size_t locate_handle(EHeapQHandle handle) const {
+      size_t pos = this->index.find_handle(handle);
+      if (pos >= this->heap->size())
+        throw EHeapQNotFoundExc;
+      return pos;
+    }
+
+    void init(size_t size, size_t arity);
+    void set_arity(size_t arity) noexcept;
+
+    /*
+     * Changes of the heap are recorded to a journal, so that an operation
+     * failing half way (e.g. the comparison raises) is undone without
+     * comparing items - a sift moves items on a path of the tree by one
+     * level, it is reverted knowing the position the sifted item started on
+     * and the position it ended on. Operations nest, start_operation()
+     * returns a mark passed to finish_operation() or undo_operation(). The
+     * outermost operation restores the last and the max item on undo, and
+     * erases items popped from the index and disposes tombstones dropped
+     * once finished.
+     */
+    struct Change {
+      enum Kind {
+        SIFTED,     // the item on from was sifted to to
+        APPENDED,   // an item was pushed on from and sifted to to
+        EXTENDED,   // items were appended from the position from on, they are indexed
+        REPLACED,   // the top item was replaced by an item sifted to to
+        POPPED,     // the top item was popped, the last item was sifted to to (EHEAPQ_NPOS if none)
+        DROPPED,    // a tombstone was dropped from the top, the same as POPPED
+        COMPACTED,  // a tombstone on from was dropped by compaction, to live items preceded it -
+                    // the last change of a compaction has from EHEAPQ_NPOS and the count in to
+      } kind;
+      size_t from;
+      size_t to;
+      T item;
+    };
+
+    std::vector<Change> journal;
+    unsigned journal_depth;
+    T journal_last_item;
+    T journal_max_item;
+    bool journal_last_item_set;
+    bool journal_max_item_set;
+
+    size_t start_operation();
+    void finish_operation(size_t mark);
+    void undo_operation(size_t mark);
+    void uncompact(size_t count);
+    void dispose_all(std::vector<T> & items) {
+      if (this->dispose) {
+        for (auto & item : items)
+          this->dispose(item);
+      }
+    }
+    void record(typename Change::Kind kind, size_t from, size_t to, const T & item = T()) {
+      if (this->journal_depth > 0)
+        this->journal.push_back({kind, from, to, item});
+    }
+
+    // Store the item after the last one without sifting, the item is not stored on failure.
+    void append_restored(T & item);
+    void finish_restore(bool ordered, size_t last_pos);
+    void discard_restored() noexcept;
+    bool push_item(T & item, T * evicted, bool move = true);
+    bool pushpop_item(T & item, T & result);
+    T replace_top(T & item);
+    T remove_at(size_t pos);
+    void update_at(size_t pos, T & item);
+
+    /*
+     * Sifts move the item into a hole walking the tree, each displaced item
+     * is written (and its index entry updated) once and the sifted item is
+     * placed at the end. Variants taking the item are given the item held
+     * out of the storage, the position it is indexed on (see hold()) and
+     * the position of the hole. Sifts return the final position of the
+     * item. If the comparison fails, the sift is reverted - displaced items
+     * are put back and the item is placed on the position it started on.
+     */
+    size_t siftdown(size_t start_pos, size_t pos);
+    size_t siftdown(T & item, size_t from, size_t start_pos, size_t pos);
+    size_t siftup(size_t pos);
+    size_t siftup(T & item, size_t from, size_t pos);
+    size_t siftup_topdown(size_t pos);
+    void unsift(size_t pos, size_t target);
+
+    /*
+     * A lazily removed item can share its index entry with a live item, so
+     * while a tombstone is around, the entry of the held item is moved to
+     * EHEAPQ_HOLE - items displaced during the sift can never match it.
+     * Tombstones are not indexed, EHEAPQ_NPOS is returned for them so that
+     * the entry of a live item held at the same time is left alone.
+     */
+    size_t hold(const T & item, size_t pos) noexcept {
+      if (this->dead_count == 0)
+        return pos;
+      if (!this->index.contains(item, pos))
+        return EHEAPQ_NPOS;
+
+      this->index.move(item, pos, EHEAPQ_HOLE);
+      return EHEAPQ_HOLE;
+    }
+
+    void place(T & item, size_t from, size_t pos) {
+      if (from != pos && from != EHEAPQ_NPOS)
+        this->index.move(item, from, pos);
+      this->heap->set(pos, std::move(item));
+    }
+
+    // Move the item on the from position to the hole on the to position.
+    void shift(size_t from, size_t to) {
+      this->heap->set(to, this->heap->take(from));
+      this->index.move(this->heap->get(to), from, to);
+    }
+    void rebuild();
+    void drop_excess(std::vector<T> * evicted);
+    size_t drop_top(T & top);
+    void drop_dead_tops();
 
     void set_last_item(T item) noexcept { this->last_item = item; this->last_item_set = true; }
     void set_max_item(T item) noexcept { this->max_item = item; this->max_item_set = true; }
 
     void maybe_del_last_item(T item) noexcept { if (this->last_item_set && this->last_item == item) { this->last_item_set = false; }}
     void maybe_del_max_item(T item) noexcept { if (this->max_item_set && this->max_item == item) { this->max_item_set = false; }}
-    void maybe_adjust_max(T item) noexcept {
-        if (! this->max_item_set)
-            return;
-
-        if (this->comp(this->max_item, item))
-            this->max_item = item;
-    }
+    // Evaluated before the heap is changed, so that a failing comparison leaves the heap untouched.
+    bool is_new_max(const T & item) { return this->max_item_set && this->comp(this->max_item, item); }
 };
 
-template <class T, class Compare>
-EHeapQ<T, Compare>::EHeapQ(size_t size) {
-    this->size = size;
+template <class T, class Compare, size_t Arity, class Index, class Storage>
+EHeapQ<T, Compare, Arity, Index, Storage>::EHeapQ(size_t size, size_t arity) {
+    this->init(size, arity);
+    this->heap = new Storage;
+}
+
+template <class T, class Compare, size_t Arity, class Index, class Storage>
+void EHeapQ<T, Compare, Arity, Index, Storage>::init(size_t size, size_t arity) {
+    if (Arity == EHEAPQ_DYNAMIC_ARITY && (arity < 2 || arity > EHEAPQ_MAX_ARITY))
+      throw EHeapQInvalidArityExc;
 
-    this->index_map = new std::unordered_map<T, size_t>;
-    this->heap = new std::vector<T>;
+    this->size = size;
+    this->set_arity(arity);
 
     this->last_item_set = false;
     this->max_item_set = false;
 
+    this->lazy = false;
+    this->compaction_threshold = EHEAPQ_DEFAULT_COMPACTION_THRESHOLD;
+    this->dead_count = 0;
+    this->dispose = nullptr;
+    this->stable_key = nullptr;
+    this->modifications = 0;
+    this->journal_depth = 0;
+
     this->comp = Compare();
 }
 
-template <class T, class Compare>
-EHeapQ<T, Compare>::~EHeapQ() {
-    delete this->index_map;
+// The arity has to be checked by the caller, see EHEAPQ_MAX_ARITY.
+template <class T, class Compare, size_t Arity, class Index, class Storage>
+void EHeapQ<T, Compare, Arity, Index, Storage>::set_arity(size_t arity) noexcept {
+    this->arity = Arity == EHEAPQ_DYNAMIC_ARITY ? arity : Arity;
+    this->arity_shift = 0;
+    if ((this->arity & (this->arity - 1)) == 0)
+      while ((size_t(1) << this->arity_shift) < this->arity)
+        this->arity_shift++;
+}
+
+template <class T, class Compare, size_t Arity, class Index, class Storage>
+EHeapQ<T, Compare, Arity, Index, Storage>::EHeapQ(const EHeapQ & other)
+  : size(other.size), comp(other.comp), arity(other.arity), arity_shift(other.arity_shift),
+    last_item(other.last_item), last_item_set(other.last_item_set),
+    max_item(other.max_item), max_item_set(other.max_item_set),
+    index(other.index), lazy(other.lazy), compaction_threshold(other.compaction_threshold),
+    dead_count(other.dead_count), dispose(other.dispose), stable_key(other.stable_key), modifications(0), journal_depth(0) {
+    this->heap = new Storage(*other.heap);
+}
+
+template <class T, class Compare, size_t Arity, class Index, class Storage>
+EHeapQ<T, Compare, Arity, Index, Storage>::~EHeapQ() {
     delete this->heap;
 }
 
-template <class T, class Compare>
-T EHeapQ<T, Compare>::get_max(void) {
+template <class T, class Compare, size_t Arity, class Index, class Storage>
+T EHeapQ<T, Compare, Arity, Index, Storage>::get_max(void) {
   this->throw_on_empty();
 
   if (this->max_item_set)
     return this->max_item;
 
-  T result = this->heap->data()[this->heap->size() / 2];
-  for (auto i = (this->heap->size() / 2) + 1; i < this->heap->size(); i++) {
-    if (this->comp(result, this->heap->data()[i]))
-      result = this->heap->data()[i];
+  // A live maximum can be stored in an inner node if its descendants were removed lazily.
+  if (this->dead_count > 0) {
+    size_t pos = 0;
+    for (size_t i = 1; i < this->heap->size(); i++) {
+      if (this->is_live(i) && this->comp(this->heap->get(pos), this->heap->get(i)))
+        pos = i;
+    }
+    return this->heap->get(pos);
+  }
+
+  // The maximum is one of the leaves, the first leaf follows the parent of the last item.
+  size_t first_leaf = this->heap->size() > 1 ? this->parent_pos(this->heap->size() - 1) + 1 : 0;
+  T result = this->heap->get(first_leaf);
+  for (auto i = first_leaf + 1; i < this->heap->size(); i++) {
+    if (this->comp(result, this->heap->get(i)))
+      result = this->heap->get(i);
   }
 
   this->max_item = result;
   return result;
 }
 
-template <class T, class Compare>
-void EHeapQ<T, Compare>::siftdown(size_t startpos, size_t pos) {
-  T newitem, parent, *arr;
-  size_t parentpos;
+template <class T, class Compare, size_t Arity, class Index, class Storage>
+size_t EHeapQ<T, Compare, Arity, Index, Storage>::siftdown(size_t startpos, size_t pos) {
+  if (pos >= this->heap->size())
+    return pos;   // nothing to do..
 
-  auto size = this->heap->size();
-  if (size == 0)
-    return;   // nothing to do..
-
-  // Follow the path to the root, moving parents down until finding a place
-  // newitem fits.
-  arr = this->heap->data();
-  newitem = arr[pos];
-  while (pos > startpos) {
-    parentpos = (pos - 1) >> 1;
-    parent = arr[parentpos];
-
-    if (! this->comp(newitem, parent))
-      break;
+  T item = this->heap->take(pos);
+  return this->siftdown(item, this->hold(item, pos), startpos, pos);
+}
 
-    arr = this->heap->data();
-    parent = arr[parentpos];
-    newitem = arr[pos];
-    arr[parentpos] = newitem;
-    arr[pos] = parent;
-    this->index_map->at(newitem) = parentpos;
-    this->index_map->at(parent) = pos;
-    pos = parentpos;
+/*
+ * Follow the path to the root, moving parents down until finding a place
+ * the item fits, return the final position of the item. If the comparison
+ * fails, parents are moved back and the item is placed on the hole it was
+ * taken from.
+ */
+template <class T, class Compare, size_t Arity, class Index, class Storage>
+size_t EHeapQ<T, Compare, Arity, Index, Storage>::siftdown(T & item, size_t from, size_t startpos, size_t pos) {
+  size_t origpos = pos, parentpos;
+
+  try {
+    while (pos > startpos) {
+      parentpos = this->parent_pos(pos);
+      if (! this->comp(item, this->heap->get(parentpos)))
+        break;
+
+      this->shift(parentpos, pos);
+      pos = parentpos;
+    }
+  } catch (...) {
+    this->place(item, from, pos);
+    this->unsift(pos, origpos);
+    throw;
   }
+
+  this->place(item, from, pos);
+  return pos;
 }
 
-template <class T, class Compare>
-void EHeapQ<T, Compare>::siftup(size_t pos) {
-  size_t startpos, endpos, childpos, limit;
-  T tmp1;
-  T tmp2;
-  T * arr;
-  int cmp;
+template <class T, class Compare, size_t Arity, class Index, class Storage>
+size_t EHeapQ<T, Compare, Arity, Index, Storage>::siftup(size_t pos) {
+  if (pos >= this->heap->size())
+    return pos;
+
+  T item = this->heap->take(pos);
+  return this->siftup(item, this->hold(item, pos), pos);
+}
+
+template <class T, class Compare, size_t Arity, class Index, class Storage>
+size_t EHeapQ<T, Compare, Arity, Index, Storage>::siftup(T & item, size_t from, size_t pos) {
+  size_t startpos, endpos, childpos, lastpos, limit;
 
   endpos = this->heap->size();
   startpos = pos;
 
-  /* Bubble up the smaller child until hitting a leaf. */
-  arr = this->heap->data();
-  limit = endpos >> 1; /* smallest pos that has no child */
-  while (pos < limit) {
-    /* Set childpos to index of smaller child.   */
-    childpos = (pos << 1) + 1; /* leftmost child position  */
-    if (childpos + 1 < endpos) {
-      cmp = int(this->comp(arr[childpos], arr[childpos + 1]));
-      childpos += ((unsigned)cmp ^ 1); /* increment when cmp==0 */
-      arr = this->heap->data();         /* arr may have changed */
-    }
-    /* Move the smaller child up. */
-    tmp1 = arr[childpos];
-    tmp2 = arr[pos];
-    arr[childpos] = tmp2;
-    arr[pos] = tmp1;
-    this->index_map->at(tmp2) = childpos;
-    this->index_map->at(tmp1) = pos;
-    pos = childpos;
-  }
-
-  /* Bubble it up to its final resting place (by sifting its parents down). */
-  this->siftdown(startpos, pos);
-}
-
-template <class T, class Compare>
-T EHeapQ<T, Compare>::pushpop(T item) {
-    if (this->index_map->find(item) != this->index_map->end())
-      throw EHeapQAlreadyPresentExc;
+  /* Move up the smallest child until the hole hits a leaf. */
+  limit = endpos > 1 ? this->parent_pos(endpos - 1) + 1 : 0; /* smallest pos that has no child */
+  try {
+    while (pos < limit) {
+      childpos = this->child_pos(pos); /* leftmost child position  */
+      lastpos = std::min(childpos + this->get_arity(), endpos);
+      childpos = this->heap->min_child(this->comp, childpos, lastpos);
+      this->shift(childpos, pos);
+      pos = childpos;
+    }
+  } catch (...) {
+    this->place(item, from, pos);
+    this->unsift(pos, startpos);
+    throw;
+  }
+
+  /* Bubble the item up to its final resting place (by moving its parents down). */
+  try {
+    return this->siftdown(item, from, startpos, pos);
+  } catch (...) {
+    // The item is back on the leaf.
+    this->unsift(pos, startpos);
+    throw;
+  }
+}
 
-    T to_return = item;
-    if (this->heap->size() > 0 && this->comp(this->heap->at(0), item)) {
-        T to_return = this->heap->data()[0];
-        this->heap->data()[0] = item;
-        this->index_map->insert({item, 0});
-        this->index_map->erase(to_return);
-        this->siftup(0);
+/*
+ * Move the item at the given position towards leaves. Unlike siftup(), the
+ * item is compared with its children on each level and the sift stops as
+ * soon as the item is placed, which is cheaper for items that move only a
+ * few levels (e.g. on priority updates).
+ */
+template <class T, class Compare, size_t Arity, class Index, class Storage>
+size_t EHeapQ<T, Compare, Arity, Index, Storage>::siftup_topdown(size_t pos) {
+  size_t startpos, endpos, childpos, lastpos, limit, from;
 
-        this->set_last_item(item);
-        this->maybe_del_max_item(item);
-        this->maybe_adjust_max(item);
-        return to_return;
+  endpos = this->heap->size();
+  limit = endpos > 1 ? this->parent_pos(endpos - 1) + 1 : 0; /* smallest pos that has no child */
+  if (pos >= limit)
+    return pos;
+
+  T item = this->heap->take(pos);
+  from = this->hold(item, pos);
+  startpos = pos;
+  try {
+    while (pos < limit) {
+      childpos = this->child_pos(pos);
+      lastpos = std::min(childpos + this->get_arity(), endpos);
+      childpos = this->heap->min_child(this->comp, childpos, lastpos);
+
+      if (! this->comp(this->heap->get(childpos), item))
+        break;
+
+      this->shift(childpos, pos);
+      pos = childpos;
     }
+  } catch (...) {
+    this->place(item, from, pos);
+    this->unsift(pos, startpos);
+    throw;
+  }
 
-    return to_return;
+  this->place(item, from, pos);
+  return pos;
 }
 
-template <class T, class Compare>
-void EHeapQ<T, Compare>::push(T item) {
-  if (this->index_map->find(item) != this->index_map->end())
-    throw EHeapQAlreadyPresentExc;
-
-  if (this->heap->size() == this->size) {
-    this->pushpop(item);
+/*
+ * Move the item on pos back to target, an ancestor or a descendant of pos,
+ * moving items on the path between them by one level in the other
+ * direction - this reverts a sift of the item from target to pos.
+ */
+template <class T, class Compare, size_t Arity, class Index, class Storage>
+void EHeapQ<T, Compare, Arity, Index, Storage>::unsift(size_t pos, size_t target) {
+  if (pos == target)
     return;
+
+  T item = this->heap->take(pos);
+  size_t from = this->hold(item, pos);
+
+  if (target < pos) {
+    for (size_t parentpos; pos != target; pos = parentpos) {
+      parentpos = this->parent_pos(pos);
+      this->shift(parentpos, pos);
+    }
+  } else {
+    // Items are moved up starting from the top of the path, the path is at most 64 levels deep.
+    size_t path[64], depth = 0;
+
+    for (size_t childpos = target; childpos != pos; childpos = this->parent_pos(childpos))
+      path[depth++] = childpos;
+    while (depth-- > 0) {
+      this->shift(path[depth], pos);
+      pos = path[depth];
+    }
   }
 
-  this->index_map->insert({item, this->heap->size()});
-  this->heap->push_back(item);
+  this->place(item, from, target);
+}
+
+/*
+ * Push the item and pop the top item into result. If the item would be on
+ * top, it is not pushed at all, result is set to it and false is returned.
+ */
+template <class T, class Compare, size_t Arity, class Index, class Storage>
+bool EHeapQ<T, Compare, Arity, Index, Storage>::pushpop_item(T & item, T & result) {
+    if (this->locate(item) != EHEAPQ_NPOS)
+      throw EHeapQAlreadyPresentExc;
+
+    if (this->heap->size() > 0 && this->comp(this->heap->get(0), item)) {
+        result = this->replace_top(item);
+        return true;
+    }
+
+    result = item;
+    return false;
+}
+
+template <class T, class Compare, size_t Arity, class Index, class Storage>
+T EHeapQ<T, Compare, Arity, Index, Storage>::pushpop(T item) {
+    T result;
+
+    this->pushpop_item(item, result);
+    return result;
+}
+
+/*
+ * Push the item, return false if the heap is full and the item would be
+ * evicted right away. Otherwise, the evicted top item is stored to evicted
+ * (if not NULL). If move is set, the item can be moved to the heap, it is
+ * left untouched if false is returned.
+ *
+ * A full heap compares the item with the top item before the index is
+ * looked up, so an item rejected is not checked for presence.
+ */
+template <class T, class Compare, size_t Arity, class Index, class Storage>
+bool EHeapQ<T, Compare, Arity, Index, Storage>::push_item(T & item, T * evicted, bool move) {
+  if (this->get_length() == this->size) {
+    if (!this->would_accept(item))
+      return false;
+
+    if (this->locate(item) != EHEAPQ_NPOS)
+      throw EHeapQAlreadyPresentExc;
+
+    T result = this->replace_top(item);
+    if (evicted)
+      *evicted = result;
+    return true;
+  }
+
+  if (this->locate(item) != EHEAPQ_NPOS)
+    throw EHeapQAlreadyPresentExc;
+
+  size_t pos = this->heap->size();
+  bool new_max = this->is_new_max(item);
+
+  this->modifications++;
+  this->index.insert(item, pos);
+  if (move)
+    this->heap->push_back(std::move(item));
+  else
+    this->heap->push_back(item);
 
   try {
-      siftdown(0, this->heap->size() - 1);
+      pos = siftdown(0, pos);
   } catch (...) {
-    this->index_map->erase(item);
+    // The item is back on the last position.
+    this->index.erase(this->heap->get(pos));
     this->heap->pop_back();
     throw;
   }
 
-  this->set_last_item(item);
+  this->record(Change::APPENDED, this->heap->size() - 1, pos);
+  this->set_last_item(this->heap->get(pos));
 
   if (this->heap->size() == 1)
-      this->set_max_item(item);
-  else
-      maybe_adjust_max(item);
+      this->set_max_item(this->heap->get(pos));
+  else if (new_max)
+      this->max_item = this->heap->get(pos);
+
+  return true;
 }
 
-template <class T, class Compare>
-T EHeapQ<T, Compare>::pop(void) {
+template <class T, class Compare, size_t Arity, class Index, class Storage>
+T EHeapQ<T, Compare, Arity, Index, Storage>::pop(void) {
   this->throw_on_empty();
 
-  T result = this->heap->data()[0];
+  T result;
+  size_t mark = this->start_operation();
 
-  if (this->heap->size() > 1) {
-    this->heap->data()[0] = this->heap->back();
-    this->index_map->at(this->heap->data()[0]) = 0;
-  }
-
-  this->heap->pop_back();
-  this->index_map->erase(result);
+  try {
+    size_t pos = this->drop_top(result);
 
-  siftup(0);
+    this->record(Change::POPPED, 0, pos, result);
+    this->drop_dead_tops();
+  } catch (...) {
+    this->undo_operation(mark);
+    throw;
+  }
+  this->finish_operation(mark);
 
   this->maybe_del_last_item(result);
   this->maybe_del_max_item(result);
@@ -298,63 +859,892 @@ T EHeapQ<T, Compare>::pop(void) {
   return result;
 }
 
-template <class T, class Compare>
-void EHeapQ<T, Compare>::set_size(size_t size) {
-  this->size = size;
+template <class T, class Compare, size_t Arity, class Index, class Storage>
+void EHeapQ<T, Compare, Arity, Index, Storage>::set_size(size_t size) {
+  size_t mark = this->start_operation();
+  size_t old_size = this->size;
 
-  while (this->heap->size() > this->size)
-     this->pop();
+  this->size = size;
+  try {
+    while (this->get_length() > this->size)
+       this->pop();
+  } catch (...) {
+    this->undo_operation(mark);
+    this->size = old_size;
+    throw;
+  }
+  this->finish_operation(mark);
 }
 
-template <class T, class Compare>
-T EHeapQ<T, Compare>::replace(T item) {
+template <class T, class Compare, size_t Arity, class Index, class Storage>
+T EHeapQ<T, Compare, Arity, Index, Storage>::replace(T item) {
   this->throw_on_empty();
 
-  if (this->index_map->find(item) != this->index_map->end())
+  if (this->locate(item) != EHEAPQ_NPOS)
     throw EHeapQAlreadyPresentExc;
 
-  T result = this->heap->data()[0];
+  return this->replace_top(item);
+}
+
+// Replace the top item with the given one, which is not present in the heap.
+template <class T, class Compare, size_t Arity, class Index, class Storage>
+T EHeapQ<T, Compare, Arity, Index, Storage>::replace_top(T & item) {
+  T result = this->heap->get(0);
+  bool new_max = this->is_new_max(item);
+  size_t mark = this->start_operation();
 
-  this->index_map->erase(result);
-  this->heap->data()[0] = item;
-  this->index_map->insert({item, 0});
+  try {
+    size_t from, pos;
+
+    this->index.insert(item, 0);
+    from = this->hold(result, 0);
+    this->heap->set(0, item);
+    try {
+      pos = this->siftup(0);
+    } catch (...) {
+      // The item is back on the top.
+      this->index.erase(item);
+      this->place(result, from, 0);
+      throw;
+    }
 
-  siftup(0);
+    this->index.erase(result);
+    this->record(Change::REPLACED, 0, pos, result);
+    this->drop_dead_tops();
+  } catch (...) {
+    this->undo_operation(mark);
+    throw;
+  }
+  this->finish_operation(mark);
 
-  this->set_last_item(result);
+  this->set_last_item(item);
   this->maybe_del_max_item(result);
-  this->maybe_adjust_max(result);
+  if (new_max && this->max_item_set)
+    this->max_item = item;
 
   return result;
 }
 
-template <class T, class Compare>
-void EHeapQ<T, Compare>::remove(T item) {
+template <class T, class Compare, size_t Arity, class Index, class Storage>
+void EHeapQ<T, Compare, Arity, Index, Storage>::remove(T item) {
+  size_t idx = this->locate(item);
+
+  if (idx == EHEAPQ_NPOS)
+    throw EHeapQNotFoundExc;
+
+  this->remove_at(idx);
+}
+
+/*
+ * Remove the item on the given position. In the lazy mode, an inner item
+ * with a stable key is left in the heap as a tombstone, other items are
+ * removed right away and passed to the dispose function.
+ */
+template <class T, class Compare, size_t Arity, class Index, class Storage>
+T EHeapQ<T, Compare, Arity, Index, Storage>::remove_at(size_t idx) {
   auto size = this->heap->size();
-  auto arr = this->heap->data();
-  unsigned long idx;
 
-  auto idx_value = this->index_map->find(item);
-  if (idx_value == this->index_map->end())
+  this->modifications++;
+  T item = this->heap->get(idx);
+  bool tombstone = this->lazy && idx > 0 && idx < size - 1 && (!this->stable_key || this->stable_key(item));
+
+  if (tombstone) {
+    this->index.erase(item);
+    this->dead_count++;
+    if (this->dead_count > this->compaction_threshold * size) {
+      try {
+        this->compact();
+      } catch (...) {
+        // Compaction is undone, the item is back on its position.
+        this->dead_count--;
+        this->index.insert(item, idx);
+        throw;
+      }
+    }
+  } else if (idx == 0) {
+    this->pop();
+  } else if (idx == size - 1) {
+    this->index.erase(item);
+    this->heap->pop_back();
+  } else {
+    // The last item fills the hole, it is sifted in the only direction needed.
+    bool up = this->comp(this->heap->get(size - 1), this->heap->get(this->parent_pos(idx)));
+    T last = this->heap->take(size - 1);
+    size_t from = this->hold(last, size - 1);
+    size_t item_from = this->hold(item, idx);
+
+    this->heap->pop_back();
+    try {
+      if (up)
+        this->siftdown(last, from, 0, idx);
+      else
+        this->siftup(last, from, idx);
+    } catch (...) {
+      // The last item is back on the hole.
+      T moved = this->heap->get(idx);
+      this->heap->push_back(moved);
+      this->index.move(moved, idx, size - 1);
+      this->place(item, item_from, idx);
+      throw;
+    }
+
+    this->index.erase(item);
+  }
+
+  this->maybe_del_max_item(item);
+  this->maybe_del_last_item(item);
+  if (this->lazy && !tombstone && this->dispose) {
+    T removed = item;
+    this->dispose(removed);
+  }
+
+  return item;
+}
+
+/*
+ * Replace the stored item equal to the given one, typically after its
+ * priority was changed, and restore the heap invariant by sifting the item
+ * in the only direction needed.
+ */
+template <class T, class Compare, size_t Arity, class Index, class Storage>
+void EHeapQ<T, Compare, Arity, Index, Storage>::update(T item) {
+  size_t idx = this->locate(item);
+
+  if (idx == EHEAPQ_NPOS)
     throw EHeapQNotFoundExc;
 
-  if (size > 0 && item == arr[size - 1]) {
+  this->update_at(idx, item);
+}
+
+template <class T, class Compare, size_t Arity, class Index, class Storage>
+void EHeapQ<T, Compare, Arity, Index, Storage>::update_at(size_t idx, T & item) {
+  bool new_max = this->is_new_max(item);
+  T stored = this->heap->get(idx);
+  size_t mark = this->start_operation();
+
+  this->index.update(stored, item);
+  this->heap->set(idx, item);
+  try {
+    size_t pos;
+
+    if (idx > 0 && this->comp(item, this->heap->get(this->parent_pos(idx))))
+      pos = this->siftdown(0, idx);
+    else
+      pos = this->siftup_topdown(idx);
+    this->record(Change::SIFTED, idx, pos);
+    this->drop_dead_tops();
+  } catch (...) {
+    // The item is back on its position.
+    this->undo_operation(mark);
+    this->heap->set(idx, stored);
+    throw;
+  }
+  this->finish_operation(mark);
+
+  // The maximum could have decreased, other items are checked against the new value.
+  if (this->max_item_set && this->max_item == item)
+    this->max_item_set = false;
+  else if (new_max)
+    this->max_item = item;
+
+  if (this->last_item_set && this->last_item == item)
+    this->last_item = item;
+}
+
+/*
+ * Add items from the given range and restore the heap invariant using
+ * Floyd's bottom-up construction, in O(N) instead of O(N*log(N)) for
+ * pushing items one by one. If the heap would exceed its size, only the
+ * largest items are kept, the smallest ones are stored to evicted (if
+ * given). If any of the kept items is already present in the heap or
+ * a comparison fails, no item is added and the heap is left as it was.
+ * The last item is not tracked afterwards.
+ */
+template <class T, class Compare, size_t Arity, class Index, class Storage>
+template <class InputIt>
+void EHeapQ<T, Compare, Arity, Index, Storage>::heapify(InputIt first, InputIt last, std::vector<T> * evicted) {
+  size_t start = this->heap->size();
+  size_t evicted_start = evicted ? evicted->size() : 0;
+  size_t length, drop, skip = 0;
+  std::vector<T> items(first, last);
+
+  if (items.empty())
+    return;
+  length = start + items.size();
+
+  // If the heap was empty, select the largest items in one pass before they are stored.
+  drop = length - this->dead_count > this->size ? length - this->dead_count - this->size : 0;
+  if (start == 0 && drop > 0) {
+    std::nth_element(items.begin(), items.begin() + drop, items.end(), this->comp);
+    if (evicted)
+      evicted->insert(evicted->end(), items.begin(), items.begin() + drop);
+
+    skip = drop;
+    length -= drop;
+  }
+
+  size_t mark = this->start_operation();
+  try {
+    this->reserve(length);
+    this->heap->append(items.begin() + skip, items.end());
+    this->record(Change::EXTENDED, start, EHEAPQ_NPOS);
+    for (auto i = start; i < length; i++) {
+      T item = this->heap->get(i);
+
+      if (this->locate(item) != EHEAPQ_NPOS) {
+        // Items not indexed yet are dropped right away.
+        this->heap->resize(i);
+        throw EHeapQAlreadyPresentExc;
+      }
+      this->index.insert(item, i);
+      this->heap->set(i, item);
+    }
+
+    this->rebuild();
+    this->drop_dead_tops();
+
+    // Otherwise, the smallest items are popped.
+    this->drop_excess(evicted);
+  } catch (...) {
+    this->undo_operation(mark);
+    if (evicted)
+      evicted->resize(evicted_start);
+    throw;
+  }
+  this->finish_operation(mark);
+
+  this->last_item_set = false;
+  this->max_item_set = false;
+}
+
+/*
+ * Push items from the given range. Items that did not fit into a full heap
+ * (evicted top items as well as pushed items) are stored to evicted (if
+ * given). A batch at least as large as the heap is appended and the heap
+ * is rebuilt using heapify(), smaller batches are pushed one by one. Either
+ * way, if an item is already present or a comparison fails, the heap is
+ * left as it was - top items evicted are put back (with new handles). The
+ * last item is not tracked afterwards.
+ */
+template <class T, class Compare, size_t Arity, class Index, class Storage>
+template <class ForwardIt>
+void EHeapQ<T, Compare, Arity, Index, Storage>::push_many(ForwardIt first, ForwardIt last, std::vector<T> * evicted) {
+  if (size_t(std::distance(first, last)) >= this->heap->size()) {
+    this->heapify(first, last, evicted);
+    return;
+  }
+
+  size_t evicted_start = evicted ? evicted->size() : 0;
+  size_t mark = this->start_operation();
+
+  try {
+    for (; first != last; ++first) {
+      T item = *first;
+      bool full = this->get_length() == this->size;
+      T result;
+
+      if (!this->push_item(item, &result)) {
+        if (evicted)
+          evicted->push_back(item);
+      } else if (full && evicted) {
+        evicted->push_back(result);
+      }
+    }
+  } catch (...) {
+    this->undo_operation(mark);
+    if (evicted)
+      evicted->resize(evicted_start);
+    throw;
+  }
+  this->finish_operation(mark);
+
+  this->last_item_set = false;
+}
+
+/*
+ * Move live items of the other heap to this heap, items removed lazily
+ * are disposed. If the other heap is at least as large as this one, its
+ * items are added using heapify() in O(N + M), otherwise they are pushed
+ * one by one, which takes O(1) comparisons per item on average. Items
+ * that did not fit into a bounded heap are stored to evicted (if given).
+ *
+ * If an item is already present or a comparison fails, the merge stops -
+ * items not moved yet stay in the other heap (with new handles). When the
+ * items are added using heapify(), no item is moved then, this heap is
+ * left as it was. Both heaps stay valid. The last item is not tracked
+ * after the merge.
+ */
+template <class T, class Compare, size_t Arity, class Index, class Storage>
+void EHeapQ<T, Compare, Arity, Index, Storage>::merge(EHeapQ & other, std::vector<T> * evicted) {
+  if (&other == this)
+    return;
+
+  this->modifications++;
+  other.modifications++;
+  other.last_item_set = false;
+  other.max_item_set = false;
+
+  if (other.dead_count == 0 && other.heap->size() >= this->get_length()) {
+    std::vector<T> items(other.heap->begin(), other.heap->end());
+
+    // Items are detached first, an intrusive index can keep an item in one heap only.
+    for (auto & item : items)
+      other.index.erase(item);
+    other.heap->clear();
+
+    try {
+      this->heapify(items.begin(), items.end(), evicted);
+    } catch (...) {
+      // No item was stored, the items are still in the order of the other heap.
+      other.restore(items.begin(), items.end(), true);
+      throw;
+    }
+    return;
+  }
+
+  // Items are taken from the end, so the rest of the other heap stays a valid heap.
+  // The bound is applied afterwards, a failed push leaves this heap untouched then.
+  size_t size = this->size;
+  std::vector<T> dropped;
+
+  this->size = EHEAPQ_DEFAULT_SIZE;
+  try {
+    for (size_t i = other.heap->size(); i-- > 0;) {
+      T item = other.heap->get(i);
+
+      if (other.is_live(i)) {
+        other.index.erase(item);
+        try {
+          this->push_item(item, nullptr, false);
+        } catch (...) {
+          other.index.insert(item, i);
+          other.heap->set(i, item);
+          throw;
+        }
+      } else {
+        other.dead_count--;
+        if (other.dispose)
+          dropped.push_back(item);
+      }
+
+      other.heap->pop_back();
+    }
+  } catch (...) {
+    this->size = size;
+    this->drop_excess(evicted);
+    other.dispose_all(dropped);
+    throw;
+  }
+
+  this->size = size;
+  this->drop_excess(evicted);
+  this->last_item_set = false;
+  other.dispose_all(dropped);
+}
+
+/*
+ * Pop up to count top items, in the order they would be popped one by one.
+ */
+template <class T, class Compare, size_t Arity, class Index, class Storage>
+std::vector<T> EHeapQ<T, Compare, Arity, Index, Storage>::pop_many(size_t count) {
+  std::vector<T> result;
+
+  this->modifications++;
+  if (count >= this->get_length()) {
+    // Draining the whole heap, sort it at once. The heap is left untouched if the comparison fails.
+    result.reserve(this->get_length());
+    for (size_t i = 0; i < this->heap->size(); i++) {
+      if (this->is_live(i))
+        result.push_back(this->heap->get(i));
+    }
+    std::sort(result.begin(), result.end(), this->comp);
+
+    std::vector<T> dropped;
+    for (size_t i = 0; i < this->heap->size(); i++) {
+      if (!this->is_live(i) && this->dispose)
+        dropped.push_back(this->heap->get(i));
+    }
+    for (auto & item : result)
+      this->index.erase(item);
+    this->heap->clear();
+    this->dead_count = 0;
+
+    this->last_item_set = false;
+    this->max_item_set = false;
+    this->dispose_all(dropped);
+    return result;
+  }
+
+  size_t mark = this->start_operation();
+
+  result.reserve(count);
+  try {
+    while (count-- > 0)
+      result.push_back(this->pop());
+  } catch (...) {
+    this->undo_operation(mark);
+    throw;
+  }
+  this->finish_operation(mark);
+
+  return result;
+}
+
+/*
+ * Return up to count top items in the order they would be popped, without
+ * modifying the heap, see SortedCursor.
+ */
+template <class T, class Compare, size_t Arity, class Index, class Storage>
+std::vector<T> EHeapQ<T, Compare, Arity, Index, Storage>::top_k(size_t count) {
+  std::vector<T> result;
+  SortedCursor cursor(*this);
+  T item;
+
+  result.reserve(std::min(count, this->get_length()));
+  while (result.size() < count && cursor.next(item))
+    result.push_back(item);
+
+  return result;
+}
+
+template <class T, class Compare, size_t Arity, class Index, class Storage>
+bool EHeapQ<T, Compare, Arity, Index, Storage>::SortedCursor::next(T & item) {
+  EHeapQ * heap = this->heap;
+  auto comp = [heap](size_t a, size_t b) { return heap->comp(heap->heap->get(b), heap->heap->get(a)); };
+
+  while (!this->frontier.empty()) {
+    std::pop_heap(this->frontier.begin(), this->frontier.end(), comp);
+    size_t pos = this->frontier.back();
+    this->frontier.pop_back();
+
+    size_t child_pos = heap->child_pos(pos);
+    size_t last_pos = std::min(child_pos + heap->get_arity(), heap->heap->size());
+    for (auto i = child_pos; i < last_pos; i++) {
+      this->frontier.push_back(i);
+      std::push_heap(this->frontier.begin(), this->frontier.end(), comp);
+    }
+
+    if (heap->is_live(pos)) {
+      item = heap->heap->get(pos);
+      return true;
+    }
+  }
+
+  return false;
+}
+
+// Restore the heap invariant of all items using Floyd's bottom-up construction.
+template <class T, class Compare, size_t Arity, class Index, class Storage>
+void EHeapQ<T, Compare, Arity, Index, Storage>::rebuild() {
+  size_t length = this->heap->size();
+
+  if (length > 1) {
+    for (auto i = this->parent_pos(length - 1) + 1; i-- > 0;) {
+      size_t pos = this->siftup(i);
+      if (pos != i)
+        this->record(Change::SIFTED, i, pos);
+    }
+  }
+}
+
+// Pop the smallest items until the heap fits into its size.
+template <class T, class Compare, size_t Arity, class Index, class Storage>
+void EHeapQ<T, Compare, Arity, Index, Storage>::drop_excess(std::vector<T> * evicted) {
+  while (this->get_length() > this->size) {
+    T item = this->pop();
+    if (evicted)
+      evicted->push_back(item);
+  }
+}
+
+/*
+ * Remove the top item from the heap storage into top, the item is erased
+ * from the index once the operation is finished. Returns the position the
+ * last item was sifted to, EHEAPQ_NPOS if the top item was the only one.
+ * If the comparison fails, the heap is left untouched.
+ */
+template <class T, class Compare, size_t Arity, class Index, class Storage>
+size_t EHeapQ<T, Compare, Arity, Index, Storage>::drop_top(T & top) {
+  size_t size = this->heap->size();
+
+  top = this->heap->get(0);
+  if (size == 1) {
     this->heap->pop_back();
-    this->index_map->erase(item);
-    goto end;
+    return EHEAPQ_NPOS;
   }
 
-  idx = idx_value->second;
-  this->heap->data()[idx] = this->heap->data()[this->heap->size() - 1];
+  size_t top_from = this->hold(top, 0);
+  T last = this->heap->take(size - 1);
+  size_t from = this->hold(last, size - 1);
+
   this->heap->pop_back();
-  this->index_map->erase(item);
+  try {
+    return this->siftup(last, from, 0);
+  } catch (...) {
+    // The last item is back on the top.
+    T moved = this->heap->get(0);
+    this->heap->push_back(moved);
+    this->index.move(moved, 0, size - 1);
+    this->place(top, top_from, 0);
+    throw;
+  }
+}
+
+// Drop tombstones from the top so that the top item is always a live one, within an operation.
+template <class T, class Compare, size_t Arity, class Index, class Storage>
+void EHeapQ<T, Compare, Arity, Index, Storage>::drop_dead_tops() {
+  while (this->dead_count > 0 && !this->is_live(0)) {
+    T item;
+    size_t pos = this->drop_top(item);
 
-  if (idx < this->heap->size()) {
-    siftup(idx);
-    siftdown(0, idx);
+    this->dead_count--;
+    this->record(Change::DROPPED, 0, pos, item);
   }
+}
 
-end:
-  this->maybe_del_max_item(item);
-  this->maybe_del_last_item(item);
+template <class T, class Compare, size_t Arity, class Index, class Storage>
+size_t EHeapQ<T, Compare, Arity, Index, Storage>::start_operation() {
+  this->modifications++;
+  if (this->journal_depth++ == 0) {
+    this->journal_last_item = this->last_item;
+    this->journal_last_item_set = this->last_item_set;
+    this->journal_max_item = this->max_item;
+    this->journal_max_item_set = this->max_item_set;
+  }
+
+  return this->journal.size();
+}
+
+template <class T, class Compare, size_t Arity, class Index, class Storage>
+void EHeapQ<T, Compare, Arity, Index, Storage>::finish_operation(size_t) {
+  std::vector<T> dropped;
+
+  if (--this->journal_depth > 0)
+    return;
+
+  for (auto & change : this->journal) {
+    if (change.kind == Change::POPPED)
+      this->index.erase(change.item);
+    else if ((change.kind == Change::DROPPED || (change.kind == Change::COMPACTED && change.from != EHEAPQ_NPOS)) && this->dispose)
+      dropped.push_back(change.item);
+  }
+
+  // Keep the journal of single item operations, batches can leave a large one behind.
+  if (this->journal.capacity() > EHEAPQ_JOURNAL_CAPACITY)
+    std::vector<Change>().swap(this->journal);
+  else
+    this->journal.clear();
+
+  // The heap is consistent now, the dispose function can even use it.
+  this->dispose_all(dropped);
+}
+
+template <class T, class Compare, size_t Arity, class Index, class Storage>
+void EHeapQ<T, Compare, Arity, Index, Storage>::undo_operation(size_t mark) {
+  while (this->journal.size() > mark) {
+    Change & change = this->journal.back();
+
+    switch (change.kind) {
+      case Change::SIFTED:
+        this->unsift(change.to, change.from);
+        break;
+      case Change::APPENDED:
+        this->unsift(change.to, change.from);
+        this->index.erase(this->heap->get(change.from));
+        this->heap->pop_back();
+        break;
+      case Change::EXTENDED:
+        for (size_t i = change.from; i < this->heap->size(); i++)
+          this->index.erase(this->heap->get(i));
+        this->heap->resize(change.from);
+        break;
+      case Change::REPLACED:
+        this->unsift(change.to, 0);
+        this->index.erase(this->heap->get(0));
+        this->index.insert(change.item, 0);
+        this->heap->set(0, change.item);
+        break;
+      case Change::POPPED:
+      case Change::DROPPED:
+        if (change.to == EHEAPQ_NPOS) {
+          this->heap->push_back(change.item);
+        } else {
+          this->unsift(change.to, 0);
+          T moved = this->heap->get(0);
+          this->heap->push_back(moved);
+          this->index.move(moved, 0, this->heap->size() - 1);
+          this->heap->set(0, change.item);
+        }
+
+        if (change.kind == Change::POPPED)
+          this->index.move(change.item, EHEAPQ_HOLE, 0);
+        else
+          this->dead_count++;
+        break;
+      case Change::COMPACTED: {
+        // All tombstones dropped by the compaction are put back at once.
+        size_t count = change.to;
+
+        this->journal.pop_back();
+        this->uncompact(count);
+        this->dead_count += count;
+        this->journal.erase(this->journal.end() - count + 1, this->journal.end());
+        break;
+      }
+    }
+
+    this->journal.pop_back();
+  }
+
+  if (--this->journal_depth == 0) {
+    this->last_item = this->journal_last_item;
+    this->last_item_set = this->journal_last_item_set;
+    this->max_item = this->journal_max_item;
+    this->max_item_set = this->journal_max_item_set;
+  }
+}
+
+/*
+ * Drop all tombstones and rebuild the heap, in O(N). If the comparison
+ * fails, tombstones are put back and the heap is left as it was.
+ */
+template <class T, class Compare, size_t Arity, class Index, class Storage>
+void EHeapQ<T, Compare, Arity, Index, Storage>::compact() {
+  size_t length = 0;
+
+  if (this->dead_count == 0)
+    return;
+
+  size_t mark = this->start_operation();
+  try {
+    for (size_t i = 0; i < this->heap->size(); i++) {
+      T item = this->heap->get(i);
+
+      if (!this->index.contains(item, i)) {
+        this->record(Change::COMPACTED, i, length, item);
+        continue;
+      }
+
+      if (length != i) {
+        this->heap->set(length, item);
+        this->index.move(item, i, length);
+      }
+      length++;
+    }
+
+    this->record(Change::COMPACTED, EHEAPQ_NPOS, this->dead_count);
+    this->heap->resize(length);
+    this->dead_count = 0;
+    this->rebuild();
+  } catch (...) {
+    this->undo_operation(mark);
+    throw;
+  }
+  this->finish_operation(mark);
+}
+
+// Put back tombstones dropped by compaction, the journal ends with count COMPACTED changes.
+template <class T, class Compare, size_t Arity, class Index, class Storage>
+void EHeapQ<T, Compare, Arity, Index, Storage>::uncompact(size_t count) {
+  size_t length = this->heap->size();
+  auto change = this->journal.end() - count;
+
+  // Live items are moved towards the end, starting with the last one.
+  for (size_t i = 0; i < count; i++)
+    this->heap->push_back(change->item);
+  for (size_t pos = length + count; pos-- > 0;) {
+    if (count > 0 && change[count - 1].from == pos) {
+      this->heap->set(pos, change[count - 1].item);
+      count--;
+    } else if (count > 0) {
+      T item = this->heap->get(pos - count);
+      this->heap->set(pos, item);
+      this->index.move(item, pos - count, pos);
+    } else {
+      break;
+    }
+  }
+}
+
+template <class T, class Compare, size_t Arity, class Index, class Storage>
+void EHeapQ<T, Compare, Arity, Index, Storage>::set_lazy(bool lazy, double compaction_threshold) {
+  if (!(compaction_threshold > 0 && compaction_threshold <= 1))
+    throw EHeapQInvalidThresholdExc;
+
+  if (!lazy)
+    this->compact();
+
+  this->lazy = lazy;
+  this->compaction_threshold = compaction_threshold;
+}
+
+template <class T, class Compare, size_t Arity, class Index, class Storage>
+template <class Record, class Encode>
+void EHeapQ<T, Compare, Arity, Index, Storage>::save(const char * path, Encode encode) const {
+  static_assert(std::is_trivially_copyable<Record>::value, "snapshot records have to be trivially copyable");
+
+  EHeapQSnapshotHeader header = EHeapQSnapshotHeader();
+  EHeapQSnapshotWriter writer(path, sizeof(Record), this->get_length());
+  size_t last_pos = this->last_item_set ? this->locate(this->last_item) : EHEAPQ_NPOS;
+  size_t max_pos = this->max_item_set ? this->locate(this->max_item) : EHEAPQ_NPOS;
+
+  header.flags = this->dead_count == 0 ? EHEAPQ_SNAPSHOT_ORDERED : 0;
+  header.size = this->size;
+  header.arity = this->get_arity();
+  header.last_pos = EHEAPQ_SNAPSHOT_NPOS;
+  header.max_pos = EHEAPQ_SNAPSHOT_NPOS;
+
+  for (size_t i = 0, pos = 0; i < this->heap->size(); i++) {
+    if (!this->is_live(i))
+      continue;
+
+    if (i == last_pos)
+      header.last_pos = pos;
+    if (i == max_pos)
+      header.max_pos = pos;
+
+    writer.write<Record>(encode(this->heap->get(i), writer));
+    pos++;
+  }
+
+  writer.commit(header);
+}
+
+template <class T, class Compare, size_t Arity, class Index, class Storage>
+template <class Record, class Decode>
+void EHeapQ<T, Compare, Arity, Index, Storage>::load(const char * path, Decode decode) {
+  static_assert(std::is_trivially_copyable<Record>::value, "snapshot records have to be trivially copyable");
+
+  if (this->heap->size() != 0)
+    throw EHeapQNotEmptyExc;
+
+  this->modifications++;
+  EHeapQSnapshotReader reader(path);
+  if (!reader.is_valid(sizeof(Record)) || reader.get_header().arity < 2 || reader.get_header().arity > EHEAPQ_MAX_ARITY)
+    throw EHeapQInvalidSnapshotExc;
+
+  const EHeapQSnapshotHeader & header = reader.get_header();
+  const Record * records = reader.template get_records<Record>();
+
+  this->reserve(header.length);
+  try {
+    for (size_t i = 0; i < header.length; i++) {
+      T item = decode(records[i], reader);
+
+      try {
+        this->append_restored(item);
+      } catch (...) {
+        // The item not stored is disposed once the heap is discarded.
+        this->discard_restored();
+        if (this->dispose)
+          this->dispose(item);
+        throw;
+      }
+    }
+  } catch (...) {
+    this->discard_restored();
+    throw;
+  }
+
+  this->size = header.size;
+  this->set_arity(header.arity);
+
+  if (header.max_pos != EHEAPQ_SNAPSHOT_NPOS)
+    this->set_max_item(this->heap->get(header.max_pos));
+
+  // The heap order of a snapshot with a different arity does not hold.
+  bool ordered = (header.flags & EHEAPQ_SNAPSHOT_ORDERED) && header.arity == this->get_arity();
+  this->finish_restore(ordered, header.last_pos == EHEAPQ_SNAPSHOT_NPOS ? EHEAPQ_NPOS : size_t(header.last_pos));
+}
+
+template <class T, class Compare, size_t Arity, class Index, class Storage>
+template <class ForwardIt>
+void EHeapQ<T, Compare, Arity, Index, Storage>::restore(ForwardIt first, ForwardIt last, bool ordered, size_t last_pos) {
+  if (this->heap->size() != 0)
+    throw EHeapQNotEmptyExc;
+
+  this->modifications++;
+  this->reserve(std::distance(first, last));
+  try {
+    for (; first != last; ++first) {
+      T item = *first;
+      this->append_restored(item);
+    }
+  } catch (...) {
+    this->discard_restored();
+    throw;
+  }
+
+  this->finish_restore(ordered, last_pos);
+}
+
+template <class T, class Compare, size_t Arity, class Index, class Storage>
+void EHeapQ<T, Compare, Arity, Index, Storage>::append_restored(T & item) {
+  size_t pos = this->heap->size();
+
+  if (this->locate(item) != EHEAPQ_NPOS)
+    throw EHeapQAlreadyPresentExc;
+
+  this->heap->push_back(item);
+  try {
+    this->index.insert(item, pos);
+  } catch (...) {
+    this->heap->pop_back();
+    throw;
+  }
+  this->heap->set(pos, item);
+}
+
+template <class T, class Compare, size_t Arity, class Index, class Storage>
+void EHeapQ<T, Compare, Arity, Index, Storage>::finish_restore(bool ordered, size_t last_pos) {
+  T last_item;
+  bool last_item_set = last_pos < this->heap->size();
+
+  if (last_item_set)
+    last_item = this->heap->get(last_pos);
+
+  if (!ordered) {
+    try {
+      this->rebuild();
+    } catch (...) {
+      this->discard_restored();
+      throw;
+    }
+  }
+
+  if (last_item_set)
+    this->set_last_item(last_item);
+}
+
+template <class T, class Compare, size_t Arity, class Index, class Storage>
+void EHeapQ<T, Compare, Arity, Index, Storage>::discard_restored() noexcept {
+  this->last_item_set = false;
+  this->max_item_set = false;
+
+  // Items are detached one by one from the end, the dispose function sees a consistent heap.
+  while (this->heap->size() > 0) {
+    T item = this->heap->get(this->heap->size() - 1);
+
+    this->index.erase(item);
+    this->heap->pop_back();
+    if (this->dispose)
+      this->dispose(item);
+  }
+}
+
+template <class T, class Compare, size_t Arity, class Index, class Storage>
+void EHeapQ<T, Compare, Arity, Index, Storage>::detach(std::vector<T> & items) {
+  items.reserve(items.size() + this->heap->size());
+  for (size_t i = 0; i < this->heap->size(); i++) {
+    // Items removed lazily are not indexed anymore.
+    if (this->is_live(i))
+      this->index.erase(this->heap->get(i));
+    items.push_back(this->heap->get(i));
+  }
+
+  this->modifications++;
+  this->heap->clear();
+  this->dead_count = 0;
+  this->last_item_set = false;
+  this->max_item_set = false;
 }
@@ -0,0 +1,327 @@
+/*
+ * eheapqindex - Index policies for the extended heap queue.
+ * Copyright(C) 2020 Fridolin Pokorny
+ *
+ * This program is free software: you can redistribute it and / or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+/*
+ * An index policy keeps track of positions of items stored in the heap so
+ * that an item can be found (and removed) in O(1). The heap notifies the
+ * policy about every item inserted, moved and erased:
+ *
+ *   size_t find(const T & item) const   - position of the item or EHEAPQ_NPOS
+ *   void insert(T & item, size_t)       - a new item is about to be placed on the position,
+ *                                         the policy can store its data in the item
+ *   bool contains(const T & item, size_t pos) const
+ *                                       - whether the item is indexed on the position
+ *   void move(const T & item, size_t from, size_t to)
+ *                                       - an item was moved, items not indexed on the from
+ *                                         position (removed lazily) have to be ignored
+ *   void swap(const T & a, size_t pos_a, const T & b, size_t pos_b)
+ *                                       - items were swapped, a lazily removed item can share
+ *                                         its entry with a live one so both entries are read
+ *                                         before they are changed
+ *   void update(const T & stored, T & item)
+ *                                       - the stored item is about to be replaced by an equal item
+ *                                         (e.g. with an updated priority) on the same position
+ *   void erase(const T & item)          - the item was removed from the heap
+ *   void reserve(size_t)                - capacity hint
+ *
+ * Policies handing out handles (see EHeapQHandleIndex) additionally provide:
+ *
+ *   EHeapQHandle handle(const T & item) const      - handle of an indexed item
+ *   size_t find_handle(EHeapQHandle handle) const  - position of the item or EHEAPQ_NPOS
+ *
+ * The position returned by find() is checked by the heap, a policy does not
+ * need to verify the item is stored in the given heap.
+ *
+ * Policies are default constructible and constructible from an allocator
+ * passed to the heap (of any value type, it is rebound as needed); policies
+ * that do not allocate ignore it.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <limits>
+#include <memory>
+#include <vector>
+
+#include "eflatmap.hpp"
+
+// Position of an item not stored in any heap.
+const size_t EHEAPQ_NPOS = std::numeric_limits<size_t>::max();
+
+typedef uint64_t EHeapQHandle;
+const EHeapQHandle EHEAPQ_NO_HANDLE = std::numeric_limits<EHeapQHandle>::max();
+
+/*
+ * The default index policy - positions are kept in a hash map keyed by
+ * items. The map keeps its entries in a Vector container, see
+ * EHeapQHandleIndex.
+ */
+template <
+  class T,
+  class Hash = std::hash<T>,
+  class Allocator = std::allocator<T>,
+  template <class, class> class Vector = std::vector
+>
+class EHeapQHashIndex {
+  public:
+    EHeapQHashIndex() {}
+    template <class A>
+    explicit EHeapQHashIndex(const A & allocator) : positions(Allocator(allocator)) {}
+
+    size_t find(const T & item) const noexcept {
+      const size_t * pos = this->positions.find(item);
+      return pos ? *pos : EHEAPQ_NPOS;
+    }
+
+    void insert(const T & item, size_t pos) { this->positions.insert(item, pos); }
+    bool contains(const T & item, size_t pos) const noexcept {
+      const size_t * stored = this->positions.find(item);
+      return stored && *stored == pos;
+    }
+
+    void move(const T & item, size_t from, size_t to) noexcept {
+      size_t * stored = this->positions.find(item);
+      if (stored && *stored == from)
+        *stored = to;
+    }
+
+    void swap(const T & a, size_t pos_a, const T & b, size_t pos_b) noexcept {
+      size_t * stored_a = this->positions.find(a);
+      size_t * stored_b = this->positions.find(b);
+      bool live_a = stored_a && *stored_a == pos_a;
+      bool live_b = stored_b && *stored_b == pos_b;
+
+      if (live_a)
+        *stored_a = pos_b;
+      if (live_b)
+        *stored_b = pos_a;
+    }
+
+    void update(const T &, T &) noexcept {}
+    void erase(const T & item) noexcept { this->positions.erase(item); }
+    void reserve(size_t size) { this->positions.reserve(size); }
+
+  private:
+    EFlatMap<T, size_t, Hash, std::equal_to<T>, Allocator, Vector> positions;
+};
+
+/*
+ * Traits used by the intrusive index to access the position stored in an
+ * item. By default, T is expected to be a pointer to an object with
+ * a size_t eheapq_position member initialized to EHEAPQ_NPOS. Specialize
+ * the traits for other types.
+ */
+template <class T>
+struct EHeapQPositionTraits {
+  static size_t & position(const T & item) noexcept { return item->eheapq_position; }
+};
+
+/*
+ * An index policy that stores the position directly in items, so no
+ * hashing is done and no memory is used for the index. An item can be
+ * stored in at most one heap at a time (so heaps using this index cannot be
+ * copied), an item removed lazily is stored in the heap until it is
+ * disposed.
+ */
+template <class T, class Traits = EHeapQPositionTraits<T>>
+class EHeapQIntrusiveIndex {
+  public:
+    EHeapQIntrusiveIndex() {}
+    template <class A>
+    explicit EHeapQIntrusiveIndex(const A & allocator) noexcept {}
+
+    size_t find(const T & item) const noexcept { return Traits::position(item); }
+    void insert(const T & item, size_t pos) noexcept { Traits::position(item) = pos; }
+    bool contains(const T & item, size_t pos) const noexcept { return Traits::position(item) == pos; }
+    void move(const T & item, size_t from, size_t to) noexcept {
+      if (Traits::position(item) == from)
+        Traits::position(item) = to;
+    }
+
+    void swap(const T & a, size_t pos_a, const T & b, size_t pos_b) noexcept {
+      bool live_a = Traits::position(a) == pos_a;
+      bool live_b = Traits::position(b) == pos_b;
+
+      if (live_a)
+        Traits::position(a) = pos_b;
+      if (live_b)
+        Traits::position(b) = pos_a;
+    }
+    void update(const T & stored, T & item) noexcept { Traits::position(item) = Traits::position(stored); }
+    void erase(const T & item) noexcept { Traits::position(item) = EHEAPQ_NPOS; }
+    void reserve(size_t size) noexcept {}
+};
+
+/*
+ * An index policy not tracking positions at all, for heaps that only push
+ * and pop. Items cannot be removed or updated, equal items can be stored
+ * in the heap and lazy removal cannot be used.
+ */
+template <class T>
+class EHeapQNullIndex {
+  public:
+    EHeapQNullIndex() {}
+    template <class A>
+    explicit EHeapQNullIndex(const A &) noexcept {}
+
+    size_t find(const T &) const noexcept { return EHEAPQ_NPOS; }
+    void insert(const T &, size_t) noexcept {}
+    bool contains(const T &, size_t) const noexcept { return true; }
+    void move(const T &, size_t, size_t) noexcept {}
+    void swap(const T &, size_t, const T &, size_t) noexcept {}
+    void update(const T &, T &) noexcept {}
+    void erase(const T &) noexcept {}
+    void reserve(size_t) noexcept {}
+};
+
+/*
+ * Traits used by the handle index to access the slot stored in an item. By
+ * default, T is expected to have a uint32_t eheapq_slot member.
+ */
+template <class T>
+struct EHeapQSlotTraits {
+  static uint32_t & slot(T & item) noexcept { return item.eheapq_slot; }
+  static uint32_t slot(const T & item) noexcept { return item.eheapq_slot; }
+};
+
+/*
+ * An index policy handing out stable handles to items. Each item in the
+ * heap owns a slot in a slot map, the slot number is stored in the item and
+ * the slot keeps the position of the item. A handle consists of the slot
+ * number and a generation counter of the slot, so handles of removed items
+ * are not valid anymore even if their slot is reused. Moving an item in the
+ * heap is a plain array write, no hashing is done.
+ *
+ * If the index is not unique, equal items can be stored in the heap and
+ * items can be found only by their handles. Otherwise, items are also kept
+ * in a hash map so that they can be found by their value.
+ *
+ * Slots and the hash map are kept in Vector containers - with ECowVector
+ * (see ecowvector.hpp), copies of the index share memory until they are
+ * changed. Handles stay valid in copies of the index.
+ */
+template <
+  class T,
+  class Hash = std::hash<T>,
+  class Traits = EHeapQSlotTraits<T>,
+  class Allocator = std::allocator<T>,
+  template <class, class> class Vector = std::vector
+>
+class EHeapQHandleIndex {
+  public:
+    EHeapQHandleIndex(bool unique = true) : unique(unique) {}
+    template <class A>
+    explicit EHeapQHandleIndex(const A & allocator, bool unique = true)
+      : unique(unique), slots(SlotAllocator(allocator)), free_slots(SlotNumberAllocator(allocator)),
+        items(Allocator(allocator)) {}
+
+    // Can be changed only if no items are indexed.
+    void set_unique(bool unique) noexcept { this->unique = unique; }
+    bool get_unique() const noexcept { return this->unique; }
+
+    size_t find(const T & item) const noexcept {
+      if (!this->unique)
+        return EHEAPQ_NPOS;
+
+      const uint32_t * slot = this->items.find(item);
+      return slot ? this->slots[*slot].pos : EHEAPQ_NPOS;
+    }
+
+    void insert(T & item, size_t pos) {
+      uint32_t slot;
+
+      if (this->free_slots.empty()) {
+        slot = uint32_t(this->slots.size());
+        this->slots.push_back({pos, 0});
+      } else {
+        slot = this->free_slots.back();
+        this->free_slots.pop_back();
+        this->slots[slot].pos = pos;
+      }
+
+      Traits::slot(item) = slot;
+      if (this->unique)
+        this->items.insert(item, slot);
+    }
+
+    bool contains(const T & item, size_t pos) const noexcept { return this->slots[Traits::slot(item)].pos == pos; }
+    void move(const T & item, size_t from, size_t to) noexcept {
+      Slot & slot = this->slots[Traits::slot(item)];
+      if (slot.pos == from)
+        slot.pos = to;
+    }
+
+    void swap(const T & a, size_t pos_a, const T & b, size_t pos_b) noexcept {
+      Slot & slot_a = this->slots[Traits::slot(a)];
+      Slot & slot_b = this->slots[Traits::slot(b)];
+      bool live_a = slot_a.pos == pos_a;
+      bool live_b = slot_b.pos == pos_b;
+
+      if (live_a)
+        slot_a.pos = pos_b;
+      if (live_b)
+        slot_b.pos = pos_a;
+    }
+    void update(const T & stored, T & item) noexcept { Traits::slot(item) = Traits::slot(stored); }
+
+    void erase(const T & item) {
+      uint32_t slot = Traits::slot(item);
+
+      this->slots[slot].pos = EHEAPQ_NPOS;
+      this->slots[slot].generation++;
+      this->free_slots.push_back(slot);
+
+      if (this->unique)
+        this->items.erase(item);
+    }
+
+    void reserve(size_t size) {
+      this->slots.reserve(size);
+      if (this->unique)
+        this->items.reserve(size);
+    }
+
+    EHeapQHandle handle(const T & item) const noexcept {
+      uint32_t slot = Traits::slot(item);
+      return (EHeapQHandle(this->slots[slot].generation) << 32) | slot;
+    }
+
+    size_t find_handle(EHeapQHandle handle) const noexcept {
+      uint32_t slot = uint32_t(handle);
+
+      if (slot >= this->slots.size() || this->slots[slot].generation != uint32_t(handle >> 32))
+        return EHEAPQ_NPOS;
+
+      return this->slots[slot].pos;
+    }
+
+  private:
+    struct Slot {
+      size_t pos;
+      uint32_t generation;
+    };
+
+    typedef typename std::allocator_traits<Allocator>::template rebind_alloc<Slot> SlotAllocator;
+    typedef typename std::allocator_traits<Allocator>::template rebind_alloc<uint32_t> SlotNumberAllocator;
+
+    bool unique;
+    Vector<Slot, SlotAllocator> slots;
+    Vector<uint32_t, SlotNumberAllocator> free_slots;
+    EFlatMap<T, uint32_t, Hash, std::equal_to<T>, Allocator, Vector> items;
+};
@@ -0,0 +1,93 @@
+/*
+ * eheapqpmr - Polymorphic memory resource support for the extended heap queue.
+ * Copyright(C) 2020 Fridolin Pokorny
+ *
+ * This program is free software: you can redistribute it and / or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+/*
+ * Heaps allocating from a std::pmr::memory_resource (C++17). A short-lived
+ * heap (e.g. one per request) can allocate from an arena and the memory is
+ * released at once when the arena is destroyed:
+ *
+ *   EHeapQArena arena;
+ *   EPmrHeapQ<State *, StateCompare> heap(EHEAPQ_DEFAULT_SIZE, 2, &arena);
+ *
+ * The heap itself still has to be destroyed before the arena.
+ */
+
+#pragma once
+
+#include <memory_resource>
+
+#include "eheapq.hpp"
+
+// Size of the first block an arena allocates from its upstream resource.
+const size_t EHEAPQ_ARENA_INITIAL_SIZE = 64 * 1024;
+
+/*
+ * A heap with the vector storage and the hash index allocating from
+ * a memory resource given on construction.
+ */
+template <
+  class T,
+  class Compare = std::less<T>,
+  size_t Arity = EHEAPQ_DEFAULT_ARITY,
+  class Hash = std::hash<T>
+>
+using EPmrHeapQ = EHeapQ<
+  T,
+  Compare,
+  Arity,
+  EHeapQHashIndex<T, Hash, std::pmr::polymorphic_allocator<T>>,
+  EHeapQVectorStorage<T, std::pmr::polymorphic_allocator<T>>
+>;
+
+/*
+ * A single-threaded arena - blocks freed when the storage or the index
+ * grows are recycled by a pool, the pool takes memory from a monotonic
+ * buffer that is returned to the upstream resource all at once, when the
+ * arena is released or destroyed. An initial buffer (e.g. on the stack)
+ * can be given to avoid allocating from the upstream resource at all.
+ */
+class EHeapQArena: public std::pmr::memory_resource {
+  public:
+    explicit EHeapQArena(
+      size_t initial_size = EHEAPQ_ARENA_INITIAL_SIZE,
+      std::pmr::memory_resource * upstream = std::pmr::get_default_resource()
+    ) : buffer(initial_size, upstream), pool(&buffer) {}
+
+    EHeapQArena(
+      void * buffer,
+      size_t buffer_size,
+      std::pmr::memory_resource * upstream = std::pmr::get_default_resource()
+    ) : buffer(buffer, buffer_size, upstream), pool(&this->buffer) {}
+
+    EHeapQArena(const EHeapQArena &) = delete;
+    EHeapQArena & operator=(const EHeapQArena &) = delete;
+
+    // Release all the memory allocated, no heap can use the arena anymore.
+    void release() {
+      this->pool.release();
+      this->buffer.release();
+    }
+
+  protected:
+    void * do_allocate(size_t bytes, size_t alignment) override { return this->pool.allocate(bytes, alignment); }
+    void do_deallocate(void * p, size_t bytes, size_t alignment) override { this->pool.deallocate(p, bytes, alignment); }
+    bool do_is_equal(const std::pmr::memory_resource & other) const noexcept override { return this == &other; }
+
+  private:
+    std::pmr::monotonic_buffer_resource buffer;
+    std::pmr::unsynchronized_pool_resource pool;
+};
@@ -0,0 +1,271 @@
+/*
+ * eheapqsimd - Vectorized min-child selection for wide heaps.
+ * Copyright(C) 2020 Fridolin Pokorny
+ *
+ * This program is free software: you can redistribute it and / or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+/*
+ * eheapq_min_pos(keys, count) returns the position of the smallest key in
+ * a contiguous block, the last one if there are more equal keys - the same
+ * item the scalar sift loop would choose (unless keys are NaN). For double, float, int32_t and
+ * int64_t keys on x86, the block is scanned using AVX2 or SSE4 kernels
+ * selected on the first use by CPU feature detection, so a build runs on
+ * machines without AVX2 as well. Kernels are compiled using function
+ * target attributes, no compiler flags are needed. Other types and
+ * platforms, or builds with EHEAPQ_NO_SIMD defined, use the scalar loop.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#if !defined(EHEAPQ_NO_SIMD) && (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define EHEAPQ_SIMD 1
+#include <immintrin.h>
+#endif
+
+// Largest block scanned by the vectorized kernels.
+const size_t EHEAPQ_SIMD_MAX_COUNT = 64;
+
+template <class T>
+size_t eheapq_min_pos_scalar(const T * keys, size_t count) noexcept {
+  size_t result = 0;
+
+  for (size_t i = 1; i < count; i++) {
+    if (!(keys[result] < keys[i]))
+      result = i;
+  }
+
+  return result;
+}
+
+#ifdef EHEAPQ_SIMD
+
+/*
+ * Operations on vectors of keys for the given instruction set: width,
+ * load(), min(), hmin() setting all lanes to the smallest one and eq()
+ * returning a bit mask of equal lanes.
+ */
+template <class T> struct EHeapQAVX2;
+template <class T> struct EHeapQSSE4;
+
+#define EHEAPQ_AVX2 __attribute__((target("avx2")))
+#define EHEAPQ_SSE4 __attribute__((target("sse4.2")))
+
+template <>
+struct EHeapQAVX2<double> {
+  typedef __m256d V;
+  static const size_t width = 4;
+  EHEAPQ_AVX2 static V load(const double * p) { return _mm256_loadu_pd(p); }
+  EHEAPQ_AVX2 static V min(V a, V b) { return _mm256_min_pd(a, b); }
+  EHEAPQ_AVX2 static unsigned eq(V a, V b) { return _mm256_movemask_pd(_mm256_cmp_pd(a, b, _CMP_EQ_OQ)); }
+  EHEAPQ_AVX2 static V hmin(V v) {
+    v = _mm256_min_pd(v, _mm256_permute4x64_pd(v, 0x4E));
+    return _mm256_min_pd(v, _mm256_permute_pd(v, 0x5));
+  }
+};
+
+template <>
+struct EHeapQAVX2<float> {
+  typedef __m256 V;
+  static const size_t width = 8;
+  EHEAPQ_AVX2 static V load(const float * p) { return _mm256_loadu_ps(p); }
+  EHEAPQ_AVX2 static V min(V a, V b) { return _mm256_min_ps(a, b); }
+  EHEAPQ_AVX2 static unsigned eq(V a, V b) { return _mm256_movemask_ps(_mm256_cmp_ps(a, b, _CMP_EQ_OQ)); }
+  EHEAPQ_AVX2 static V hmin(V v) {
+    v = _mm256_min_ps(v, _mm256_permute2f128_ps(v, v, 0x01));
+    v = _mm256_min_ps(v, _mm256_permute_ps(v, 0x4E));
+    return _mm256_min_ps(v, _mm256_permute_ps(v, 0xB1));
+  }
+};
+
+template <>
+struct EHeapQAVX2<int32_t> {
+  typedef __m256i V;
+  static const size_t width = 8;
+  EHEAPQ_AVX2 static V load(const int32_t * p) { return _mm256_loadu_si256((const __m256i *)p); }
+  EHEAPQ_AVX2 static V min(V a, V b) { return _mm256_min_epi32(a, b); }
+  EHEAPQ_AVX2 static unsigned eq(V a, V b) { return _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(a, b))); }
+  EHEAPQ_AVX2 static V hmin(V v) {
+    v = _mm256_min_epi32(v, _mm256_permute2x128_si256(v, v, 0x01));
+    v = _mm256_min_epi32(v, _mm256_shuffle_epi32(v, 0x4E));
+    return _mm256_min_epi32(v, _mm256_shuffle_epi32(v, 0xB1));
+  }
+};
+
+template <>
+struct EHeapQAVX2<int64_t> {
+  typedef __m256i V;
+  static const size_t width = 4;
+  EHEAPQ_AVX2 static V load(const int64_t * p) { return _mm256_loadu_si256((const __m256i *)p); }
+  EHEAPQ_AVX2 static V min(V a, V b) { return _mm256_blendv_epi8(a, b, _mm256_cmpgt_epi64(a, b)); }
+  EHEAPQ_AVX2 static unsigned eq(V a, V b) { return _mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpeq_epi64(a, b))); }
+  EHEAPQ_AVX2 static V hmin(V v) {
+    v = min(v, _mm256_permute4x64_epi64(v, 0x4E));
+    return min(v, _mm256_shuffle_epi32(v, 0x4E));
+  }
+};
+
+template <>
+struct EHeapQSSE4<double> {
+  typedef __m128d V;
+  static const size_t width = 2;
+  EHEAPQ_SSE4 static V load(const double * p) { return _mm_loadu_pd(p); }
+  EHEAPQ_SSE4 static V min(V a, V b) { return _mm_min_pd(a, b); }
+  EHEAPQ_SSE4 static unsigned eq(V a, V b) { return _mm_movemask_pd(_mm_cmpeq_pd(a, b)); }
+  EHEAPQ_SSE4 static V hmin(V v) { return _mm_min_pd(v, _mm_shuffle_pd(v, v, 0x1)); }
+};
+
+template <>
+struct EHeapQSSE4<float> {
+  typedef __m128 V;
+  static const size_t width = 4;
+  EHEAPQ_SSE4 static V load(const float * p) { return _mm_loadu_ps(p); }
+  EHEAPQ_SSE4 static V min(V a, V b) { return _mm_min_ps(a, b); }
+  EHEAPQ_SSE4 static unsigned eq(V a, V b) { return _mm_movemask_ps(_mm_cmpeq_ps(a, b)); }
+  EHEAPQ_SSE4 static V hmin(V v) {
+    v = _mm_min_ps(v, _mm_shuffle_ps(v, v, 0x4E));
+    return _mm_min_ps(v, _mm_shuffle_ps(v, v, 0xB1));
+  }
+};
+
+template <>
+struct EHeapQSSE4<int32_t> {
+  typedef __m128i V;
+  static const size_t width = 4;
+  EHEAPQ_SSE4 static V load(const int32_t * p) { return _mm_loadu_si128((const __m128i *)p); }
+  EHEAPQ_SSE4 static V min(V a, V b) { return _mm_min_epi32(a, b); }
+  EHEAPQ_SSE4 static unsigned eq(V a, V b) { return _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(a, b))); }
+  EHEAPQ_SSE4 static V hmin(V v) {
+    v = _mm_min_epi32(v, _mm_shuffle_epi32(v, 0x4E));
+    return _mm_min_epi32(v, _mm_shuffle_epi32(v, 0xB1));
+  }
+};
+
+template <>
+struct EHeapQSSE4<int64_t> {
+  typedef __m128i V;
+  static const size_t width = 2;
+  EHEAPQ_SSE4 static V load(const int64_t * p) { return _mm_loadu_si128((const __m128i *)p); }
+  EHEAPQ_SSE4 static V min(V a, V b) { return _mm_blendv_epi8(a, b, _mm_cmpgt_epi64(a, b)); }
+  EHEAPQ_SSE4 static unsigned eq(V a, V b) { return _mm_movemask_pd(_mm_castsi128_pd(_mm_cmpeq_epi64(a, b))); }
+  EHEAPQ_SSE4 static V hmin(V v) { return min(v, _mm_shuffle_epi32(v, 0x4E)); }
+};
+
+/*
+ * The block is reduced to a vector of minimums (the last load overlaps the
+ * previous one if count is not a multiple of the width), then the mask of
+ * positions holding the smallest key is built without branching. The count
+ * has to be at least the width and at most EHEAPQ_SIMD_MAX_COUNT. Both
+ * kernels are the same, they are compiled for different targets.
+ */
+template <class T>
+EHEAPQ_AVX2 size_t eheapq_min_pos_avx2(const T * keys, size_t count) noexcept {
+  typedef EHeapQAVX2<T> O;
+  const size_t width = O::width;
+  typename O::V min = O::load(keys);
+  uint64_t mask = 0;
+
+  for (size_t i = width; i < count; i += width)
+    min = O::min(min, O::load(keys + (i + width <= count ? i : count - width)));
+  min = O::hmin(min);
+
+  for (size_t i = 0; i < count; i += width) {
+    size_t start = i + width <= count ? i : count - width;
+    mask |= uint64_t(O::eq(O::load(keys + start), min)) << start;
+  }
+
+  // No key is equal to the minimum only if NaN keys were reduced, leave them to the scalar loop.
+  return mask ? 63 - __builtin_clzll(mask) : eheapq_min_pos_scalar(keys, count);
+}
+
+template <class T>
+EHEAPQ_SSE4 size_t eheapq_min_pos_sse4(const T * keys, size_t count) noexcept {
+  typedef EHeapQSSE4<T> O;
+  const size_t width = O::width;
+  typename O::V min = O::load(keys);
+  uint64_t mask = 0;
+
+  for (size_t i = width; i < count; i += width)
+    min = O::min(min, O::load(keys + (i + width <= count ? i : count - width)));
+  min = O::hmin(min);
+
+  for (size_t i = 0; i < count; i += width) {
+    size_t start = i + width <= count ? i : count - width;
+    mask |= uint64_t(O::eq(O::load(keys + start), min)) << start;
+  }
+
+  return mask ? 63 - __builtin_clzll(mask) : eheapq_min_pos_scalar(keys, count);
+}
+
+#undef EHEAPQ_AVX2
+#undef EHEAPQ_SSE4
+
+/*
+ * Smallest block scanned by the vectorized kernel for the key type, smaller
+ * ones are not worth the indirect call. There is no 64 bit integer minimum
+ * in AVX2, so int64_t keys pay off only for larger blocks.
+ */
+template <class T> struct EHeapQMinPosCount { static const size_t value = 0; };
+template <> struct EHeapQMinPosCount<double> { static const size_t value = 8; };
+template <> struct EHeapQMinPosCount<float> { static const size_t value = 8; };
+template <> struct EHeapQMinPosCount<int32_t> { static const size_t value = 8; };
+template <> struct EHeapQMinPosCount<int64_t> { static const size_t value = 16; };
+
+#endif
+
+template <class T, bool Vectorized = false>
+struct EHeapQMinPos {
+  static size_t min_pos(const T * keys, size_t count) noexcept { return eheapq_min_pos_scalar(keys, count); }
+};
+
+#ifdef EHEAPQ_SIMD
+
+// The kernel for the given key type is resolved on the first call.
+template <class T>
+struct EHeapQMinPos<T, true> {
+  typedef size_t (*Kernel)(const T *, size_t);
+
+  static size_t min_pos(const T * keys, size_t count) noexcept {
+    static const Kernel kernel = select();
+
+    if (count < EHeapQMinPosCount<T>::value || count > EHEAPQ_SIMD_MAX_COUNT)
+      return eheapq_min_pos_scalar(keys, count);
+    return kernel(keys, count);
+  }
+
+  static Kernel select() noexcept {
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+      return eheapq_min_pos_avx2<T>;
+    if (__builtin_cpu_supports("sse4.2"))
+      return eheapq_min_pos_sse4<T>;
+    return eheapq_min_pos_scalar<T>;
+  }
+};
+
+template <class T>
+inline size_t eheapq_min_pos(const T * keys, size_t count) noexcept {
+  return EHeapQMinPos<T, EHeapQMinPosCount<T>::value != 0>::min_pos(keys, count);
+}
+
+#else
+
+template <class T>
+inline size_t eheapq_min_pos(const T * keys, size_t count) noexcept {
+  return EHeapQMinPos<T>::min_pos(keys, count);
+}
+
+#endif
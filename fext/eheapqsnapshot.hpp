@@ -0,0 +1,313 @@
+/*
+ * eheapqsnapshot - Binary snapshots of the extended heap queue.
+ * Copyright(C) 2020 Fridolin Pokorny
+ *
+ * This program is free software: you can redistribute it and / or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+/*
+ * A snapshot file (see EHeapQ::save() and EHeapQ::load()) is laid out as:
+ *
+ *   header          - EHeapQSnapshotHeader
+ *   records         - fixed size records, items in the order of the heap
+ *                     storage, on an EHEAPQ_SNAPSHOT_ALIGNMENT boundary
+ *   payload         - optional data records refer to (e.g. serialized
+ *                     Python objects), on an EHEAPQ_SNAPSHOT_ALIGNMENT
+ *                     boundary
+ *
+ * Records are stored in the native byte order, a snapshot is rejected on
+ * a machine with a different byte order or a different record size. The
+ * file is mapped on load, so records are read directly from the page cache
+ * and the heap does not need to compare items to restore the heap order.
+ *
+ * Snapshots are written to a temporary file next to the target one, which
+ * is renamed over the target once the snapshot is complete and synced, so
+ * a crash while saving leaves the previous snapshot intact. POSIX only.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <type_traits>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+const char EHEAPQ_SNAPSHOT_MAGIC[8] = {'E', 'H', 'E', 'A', 'P', 'Q', 'S', '\0'};
+const uint32_t EHEAPQ_SNAPSHOT_VERSION = 1;
+const uint32_t EHEAPQ_SNAPSHOT_BYTE_ORDER = 0x01020304;
+// Alignment of sections in the file, a page so that mapped records are page aligned.
+const uint64_t EHEAPQ_SNAPSHOT_ALIGNMENT = 4096;
+// Size of the buffer records are collected in before they are written.
+const size_t EHEAPQ_SNAPSHOT_BUFFER_SIZE = 1 << 20;
+// Position of the last or the max item not tracked by the heap.
+const uint64_t EHEAPQ_SNAPSHOT_NPOS = UINT64_MAX;
+
+// Records are in the heap order, the heap does not need to be rebuilt on load.
+const uint32_t EHEAPQ_SNAPSHOT_ORDERED = 1;
+
+struct EHeapQSnapshotHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t byte_order;
+  uint32_t record_size;
+  uint32_t flags;
+  uint64_t length;
+  // Size bound and arity of the heap saved.
+  uint64_t size;
+  uint64_t arity;
+  // Positions of the last and the max item tracked, EHEAPQ_SNAPSHOT_NPOS if not tracked.
+  uint64_t last_pos;
+  uint64_t max_pos;
+  uint64_t records_offset;
+  uint64_t payload_offset;
+  uint64_t payload_length;
+};
+
+static_assert(std::is_trivially_copyable<EHeapQSnapshotHeader>::value, "the snapshot header has to be trivially copyable");
+
+inline uint64_t eheapq_snapshot_align(uint64_t offset) noexcept {
+  return (offset + EHEAPQ_SNAPSHOT_ALIGNMENT - 1) / EHEAPQ_SNAPSHOT_ALIGNMENT * EHEAPQ_SNAPSHOT_ALIGNMENT;
+}
+
+/*
+ * Writes a snapshot with the given number of records. Records are written
+ * in order, payload can be written in between, e.g. while encoding the
+ * record referring to it. Errors are raised as std::system_error.
+ */
+class EHeapQSnapshotWriter {
+  public:
+    EHeapQSnapshotWriter(const char * path, size_t record_size, uint64_t length);
+    ~EHeapQSnapshotWriter();
+
+    EHeapQSnapshotWriter(const EHeapQSnapshotWriter &) = delete;
+    EHeapQSnapshotWriter & operator=(const EHeapQSnapshotWriter &) = delete;
+
+    template <class Record>
+    void write(const Record & record) {
+      static_assert(std::is_trivially_copyable<Record>::value, "snapshot records have to be trivially copyable");
+      this->write_record(&record);
+    }
+
+    void write_record(const void * record);
+    // Append data to the payload section, returns its offset within the section.
+    uint64_t write_payload(const void * data, size_t length);
+    // Write the header (fields describing the file layout are filled in) and replace the target file.
+    void commit(EHeapQSnapshotHeader header);
+
+  private:
+    std::string path;
+    std::string temp_path;
+    FILE * file;
+
+    size_t record_size;
+    uint64_t length;
+    uint64_t written;
+    uint64_t flushed;
+    std::vector<char> buffer;
+
+    uint64_t records_offset;
+    uint64_t payload_offset;
+    uint64_t payload_length;
+    // The file position is at the end of the payload, seeking flushes the stdio buffer.
+    bool at_payload_end;
+
+    void check(bool ok) const {
+      if (!ok)
+        throw std::system_error(errno, std::generic_category(), this->path);
+    }
+
+    void seek(uint64_t offset) { this->check(fseeko(this->file, off_t(offset), SEEK_SET) == 0); }
+    void flush_records();
+};
+
+inline EHeapQSnapshotWriter::EHeapQSnapshotWriter(const char * path, size_t record_size, uint64_t length)
+  : path(path), temp_path(std::string(path) + ".tmp"), record_size(record_size), length(length),
+    written(0), flushed(0), payload_length(0), at_payload_end(false) {
+  this->records_offset = eheapq_snapshot_align(sizeof(EHeapQSnapshotHeader));
+  this->payload_offset = eheapq_snapshot_align(this->records_offset + length * record_size);
+  this->buffer.reserve(std::max(record_size, EHEAPQ_SNAPSHOT_BUFFER_SIZE / record_size * record_size));
+
+  this->file = fopen(this->temp_path.c_str(), "wb");
+  this->check(this->file != NULL);
+}
+
+inline EHeapQSnapshotWriter::~EHeapQSnapshotWriter() {
+  // Not committed, the previous snapshot is kept.
+  if (this->file) {
+    fclose(this->file);
+    unlink(this->temp_path.c_str());
+  }
+}
+
+inline void EHeapQSnapshotWriter::write_record(const void * record) {
+  if (this->written == this->length)
+    throw std::length_error("more records written than announced");
+
+  const char * data = static_cast<const char *>(record);
+  this->buffer.insert(this->buffer.end(), data, data + this->record_size);
+  this->written++;
+
+  if (this->buffer.size() == this->buffer.capacity())
+    this->flush_records();
+}
+
+inline uint64_t EHeapQSnapshotWriter::write_payload(const void * data, size_t length) {
+  uint64_t offset = this->payload_length;
+
+  if (!this->at_payload_end) {
+    this->seek(this->payload_offset + offset);
+    this->at_payload_end = true;
+  }
+
+  this->check(fwrite(data, 1, length, this->file) == length);
+  this->payload_length += length;
+  return offset;
+}
+
+inline void EHeapQSnapshotWriter::flush_records() {
+  if (this->buffer.empty())
+    return;
+
+  this->seek(this->records_offset + this->flushed * this->record_size);
+  this->at_payload_end = false;
+  this->check(fwrite(this->buffer.data(), 1, this->buffer.size(), this->file) == this->buffer.size());
+  this->flushed = this->written;
+  this->buffer.clear();
+}
+
+inline void EHeapQSnapshotWriter::commit(EHeapQSnapshotHeader header) {
+  if (this->written != this->length)
+    throw std::length_error("fewer records written than announced");
+
+  this->flush_records();
+
+  memcpy(header.magic, EHEAPQ_SNAPSHOT_MAGIC, sizeof(header.magic));
+  header.version = EHEAPQ_SNAPSHOT_VERSION;
+  header.byte_order = EHEAPQ_SNAPSHOT_BYTE_ORDER;
+  header.record_size = uint32_t(this->record_size);
+  header.length = this->length;
+  header.records_offset = this->records_offset;
+  header.payload_offset = this->payload_offset;
+  header.payload_length = this->payload_length;
+
+  this->seek(0);
+  this->check(fwrite(&header, sizeof(header), 1, this->file) == 1);
+  this->check(fflush(this->file) == 0);
+  this->check(ftruncate(fileno(this->file), off_t(this->payload_offset + this->payload_length)) == 0);
+  this->check(fsync(fileno(this->file)) == 0);
+
+  FILE * file = this->file;
+  this->file = NULL;
+  if (fclose(file) != 0 || rename(this->temp_path.c_str(), this->path.c_str()) != 0) {
+    int error = errno;
+    unlink(this->temp_path.c_str());
+    throw std::system_error(error, std::generic_category(), this->path);
+  }
+}
+
+/*
+ * A snapshot file mapped to memory. Errors accessing the file are raised as
+ * std::system_error, the content is checked by is_valid().
+ */
+class EHeapQSnapshotReader {
+  public:
+    explicit EHeapQSnapshotReader(const char * path);
+    ~EHeapQSnapshotReader() {
+      if (this->data)
+        munmap(this->data, this->length);
+    }
+
+    EHeapQSnapshotReader(const EHeapQSnapshotReader &) = delete;
+    EHeapQSnapshotReader & operator=(const EHeapQSnapshotReader &) = delete;
+
+    // Whether the file is a complete snapshot with records of the given size.
+    bool is_valid(size_t record_size) const noexcept;
+
+    const EHeapQSnapshotHeader & get_header() const noexcept { return *reinterpret_cast<const EHeapQSnapshotHeader *>(this->data); }
+
+    template <class Record>
+    const Record * get_records() const noexcept {
+      return reinterpret_cast<const Record *>(static_cast<const char *>(this->data) + this->get_header().records_offset);
+    }
+
+    const char * get_payload() const noexcept { return static_cast<const char *>(this->data) + this->get_header().payload_offset; }
+    uint64_t get_payload_length() const noexcept { return this->get_header().payload_length; }
+
+  private:
+    void * data;
+    size_t length;
+};
+
+inline EHeapQSnapshotReader::EHeapQSnapshotReader(const char * path) : data(NULL), length(0) {
+  struct stat info;
+  int fd = open(path, O_RDONLY);
+
+  if (fd < 0 || fstat(fd, &info) != 0) {
+    int error = errno;
+    if (fd >= 0)
+      close(fd);
+    throw std::system_error(error, std::generic_category(), path);
+  }
+
+  // A file too short to be mapped is rejected by is_valid().
+  if (size_t(info.st_size) >= sizeof(EHeapQSnapshotHeader)) {
+    void * data = mmap(NULL, size_t(info.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+    if (data == MAP_FAILED) {
+      int error = errno;
+      close(fd);
+      throw std::system_error(error, std::generic_category(), path);
+    }
+
+    this->data = data;
+    this->length = size_t(info.st_size);
+    madvise(this->data, this->length, MADV_SEQUENTIAL);
+  }
+
+  close(fd);
+}
+
+inline bool EHeapQSnapshotReader::is_valid(size_t record_size) const noexcept {
+  if (!this->data)
+    return false;
+
+  const EHeapQSnapshotHeader & header = this->get_header();
+
+  if (memcmp(header.magic, EHEAPQ_SNAPSHOT_MAGIC, sizeof(header.magic)) != 0 ||
+      header.version != EHEAPQ_SNAPSHOT_VERSION ||
+      header.byte_order != EHEAPQ_SNAPSHOT_BYTE_ORDER ||
+      header.record_size != record_size)
+    return false;
+
+  // Sections have to lie within the file, checked without overflows.
+  if (header.records_offset % EHEAPQ_SNAPSHOT_ALIGNMENT != 0 ||
+      header.records_offset > this->length ||
+      header.length > (this->length - header.records_offset) / record_size ||
+      header.payload_offset < header.records_offset + header.length * record_size ||
+      header.payload_offset > this->length ||
+      header.payload_length > this->length - header.payload_offset)
+    return false;
+
+  return (header.last_pos == EHEAPQ_SNAPSHOT_NPOS || header.last_pos < header.length) &&
+         (header.max_pos == EHEAPQ_SNAPSHOT_NPOS || header.max_pos < header.length);
+}
@@ -0,0 +1,270 @@
+/*
+ * eheapqstorage - Storage policies for the extended heap queue.
+ * Copyright(C) 2020 Fridolin Pokorny
+ *
+ * This program is free software: you can redistribute it and / or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+/*
+ * A storage policy keeps the array of items the heap is laid out in:
+ *
+ *   size_t size() const                 - number of items stored
+ *   get(size_t pos) const               - item on the position, by value or by const reference
+ *   T take(size_t pos)                  - move the item out of the position, the position is set
+ *                                         again before it is accessed
+ *   void set(size_t pos, const T &), void set(size_t pos, T &&)
+ *                                       - store the item on the position
+ *   void push_back(const T &), void push_back(T &&)
+ *   void pop_back()
+ *   void append(InputIt, InputIt)       - store items from the range after the last one
+ *   void resize(size_t)                 - shrink to the given number of items
+ *   void reserve(size_t)                - capacity hint
+ *   void clear()
+ *   begin(), end()                      - iteration over items stored, in no particular order
+ *   size_t min_child(Compare &, size_t first, size_t last) const
+ *                                       - position of the smallest item in [first, last), the last
+ *                                         one of equal items
+ *
+ * Policies are default constructible and constructible from an allocator
+ * passed to the heap, the same as index policies (see eheapqindex.hpp).
+ *
+ * The heap compares items on positions as comp(get(a), get(b)), so
+ * a storage returning items by value lets the compiler skip loading parts
+ * of items the comparison does not use.
+ */
+
+#pragma once
+
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include "ecowvector.hpp"
+#include "eheapqsimd.hpp"
+
+template <class P, class V>
+struct EHeapQPriorityItem;
+template <class P, class V, class Compare>
+struct EHeapQPriorityCompare;
+
+/*
+ * The default storage policy - items are stored in one vector.
+ */
+template <class T, class Allocator = std::allocator<T>>
+class EHeapQVectorStorage {
+  public:
+    typedef typename std::vector<T, Allocator>::const_iterator const_iterator;
+
+    EHeapQVectorStorage() {}
+    template <class A>
+    explicit EHeapQVectorStorage(const A & allocator) : items(Allocator(allocator)) {}
+
+    size_t size() const noexcept { return this->items.size(); }
+    const T & get(size_t pos) const noexcept { return this->items.data()[pos]; }
+    T take(size_t pos) noexcept { return std::move(this->items.data()[pos]); }
+    void set(size_t pos, const T & item) { this->items.data()[pos] = item; }
+    void set(size_t pos, T && item) { this->items.data()[pos] = std::move(item); }
+
+    void push_back(const T & item) { this->items.push_back(item); }
+    void push_back(T && item) { this->items.push_back(std::move(item)); }
+    void pop_back() noexcept { this->items.pop_back(); }
+    template <class InputIt>
+    void append(InputIt first, InputIt last) { this->items.insert(this->items.end(), first, last); }
+    void resize(size_t size) { this->items.resize(size); }
+    void reserve(size_t size) { this->items.reserve(size); }
+    void clear() noexcept { this->items.clear(); }
+
+    template <class Compare>
+    size_t min_child(Compare & comp, size_t first, size_t last) const {
+      for (auto i = first + 1; i < last; i++) {
+        if (! comp(this->items.data()[first], this->items.data()[i]))
+          first = i;
+      }
+      return first;
+    }
+
+    const_iterator begin() const noexcept { return this->items.begin(); }
+    const_iterator end() const noexcept { return this->items.end(); }
+
+  private:
+    std::vector<T, Allocator> items;
+};
+
+/*
+ * A copy-on-write storage policy - items are kept in chunks of an
+ * ECowVector, so copying the storage (and so the heap) takes time
+ * proportional to the number of chunks and copies share chunks until
+ * they are changed. A sift changes a path in the tree, so a heap copy that
+ * pushes and pops items clones only chunks on the paths, the root chunk
+ * being the most common one.
+ */
+template <class T, class Allocator = std::allocator<T>>
+class EHeapQCowStorage {
+  public:
+    typedef typename ECowVector<T, Allocator>::const_iterator const_iterator;
+
+    EHeapQCowStorage() {}
+    template <class A>
+    explicit EHeapQCowStorage(const A & allocator) : items(Allocator(allocator)) {}
+
+    size_t size() const noexcept { return this->items.size(); }
+    const T & get(size_t pos) const noexcept { return this->items[pos]; }
+    T take(size_t pos) { return std::move(this->items[pos]); }
+    void set(size_t pos, const T & item) { this->items[pos] = item; }
+    void set(size_t pos, T && item) { this->items[pos] = std::move(item); }
+
+    void push_back(const T & item) { this->items.push_back(item); }
+    void push_back(T && item) { this->items.push_back(std::move(item)); }
+    void pop_back() noexcept { this->items.pop_back(); }
+    template <class InputIt>
+    void append(InputIt first, InputIt last) {
+      for (; first != last; ++first)
+        this->items.push_back(*first);
+    }
+    void resize(size_t size) { this->items.resize(size); }
+    void reserve(size_t size) { this->items.reserve(size); }
+    void clear() noexcept { this->items.clear(); }
+
+    template <class Compare>
+    size_t min_child(Compare & comp, size_t first, size_t last) const {
+      for (auto i = first + 1; i < last; i++) {
+        if (! comp(this->get(first), this->get(i)))
+          first = i;
+      }
+      return first;
+    }
+
+    const_iterator begin() const noexcept { return this->items.begin(); }
+    const_iterator end() const noexcept { return this->items.end(); }
+
+    // Number of chunks shared with copies of the storage.
+    size_t get_shared_count() const noexcept { return this->items.get_shared_count(); }
+
+  private:
+    ECowVector<T, Allocator> items;
+};
+
+/*
+ * A structure-of-arrays storage policy for EHeapQPriorityItem<P, V> items.
+ * Priorities are kept in a dense array separate from the values, so
+ * comparing children of an item touches only the priority array - with
+ * 8 byte priorities, an 8-ary heap compares all siblings within one cache
+ * line. Items are returned by value. If items are ordered by priorities
+ * using std::less, children are selected by vectorized kernels, see
+ * eheapqsimd.hpp.
+ */
+template <class P, class V, class Allocator = std::allocator<EHeapQPriorityItem<P, V>>>
+class EHeapQSoAStorage {
+  public:
+    typedef EHeapQPriorityItem<P, V> T;
+
+    EHeapQSoAStorage() {}
+    template <class A>
+    explicit EHeapQSoAStorage(const A & allocator)
+      : priorities(PriorityAllocator(allocator)), values(ValueAllocator(allocator)) {}
+
+    class const_iterator {
+      public:
+        typedef std::forward_iterator_tag iterator_category;
+        typedef T value_type;
+        typedef std::ptrdiff_t difference_type;
+        typedef const T * pointer;
+        typedef T reference;
+
+        const_iterator(const EHeapQSoAStorage * storage, size_t pos) : storage(storage), pos(pos) {}
+
+        T operator*() const noexcept { return this->storage->get(this->pos); }
+        const_iterator & operator++() noexcept { this->pos++; return *this; }
+        const_iterator operator++(int) noexcept { const_iterator result = *this; this->pos++; return result; }
+        bool operator==(const const_iterator & other) const noexcept { return this->pos == other.pos; }
+        bool operator!=(const const_iterator & other) const noexcept { return this->pos != other.pos; }
+
+      private:
+        const EHeapQSoAStorage * storage;
+        size_t pos;
+    };
+
+    size_t size() const noexcept { return this->priorities.size(); }
+    T get(size_t pos) const noexcept { return {this->priorities.data()[pos], this->values.data()[pos]}; }
+    T take(size_t pos) noexcept { return {this->priorities.data()[pos], std::move(this->values.data()[pos])}; }
+    void set(size_t pos, const T & item) {
+      this->priorities.data()[pos] = item.priority;
+      this->values.data()[pos] = item.item;
+    }
+
+    void set(size_t pos, T && item) {
+      this->priorities.data()[pos] = item.priority;
+      this->values.data()[pos] = std::move(item.item);
+    }
+
+    void push_back(const T & item) {
+      this->priorities.push_back(item.priority);
+      this->values.push_back(item.item);
+    }
+
+    void push_back(T && item) {
+      this->priorities.push_back(item.priority);
+      this->values.push_back(std::move(item.item));
+    }
+
+    void pop_back() noexcept {
+      this->priorities.pop_back();
+      this->values.pop_back();
+    }
+
+    template <class InputIt>
+    void append(InputIt first, InputIt last) {
+      for (; first != last; ++first)
+        this->push_back(*first);
+    }
+
+    void resize(size_t size) {
+      this->priorities.resize(size);
+      this->values.resize(size);
+    }
+
+    void reserve(size_t size) {
+      this->priorities.reserve(size);
+      this->values.reserve(size);
+    }
+
+    void clear() noexcept {
+      this->priorities.clear();
+      this->values.clear();
+    }
+
+    template <class Compare>
+    size_t min_child(Compare & comp, size_t first, size_t last) const {
+      for (auto i = first + 1; i < last; i++) {
+        if (! comp(this->get(first), this->get(i)))
+          first = i;
+      }
+      return first;
+    }
+
+    size_t min_child(EHeapQPriorityCompare<P, V, std::less<P>> &, size_t first, size_t last) const noexcept {
+      return first + eheapq_min_pos(this->priorities.data() + first, last - first);
+    }
+
+    const_iterator begin() const noexcept { return const_iterator(this, 0); }
+    const_iterator end() const noexcept { return const_iterator(this, this->size()); }
+
+  private:
+    typedef typename std::allocator_traits<Allocator>::template rebind_alloc<P> PriorityAllocator;
+    typedef typename std::allocator_traits<Allocator>::template rebind_alloc<V> ValueAllocator;
+
+    std::vector<P, PriorityAllocator> priorities;
+    std::vector<V, ValueAllocator> values;
+};
@@ -0,0 +1,502 @@
+/*
+ * eminmaxheapq - A min-max heap with the interface of the extended heap queue.
+ * Copyright(C) 2020 Fridolin Pokorny
+ *
+ * This program is free software: you can redistribute it and / or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+/*
+ * A min-max heap (Atkinson et al., 1986) is a binary heap whose levels
+ * alternate between min levels (even depth, starting with the root) and max
+ * levels (odd depth). An item on a min level is the smallest item of its
+ * subtree, an item on a max level is the largest one. Hence the smallest
+ * item is the root and the largest one is one of its children, both can be
+ * retrieved in O(1) and popped in O(log(N)).
+ *
+ * EMinMaxHeapQ can be used in place of EHeapQ, it shares index policies,
+ * exceptions and semantics of the bounded size - once the heap is full, the
+ * smallest item is evicted. Additionally, pop_max() is provided.
+ */
+
+#pragma once
+
+#include "eheapq.hpp"
+
+template <
+  class T,
+  class Compare = std::less<T>,
+  class Index = EHeapQHashIndex<T>
+>
+class EMinMaxHeapQ {
+  public:
+    EMinMaxHeapQ(size_t size = EHEAPQ_DEFAULT_SIZE);
+    ~EMinMaxHeapQ();
+
+    T get_top() const { this->throw_on_empty(); return this->heap->at(0); }
+    T get_last() const {
+        if (this->heap->size() == 0) {
+           throw EHeapQEmptyExc;
+        }
+
+        if (!this->last_item_set) {
+           throw EHeapQNoLastExc;
+        }
+
+        return this->last_item;
+    }
+    T get_max() const { this->throw_on_empty(); return this->heap->data()[this->max_pos()]; }
+    void set_size(size_t size);
+    void reserve(size_t size) { this->heap->reserve(size); this->index.reserve(size); }
+    size_t get_size() const noexcept { return this->size; }
+    size_t get_length() const noexcept { return this->heap->size(); }
+    const std::vector<T> * get_items() const { return this->heap; }
+    Compare & get_compare() noexcept { return this->comp; }
+
+    /*
+     * Push the item, if the heap is full the smallest item is evicted (and
+     * stored to evicted if given). Returns false if the pushed item itself
+     * does not fit.
+     */
+    bool push(T item, T * evicted = nullptr) { return this->push_item(item, evicted); }
+    T pushpop(T item);
+    T pop(void) { this->throw_on_empty(); return this->remove_at(0); }
+    T pop_max(void) { this->throw_on_empty(); return this->remove_at(this->max_pos()); }
+    T replace(T item);
+    void remove(T item);
+    void update(T item);
+    // Move all the items to items and leave the heap empty, items are not compared.
+    void detach(std::vector<T> & items);
+
+    // Operations on handles, see EHeapQ.
+    EHeapQHandle push_handle(T item, T * evicted = nullptr) {
+      return this->push_item(item, evicted) ? this->index.handle(item) : EHEAPQ_NO_HANDLE;
+    }
+    T get_item(EHeapQHandle handle) const { return this->heap->data()[this->locate_handle(handle)]; }
+    T remove_handle(EHeapQHandle handle) { return this->remove_at(this->locate_handle(handle)); }
+    void update_handle(EHeapQHandle handle, T item) { this->update_at(this->locate_handle(handle), item); }
+    Index & get_index() noexcept { return this->index; }
+
+  private:
+    std::vector<T> * heap;
+
+    long unsigned int size;
+    Compare comp;
+
+    T last_item;
+    bool last_item_set;
+
+    Index index;
+
+    // Swaps done by the running operation, undone if the comparison fails.
+    std::vector<std::pair<size_t, size_t>> swaps;
+
+    void throw_on_empty() const {
+      if (this->heap->size() == 0)
+        throw EHeapQEmptyExc;
+    }
+
+    // Position of the given item in this heap, EHEAPQ_NPOS if not present.
+    size_t locate(const T & item) const noexcept {
+      size_t pos = this->index.find(item);
+      if (pos >= this->heap->size() || !(this->heap->data()[pos] == item))
+        return EHEAPQ_NPOS;
+      return pos;
+    }
+
+    size_t locate_handle(EHeapQHandle handle) const {
+      size_t pos = this->index.find_handle(handle);
+      if (pos >= this->heap->size())
+        throw EHeapQNotFoundExc;
+      return pos;
+    }
+
+    // The largest item is one of the children of the root (if any).
+    size_t max_pos() const {
+      auto size = this->heap->size();
+      auto arr = this->heap->data();
+
+      if (size < 3)
+        return size - 1;
+
+      return this->comp(arr[1], arr[2]) ? 2 : 1;
+    }
+
+    static bool is_min_level(size_t pos) noexcept { return ((63 - __builtin_clzll(uint64_t(pos) + 1)) & 1) == 0; }
+
+    // Order of items on min levels (Max = false) or max levels (Max = true).
+    template <bool Max>
+    bool before(const T & a, const T & b) { return Max ? this->comp(b, a) : this->comp(a, b); }
+
+    void swap(size_t a, size_t b) {
+      this->swaps.emplace_back(a, b);
+      this->exchange(a, b);
+    }
+
+    void exchange(size_t a, size_t b) noexcept {
+      auto arr = this->heap->data();
+      T tmp = arr[a];
+
+      arr[a] = arr[b];
+      arr[b] = tmp;
+      this->index.swap(arr[a], b, tmp, a);
+    }
+
+    // Move items back to positions they had before the running operation.
+    void undo_swaps() noexcept {
+      while (!this->swaps.empty()) {
+        this->exchange(this->swaps.back().first, this->swaps.back().second);
+        this->swaps.pop_back();
+      }
+    }
+
+    bool push_item(T & item, T * evicted);
+    bool pushpop_item(T & item, T & result);
+    T replace_top(T & item);
+    T remove_at(size_t pos);
+    void update_at(size_t pos, T & item);
+    void fix(size_t pos);
+
+    void bubble_up(size_t pos);
+    template <bool Max> void bubble_up_level(size_t pos);
+    template <bool Max> size_t trickle_down_level(size_t pos);
+
+    void set_last_item(T item) noexcept { this->last_item = item; this->last_item_set = true; }
+    void maybe_del_last_item(T item) noexcept { if (this->last_item_set && this->last_item == item) { this->last_item_set = false; }}
+};
+
+template <class T, class Compare, class Index>
+EMinMaxHeapQ<T, Compare, Index>::EMinMaxHeapQ(size_t size) {
+    this->size = size;
+    this->heap = new std::vector<T>;
+    this->last_item_set = false;
+    this->comp = Compare();
+}
+
+template <class T, class Compare, class Index>
+EMinMaxHeapQ<T, Compare, Index>::~EMinMaxHeapQ() {
+    delete this->heap;
+}
+
+/*
+ * Move the item at the given position towards the root, the subtree rooted
+ * at the position is expected to satisfy the min-max heap invariant with
+ * the item.
+ */
+template <class T, class Compare, class Index>
+void EMinMaxHeapQ<T, Compare, Index>::bubble_up(size_t pos) {
+  auto arr = this->heap->data();
+  size_t parent_pos;
+
+  if (pos == 0)
+    return;
+
+  parent_pos = (pos - 1) / 2;
+  if (is_min_level(pos)) {
+    if (this->comp(arr[parent_pos], arr[pos])) {
+      this->swap(pos, parent_pos);
+      this->bubble_up_level<true>(parent_pos);
+    } else {
+      this->bubble_up_level<false>(pos);
+    }
+  } else {
+    if (this->comp(arr[pos], arr[parent_pos])) {
+      this->swap(pos, parent_pos);
+      this->bubble_up_level<false>(parent_pos);
+    } else {
+      this->bubble_up_level<true>(pos);
+    }
+  }
+}
+
+// Move the item towards the root over grandparents, staying on min or max levels.
+template <class T, class Compare, class Index>
+template <bool Max>
+void EMinMaxHeapQ<T, Compare, Index>::bubble_up_level(size_t pos) {
+  auto arr = this->heap->data();
+  size_t grandparent_pos;
+
+  while (pos > 2) {
+    grandparent_pos = (pos - 3) / 4;
+    if (!this->before<Max>(arr[pos], arr[grandparent_pos]))
+      break;
+
+    this->swap(pos, grandparent_pos);
+    pos = grandparent_pos;
+  }
+}
+
+/*
+ * Move the item at the given position (on a min level if Max is false,
+ * on a max level otherwise) towards leaves. Returns the final position of
+ * the item.
+ */
+template <class T, class Compare, class Index>
+template <bool Max>
+size_t EMinMaxHeapQ<T, Compare, Index>::trickle_down_level(size_t pos) {
+  auto size = this->heap->size();
+  auto arr = this->heap->data();
+  size_t result = pos;
+  size_t child_pos, grandchild_pos, last_pos, m, parent_pos;
+
+  for (;;) {
+    child_pos = 2 * pos + 1;
+    if (child_pos >= size)
+      return result;
+
+    // The smallest (largest) of children and grandchildren.
+    m = child_pos;
+    if (child_pos + 1 < size && this->before<Max>(arr[child_pos + 1], arr[m]))
+      m = child_pos + 1;
+
+    grandchild_pos = 2 * child_pos + 1;
+    last_pos = std::min(grandchild_pos + 4, size);
+    for (auto i = grandchild_pos; i < last_pos; i++) {
+      if (this->before<Max>(arr[i], arr[m]))
+        m = i;
+    }
+
+    if (!this->before<Max>(arr[m], arr[pos]))
+      return result;
+
+    this->swap(m, pos);
+    if (result == pos)
+      result = m;
+
+    if (m < grandchild_pos)
+      return result;
+
+    // The item got below a node on the opposite level, restore their order.
+    parent_pos = (m - 1) / 2;
+    if (this->before<Max>(arr[parent_pos], arr[m])) {
+      this->swap(m, parent_pos);
+      if (result == m)
+        result = parent_pos;
+    }
+
+    pos = m;
+  }
+}
+
+/*
+ * Restore the invariant after the item at the given position was replaced
+ * by an arbitrary item - first place it within its subtree, then towards
+ * the root.
+ */
+template <class T, class Compare, class Index>
+void EMinMaxHeapQ<T, Compare, Index>::fix(size_t pos) {
+  if (is_min_level(pos))
+    pos = this->trickle_down_level<false>(pos);
+  else
+    pos = this->trickle_down_level<true>(pos);
+
+  this->bubble_up(pos);
+}
+
+/*
+ * Push the item and pop the smallest item into result. If the item is the
+ * smallest one, it is not pushed at all, result is set to it and false is
+ * returned.
+ */
+template <class T, class Compare, class Index>
+bool EMinMaxHeapQ<T, Compare, Index>::pushpop_item(T & item, T & result) {
+    if (this->locate(item) != EHEAPQ_NPOS)
+      throw EHeapQAlreadyPresentExc;
+
+    if (this->heap->size() > 0 && this->comp(this->heap->at(0), item)) {
+        result = this->replace_top(item);
+        return true;
+    }
+
+    result = item;
+    return false;
+}
+
+/*
+ * Replace the smallest item by the given one and return it. The heap is
+ * left unchanged if the comparison fails.
+ */
+template <class T, class Compare, class Index>
+T EMinMaxHeapQ<T, Compare, Index>::replace_top(T & item) {
+  auto arr = this->heap->data();
+  T result = arr[0];
+
+  // The replaced item stays indexed until the heap is fixed, so that it can be put back.
+  this->index.insert(item, 0);
+  arr[0] = item;
+
+  this->swaps.clear();
+  try {
+    this->fix(0);
+  } catch (...) {
+    this->undo_swaps();
+    arr[0] = result;
+    this->index.erase(item);
+    throw;
+  }
+
+  this->index.erase(result);
+  this->set_last_item(item);
+  return result;
+}
+
+template <class T, class Compare, class Index>
+T EMinMaxHeapQ<T, Compare, Index>::pushpop(T item) {
+    T result;
+
+    this->pushpop_item(item, result);
+    return result;
+}
+
+template <class T, class Compare, class Index>
+bool EMinMaxHeapQ<T, Compare, Index>::push_item(T & item, T * evicted) {
+  if (this->locate(item) != EHEAPQ_NPOS)
+    throw EHeapQAlreadyPresentExc;
+
+  if (this->heap->size() == this->size) {
+    T result;
+
+    if (!this->pushpop_item(item, result))
+      return false;
+
+    if (evicted)
+      *evicted = result;
+    return true;
+  }
+
+  this->heap->push_back(item);
+  try {
+    this->index.insert(item, this->heap->size() - 1);
+  } catch (...) {
+    this->heap->pop_back();
+    throw;
+  }
+
+  this->swaps.clear();
+  try {
+    this->bubble_up(this->heap->size() - 1);
+  } catch (...) {
+    this->undo_swaps();
+    this->index.erase(item);
+    this->heap->pop_back();
+    throw;
+  }
+
+  this->set_last_item(item);
+  return true;
+}
+
+template <class T, class Compare, class Index>
+void EMinMaxHeapQ<T, Compare, Index>::set_size(size_t size) {
+  this->size = size;
+
+  while (this->heap->size() > this->size)
+     this->pop();
+}
+
+template <class T, class Compare, class Index>
+T EMinMaxHeapQ<T, Compare, Index>::replace(T item) {
+  this->throw_on_empty();
+
+  if (this->locate(item) != EHEAPQ_NPOS)
+    throw EHeapQAlreadyPresentExc;
+
+  return this->replace_top(item);
+}
+
+template <class T, class Compare, class Index>
+void EMinMaxHeapQ<T, Compare, Index>::remove(T item) {
+  size_t idx = this->locate(item);
+
+  if (idx == EHEAPQ_NPOS)
+    throw EHeapQNotFoundExc;
+
+  this->remove_at(idx);
+}
+
+/*
+ * Remove the item at the given position, the last item takes its place.
+ * The heap is left unchanged if the comparison fails.
+ */
+template <class T, class Compare, class Index>
+T EMinMaxHeapQ<T, Compare, Index>::remove_at(size_t idx) {
+  auto arr = this->heap->data();
+  size_t last = this->heap->size() - 1;
+  T item = arr[idx];
+
+  if (idx != last) {
+    arr[idx] = arr[last];
+    this->index.move(arr[idx], last, idx);
+  }
+
+  // Removed items stay indexed until the heap is fixed, the storage keeps its capacity.
+  this->heap->pop_back();
+  if (idx < last) {
+    this->swaps.clear();
+    try {
+      this->fix(idx);
+    } catch (...) {
+      this->undo_swaps();
+      this->heap->push_back(arr[idx]);
+      arr[idx] = item;
+      this->index.move(arr[last], idx, last);
+      throw;
+    }
+  }
+
+  this->index.erase(item);
+  this->maybe_del_last_item(item);
+  return item;
+}
+
+template <class T, class Compare, class Index>
+void EMinMaxHeapQ<T, Compare, Index>::detach(std::vector<T> & items) {
+  items.reserve(items.size() + this->heap->size());
+  for (auto & item : *this->heap) {
+    this->index.erase(item);
+    items.push_back(item);
+  }
+
+  this->heap->clear();
+  this->last_item_set = false;
+}
+
+template <class T, class Compare, class Index>
+void EMinMaxHeapQ<T, Compare, Index>::update(T item) {
+  size_t idx = this->locate(item);
+
+  if (idx == EHEAPQ_NPOS)
+    throw EHeapQNotFoundExc;
+
+  this->update_at(idx, item);
+}
+
+template <class T, class Compare, class Index>
+void EMinMaxHeapQ<T, Compare, Index>::update_at(size_t idx, T & item) {
+  auto arr = this->heap->data();
+  T stored = arr[idx];
+
+  this->index.update(stored, item);
+  arr[idx] = item;
+
+  this->swaps.clear();
+  try {
+    this->fix(idx);
+  } catch (...) {
+    this->undo_swaps();
+    arr[idx] = stored;
+    throw;
+  }
+
+  if (this->last_item_set && this->last_item == item)
+    this->last_item = item;
+}
@@ -0,0 +1,217 @@
+/*
+ * emultiheapq - A relaxed concurrent priority queue (MultiQueue).
+ * Copyright(C) 2020 Fridolin Pokorny
+ *
+ * This program is free software: you can redistribute it and / or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+/*
+ * A MultiQueue (Rihani et al., 2015) keeps c * P heaps, each guarded by
+ * its own lock, for P threads. An item is pushed to a random heap, pop
+ * samples two random heaps and pops the better of their top items. Threads
+ * rarely meet on the same lock, so the throughput scales with the number
+ * of threads, but the item popped is only approximately the smallest one -
+ * the expected rank error grows linearly with the number of heaps. The
+ * relaxation factor c trades the rank error for less contention.
+ *
+ * Items cannot be removed or updated, the heaps use EHeapQNullIndex by
+ * default.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "eheapq.hpp"
+
+const size_t EMULTIHEAPQ_DEFAULT_FACTOR = 2;
+// Bound of the number of heaps (threads * factor), each heap takes its own cache lines.
+const size_t EMULTIHEAPQ_MAX_QUEUES = 4096;
+// Attempts to take a random lock without blocking, then the operation blocks.
+const unsigned EMULTIHEAPQ_TRY_LOCK_ATTEMPTS = 8;
+
+class EMultiHeapQTooManyQueues: public EHeapQException {
+  public:
+    virtual const char* what() const throw() {
+      return "number of heaps (threads * factor) has to be at most 4096";
+    }
+} EMultiHeapQTooManyQueuesExc;
+
+template <
+  class T,
+  class Compare = std::less<T>,
+  size_t Arity = EHEAPQ_DEFAULT_ARITY,
+  class Index = EHeapQNullIndex<T>,
+  class Storage = EHeapQVectorStorage<T>
+>
+class EMultiHeapQ {
+  public:
+    typedef EHeapQ<T, Compare, Arity, Index, Storage> Heap;
+
+    /*
+     * If threads is 0, the number of hardware threads is used. Throws
+     * EMultiHeapQTooManyQueues if threads * factor exceeds
+     * EMULTIHEAPQ_MAX_QUEUES.
+     */
+    EMultiHeapQ(size_t threads = 0, size_t factor = EMULTIHEAPQ_DEFAULT_FACTOR, size_t arity = Arity);
+
+    EMultiHeapQ(const EMultiHeapQ &) = delete;
+    EMultiHeapQ & operator=(const EMultiHeapQ &) = delete;
+
+    void push(T item);
+    T pop(void);
+    // Pop an item if any heap is not empty, does not raise EHeapQEmpty.
+    bool try_pop(T & item);
+
+    // Not a snapshot if other threads change the queue meanwhile.
+    size_t get_length();
+    size_t get_queue_count() const noexcept { return this->queues.size(); }
+    size_t get_arity() const noexcept { return this->queues[0]->heap.get_arity(); }
+
+    // Call the function on each item stored, heaps are locked one at a time.
+    template <class Function>
+    void for_each(Function function);
+
+  private:
+    struct alignas(64) Queue {
+      Queue(size_t arity) : heap(EHEAPQ_DEFAULT_SIZE, arity) {}
+
+      std::mutex lock;
+      Heap heap;
+    };
+
+    std::vector<std::unique_ptr<Queue>> queues;
+    Compare comp;
+
+    static uint64_t random() noexcept {
+      thread_local uint64_t state = uint64_t(std::hash<std::thread::id>()(std::this_thread::get_id())) | 1;
+
+      // xorshift64*
+      state ^= state >> 12;
+      state ^= state << 25;
+      state ^= state >> 27;
+      return state * UINT64_C(0x2545F4914F6CDD1D);
+    }
+
+    Queue & random_queue() noexcept { return *this->queues[random() % this->queues.size()]; }
+};
+
+template <class T, class Compare, size_t Arity, class Index, class Storage>
+EMultiHeapQ<T, Compare, Arity, Index, Storage>::EMultiHeapQ(size_t threads, size_t factor, size_t arity) {
+  if (threads == 0)
+    threads = std::max(1u, std::thread::hardware_concurrency());
+
+  if (factor > 0 && threads > EMULTIHEAPQ_MAX_QUEUES / factor)
+    throw EMultiHeapQTooManyQueuesExc;
+
+  size_t count = std::max(size_t(1), threads * factor);
+  this->queues.reserve(count);
+  for (size_t i = 0; i < count; i++)
+    this->queues.emplace_back(new Queue(arity));
+}
+
+template <class T, class Compare, size_t Arity, class Index, class Storage>
+void EMultiHeapQ<T, Compare, Arity, Index, Storage>::push(T item) {
+  for (unsigned attempt = 0; attempt < EMULTIHEAPQ_TRY_LOCK_ATTEMPTS; attempt++) {
+    Queue & queue = this->random_queue();
+    std::unique_lock<std::mutex> lock(queue.lock, std::try_to_lock);
+
+    if (lock) {
+      queue.heap.push(item);
+      return;
+    }
+  }
+
+  Queue & queue = this->random_queue();
+  std::lock_guard<std::mutex> lock(queue.lock);
+  queue.heap.push(item);
+}
+
+template <class T, class Compare, size_t Arity, class Index, class Storage>
+bool EMultiHeapQ<T, Compare, Arity, Index, Storage>::try_pop(T & item) {
+  for (unsigned attempt = 0;; attempt++) {
+    Queue & first = this->random_queue();
+    Queue & second = this->random_queue();
+    std::unique_lock<std::mutex> first_lock(first.lock, std::defer_lock);
+    std::unique_lock<std::mutex> second_lock(second.lock, std::defer_lock);
+
+    if (attempt >= EMULTIHEAPQ_TRY_LOCK_ATTEMPTS) {
+      if (&first == &second)
+        first_lock.lock();
+      else
+        std::lock(first_lock, second_lock);
+    } else if (&first == &second ? !first_lock.try_lock() : std::try_lock(first_lock, second_lock) != -1) {
+      continue;
+    }
+
+    Heap & a = first.heap;
+    Heap & b = second.heap;
+
+    if (a.get_length() == 0 && b.get_length() == 0)
+      break;
+
+    Heap & best = a.get_length() == 0 || (b.get_length() != 0 && this->comp(b.get_top(), a.get_top())) ? b : a;
+    item = best.pop();
+    return true;
+  }
+
+  // Both heaps sampled are empty, look for any item left.
+  size_t start = random() % this->queues.size();
+  for (size_t i = 0; i < this->queues.size(); i++) {
+    Queue & queue = *this->queues[(start + i) % this->queues.size()];
+    std::lock_guard<std::mutex> lock(queue.lock);
+
+    if (queue.heap.get_length() != 0) {
+      item = queue.heap.pop();
+      return true;
+    }
+  }
+
+  return false;
+}
+
+template <class T, class Compare, size_t Arity, class Index, class Storage>
+T EMultiHeapQ<T, Compare, Arity, Index, Storage>::pop(void) {
+  T item;
+
+  if (!this->try_pop(item))
+    throw EHeapQEmptyExc;
+
+  return item;
+}
+
+template <class T, class Compare, size_t Arity, class Index, class Storage>
+size_t EMultiHeapQ<T, Compare, Arity, Index, Storage>::get_length() {
+  size_t length = 0;
+
+  for (auto & queue : this->queues) {
+    std::lock_guard<std::mutex> lock(queue->lock);
+    length += queue->heap.get_length();
+  }
+
+  return length;
+}
+
+template <class T, class Compare, size_t Arity, class Index, class Storage>
+template <class Function>
+void EMultiHeapQ<T, Compare, Arity, Index, Storage>::for_each(Function function) {
+  for (auto & queue : this->queues) {
+    std::lock_guard<std::mutex> lock(queue->lock);
+    for (auto item : *queue->heap.get_items())
+      function(item);
+  }
+}
@@ -0,0 +1,257 @@
+/*
+ * epairingheapq - A pairing heap with constant time meld.
+ * Copyright(C) 2020 Fridolin Pokorny
+ *
+ * This program is free software: you can redistribute it and / or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+/*
+ * A pairing heap (Fredman et al., 1986) keeps items in a multiway tree of
+ * nodes, the root being the top item. Push and merge link two trees with
+ * a single comparison in O(1), the work is deferred to pop, which pairs the
+ * children of the root in two passes in O(log(N)) amortized. Compared to
+ * EHeapQ, merging heaps does not touch their items, but each item is a
+ * separately allocated node, so pops are slower - the engine pays off for
+ * workloads dominated by merges.
+ *
+ * Items cannot be removed or updated, there is no index. Heaps merged have
+ * to use equal allocators, nodes are moved between them.
+ */
+
+#pragma once
+
+#include <functional>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include "eheapq.hpp"
+
+template <
+  class T,
+  class Compare = std::less<T>,
+  class Allocator = std::allocator<T>
+>
+class EPairingHeapQ {
+  public:
+    EPairingHeapQ(size_t size = EHEAPQ_DEFAULT_SIZE, const Allocator & allocator = Allocator())
+      : size(size), length(0), root(nullptr), allocator(allocator) {}
+    ~EPairingHeapQ() { this->clear(); }
+
+    EPairingHeapQ(const EPairingHeapQ &) = delete;
+    EPairingHeapQ & operator=(const EPairingHeapQ &) = delete;
+
+    /*
+     * Push the item, return false if the heap is full and the item would be
+     * evicted right away. Otherwise, the evicted top item is stored to
+     * evicted (if not NULL).
+     */
+    bool push(T item, T * evicted = nullptr);
+    T pop(void);
+    /*
+     * Move all the items of the other heap to this heap in O(1). Top items
+     * that do not fit into the heap are popped and stored to evicted (if
+     * given).
+     */
+    void merge(EPairingHeapQ & other, std::vector<T> * evicted = nullptr);
+    void clear() noexcept;
+
+    const T & get_top() const {
+      if (!this->root)
+        throw EHeapQEmptyExc;
+      return this->root->item;
+    }
+
+    size_t get_length() const noexcept { return this->length; }
+    size_t get_size() const noexcept { return this->size; }
+    Compare & get_compare() noexcept { return this->comp; }
+
+  private:
+    // The first child and the next sibling of the node, children are not ordered.
+    struct Node {
+      T item;
+      Node * child;
+      Node * sibling;
+    };
+
+    typedef typename std::allocator_traits<Allocator>::template rebind_alloc<Node> NodeAllocator;
+    typedef std::allocator_traits<NodeAllocator> NodeTraits;
+
+    size_t size;
+    size_t length;
+    Node * root;
+    Compare comp;
+    NodeAllocator allocator;
+    // Roots of subtrees paired on pop, kept to avoid an allocation per pop.
+    std::vector<Node *> pairs;
+
+    // Link two trees, the root with the larger item becomes the first child of the other one.
+    Node * link(Node * a, Node * b) {
+      if (this->comp(b->item, a->item))
+        std::swap(a, b);
+
+      b->sibling = a->child;
+      a->child = b;
+      return a;
+    }
+
+    Node * create(T && item);
+    void destroy(Node * node) noexcept;
+    void drop_excess(std::vector<T> * evicted);
+};
+
+template <class T, class Compare, class Allocator>
+typename EPairingHeapQ<T, Compare, Allocator>::Node * EPairingHeapQ<T, Compare, Allocator>::create(T && item) {
+  Node * node = NodeTraits::allocate(this->allocator, 1);
+
+  try {
+    NodeTraits::construct(this->allocator, node, Node{std::move(item), nullptr, nullptr});
+  } catch (...) {
+    NodeTraits::deallocate(this->allocator, node, 1);
+    throw;
+  }
+
+  return node;
+}
+
+template <class T, class Compare, class Allocator>
+void EPairingHeapQ<T, Compare, Allocator>::destroy(Node * node) noexcept {
+  NodeTraits::destroy(this->allocator, node);
+  NodeTraits::deallocate(this->allocator, node, 1);
+}
+
+template <class T, class Compare, class Allocator>
+bool EPairingHeapQ<T, Compare, Allocator>::push(T item, T * evicted) {
+  if (this->length == this->size) {
+    if (!this->root || !this->comp(this->root->item, item))
+      return false;
+
+    T result = this->pop();
+    if (evicted)
+      *evicted = std::move(result);
+  }
+
+  Node * node = this->create(std::move(item));
+
+  if (this->root) {
+    try {
+      node = this->link(this->root, node);
+    } catch (...) {
+      this->destroy(node);
+      throw;
+    }
+  }
+
+  this->root = node;
+  this->length++;
+  return true;
+}
+
+/*
+ * Pop the root and pair its children - left to right, then the pairs are
+ * linked right to left. If a comparison fails, the top item is dropped and
+ * subtrees not linked yet are linked under the first one without comparing,
+ * so the heap keeps the other items, but it is not ordered anymore.
+ */
+template <class T, class Compare, class Allocator>
+T EPairingHeapQ<T, Compare, Allocator>::pop(void) {
+  if (!this->root)
+    throw EHeapQEmptyExc;
+
+  Node * top = this->root;
+  T result = std::move(top->item);
+
+  this->pairs.clear();
+  for (Node * child = top->child; child;) {
+    Node * next = child->sibling;
+    child->sibling = nullptr;
+    this->pairs.push_back(child);
+    child = next;
+  }
+
+  this->destroy(top);
+  this->root = nullptr;
+  this->length--;
+
+  size_t count = 0, i = 0;
+  try {
+    for (; i + 1 < this->pairs.size(); i += 2)
+      this->pairs[count++] = this->link(this->pairs[i], this->pairs[i + 1]);
+    if (i < this->pairs.size())
+      this->pairs[count++] = this->pairs[i];
+    i = this->pairs.size();
+
+    for (; count > 1; count--)
+      this->pairs[count - 2] = this->link(this->pairs[count - 2], this->pairs[count - 1]);
+  } catch (...) {
+    // Subtrees are in pairs[0, count) and pairs[i, end).
+    std::vector<Node *> rest(this->pairs.begin(), this->pairs.begin() + count);
+    rest.insert(rest.end(), this->pairs.begin() + i, this->pairs.end());
+    for (size_t j = 1; j < rest.size(); j++) {
+      rest[j]->sibling = rest[0]->child;
+      rest[0]->child = rest[j];
+    }
+    this->root = rest.empty() ? nullptr : rest[0];
+    throw;
+  }
+
+  this->root = this->pairs.empty() ? nullptr : this->pairs[0];
+  return result;
+}
+
+template <class T, class Compare, class Allocator>
+void EPairingHeapQ<T, Compare, Allocator>::merge(EPairingHeapQ & other, std::vector<T> * evicted) {
+  if (&other == this || !other.root)
+    return;
+
+  if (this->root)
+    other.root = this->link(this->root, other.root);
+
+  this->root = other.root;
+  this->length += other.length;
+  other.root = nullptr;
+  other.length = 0;
+
+  this->drop_excess(evicted);
+}
+
+template <class T, class Compare, class Allocator>
+void EPairingHeapQ<T, Compare, Allocator>::drop_excess(std::vector<T> * evicted) {
+  while (this->length > this->size) {
+    T item = this->pop();
+    if (evicted)
+      evicted->push_back(std::move(item));
+  }
+}
+
+template <class T, class Compare, class Allocator>
+void EPairingHeapQ<T, Compare, Allocator>::clear() noexcept {
+  // Walk the tree without recursion, children are spliced into the sibling list.
+  Node * node = this->root;
+
+  while (node) {
+    if (node->child) {
+      Node * child = node->child;
+      node->child = child->sibling;
+      child->sibling = node;
+      node = child;
+    } else {
+      Node * next = node->sibling;
+      this->destroy(node);
+      node = next;
+    }
+  }
+
+  this->root = nullptr;
+  this->length = 0;
+}
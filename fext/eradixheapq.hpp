@@ -0,0 +1,265 @@
+/*
+ * eradixheapq - A radix heap for monotone integer priorities.
+ * Copyright(C) 2020 Fridolin Pokorny
+ *
+ * This program is free software: you can redistribute it and / or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+/*
+ * A radix heap (Ahuja et al., 1990) stores items with unsigned integer
+ * priorities in 65 buckets keyed by the highest bit in which the priority
+ * differs from the last popped priority. Bucket 0 keeps items with the
+ * priority equal to the last popped one. Popping from an empty bucket 0
+ * redistributes the first non-empty bucket into lower buckets, each item
+ * moves at most 64 times in total, so push and pop are O(1) amortized
+ * without comparing items against each other.
+ *
+ * The priorities have to be monotone - an item pushed cannot have
+ * a priority smaller than the last popped one, as is the case for
+ * Dijkstra-like searches. Positions of items are tracked by an index
+ * policy (see eheapqindex.hpp), so items can be removed and updated. The
+ * bounded size follows EHeapQ - once the heap is full, the top item is
+ * evicted.
+ */
+
+#pragma once
+
+#include <cstdint>
+
+#include "eheapq.hpp"
+
+const size_t ERADIXHEAPQ_BUCKETS = 65;
+
+class ERadixHeapQNotMonotone: public EHeapQException {
+  public:
+    virtual const char* what() const throw() {
+      return "priority is smaller than the last popped priority";
+    }
+} ERadixHeapQNotMonotoneExc;
+
+template <
+  class V,
+  class Index = EHeapQHashIndex<EHeapQPriorityItem<uint64_t, V>>
+>
+class ERadixHeapQ {
+  public:
+    typedef EHeapQPriorityItem<uint64_t, V> T;
+
+    ERadixHeapQ(size_t size = EHEAPQ_DEFAULT_SIZE) : size(size), length(0), last(0), nonempty(0) {}
+
+    T get_top() const;
+    void set_size(size_t size);
+    size_t get_size() const noexcept { return this->size; }
+    size_t get_length() const noexcept { return this->length; }
+    uint64_t get_last_priority() const noexcept { return this->last; }
+    Index & get_index() noexcept { return this->index; }
+
+    // Items stored in the bucket, in no particular order.
+    const std::vector<T> & get_bucket(size_t bucket) const { return this->buckets[bucket]; }
+
+    bool push(T item, T * evicted = nullptr);
+    T pop(void);
+    void remove(T item) { this->remove_at(this->locate(item)); }
+    void update(T item);
+    /*
+     * Move all the items to items and leave the heap empty, the last
+     * popped priority is kept.
+     */
+    void detach(std::vector<T> & items);
+
+  private:
+    std::vector<T> buckets[ERADIXHEAPQ_BUCKETS];
+
+    size_t size;
+    size_t length;
+    uint64_t last;
+    // Bit i is set if bucket i + 1 is not empty.
+    uint64_t nonempty;
+
+    Index index;
+
+    // Positions used by the index encode the bucket in the lowest bits.
+    static size_t encode(size_t bucket, size_t idx) noexcept { return (idx << 7) | bucket; }
+    static size_t bucket_of(size_t pos) noexcept { return pos & 0x7F; }
+    static size_t idx_of(size_t pos) noexcept { return pos >> 7; }
+
+    size_t bucket(uint64_t priority) const noexcept {
+      return priority == this->last ? 0 : 64 - __builtin_clzll(priority ^ this->last);
+    }
+
+    void throw_on_empty() const {
+      if (this->length == 0)
+        throw EHeapQEmptyExc;
+    }
+
+    size_t locate(const T & item) const {
+      size_t pos = this->index.find(item);
+      if (pos == EHEAPQ_NPOS)
+        throw EHeapQNotFoundExc;
+      return pos;
+    }
+
+    size_t min_bucket() const noexcept {
+      return this->buckets[0].empty() ? __builtin_ctzll(this->nonempty) + 1 : 0;
+    }
+
+    void place(T & item, bool insert);
+    T remove_at(size_t pos);
+};
+
+template <class V, class Index>
+void ERadixHeapQ<V, Index>::place(T & item, bool insert) {
+  size_t bucket = this->bucket(item.priority);
+  size_t pos = encode(bucket, this->buckets[bucket].size());
+
+  if (insert)
+    this->index.insert(item, pos);
+
+  this->buckets[bucket].push_back(item);
+  if (bucket > 0)
+    this->nonempty |= uint64_t(1) << (bucket - 1);
+}
+
+template <class V, class Index>
+typename ERadixHeapQ<V, Index>::T ERadixHeapQ<V, Index>::get_top() const {
+  this->throw_on_empty();
+
+  const std::vector<T> & bucket = this->buckets[this->min_bucket()];
+  const T * result = &bucket[0];
+  for (auto & item : bucket) {
+    if (item.priority < result->priority)
+      result = &item;
+  }
+
+  return *result;
+}
+
+/*
+ * Push the item, return false if the heap is full and the item would be
+ * evicted right away. Otherwise, the evicted top item is stored to evicted
+ * (if not NULL).
+ */
+template <class V, class Index>
+bool ERadixHeapQ<V, Index>::push(T item, T * evicted) {
+  if (this->index.find(item) != EHEAPQ_NPOS)
+    throw EHeapQAlreadyPresentExc;
+
+  if (this->length == this->size) {
+    // The last popped priority is never above the top one, so items rejected here cannot break monotonicity.
+    if (this->length == 0 || item.priority <= this->get_top().priority)
+      return false;
+
+    T result = this->pop();
+    if (evicted)
+      *evicted = result;
+  } else if (item.priority < this->last) {
+    throw ERadixHeapQNotMonotoneExc;
+  }
+
+  this->place(item, true);
+  this->length++;
+  return true;
+}
+
+template <class V, class Index>
+typename ERadixHeapQ<V, Index>::T ERadixHeapQ<V, Index>::pop(void) {
+  this->throw_on_empty();
+
+  if (this->buckets[0].empty()) {
+    // Redistribute the first non-empty bucket, all its items move to lower buckets.
+    size_t bucket = this->min_bucket();
+    std::vector<T> items;
+
+    std::swap(items, this->buckets[bucket]);
+    this->nonempty &= ~(uint64_t(1) << (bucket - 1));
+
+    this->last = items[0].priority;
+    for (auto & item : items)
+      this->last = std::min(this->last, item.priority);
+
+    for (size_t i = 0; i < items.size(); i++) {
+      size_t to = this->bucket(items[i].priority);
+      this->index.move(items[i], encode(bucket, i), encode(to, this->buckets[to].size()));
+      this->place(items[i], false);
+    }
+
+    // Keep the capacity of the emptied bucket.
+    items.clear();
+    std::swap(items, this->buckets[bucket]);
+  }
+
+  T result = this->buckets[0].back();
+  this->buckets[0].pop_back();
+  this->index.erase(result);
+  this->length--;
+  return result;
+}
+
+template <class V, class Index>
+typename ERadixHeapQ<V, Index>::T ERadixHeapQ<V, Index>::remove_at(size_t pos) {
+  size_t bucket = bucket_of(pos), idx = idx_of(pos);
+  std::vector<T> & items = this->buckets[bucket];
+  T result = items[idx];
+
+  if (idx != items.size() - 1) {
+    items[idx] = items.back();
+    this->index.move(items[idx], encode(bucket, items.size() - 1), pos);
+  }
+
+  items.pop_back();
+  if (bucket > 0 && items.empty())
+    this->nonempty &= ~(uint64_t(1) << (bucket - 1));
+
+  this->index.erase(result);
+  this->length--;
+  return result;
+}
+
+template <class V, class Index>
+void ERadixHeapQ<V, Index>::detach(std::vector<T> & items) {
+  items.reserve(items.size() + this->length);
+  for (auto & bucket : this->buckets) {
+    for (auto & item : bucket) {
+      this->index.erase(item);
+      items.push_back(item);
+    }
+    bucket.clear();
+  }
+
+  this->length = 0;
+  this->nonempty = 0;
+}
+
+/*
+ * Change priority of the stored item, the new priority cannot be smaller
+ * than the last popped one.
+ */
+template <class V, class Index>
+void ERadixHeapQ<V, Index>::update(T item) {
+  size_t pos = this->locate(item);
+
+  if (item.priority < this->last)
+    throw ERadixHeapQNotMonotoneExc;
+
+  this->remove_at(pos);
+  this->place(item, true);
+  this->length++;
+}
+
+template <class V, class Index>
+void ERadixHeapQ<V, Index>::set_size(size_t size) {
+  this->size = size;
+
+  while (this->length > this->size)
+    this->pop();
+}
@@ -15,7 +15,7 @@ int main(int argv, char * argc[]) {
   for (auto i: l)
       a.push(i);
 
-  while (a.get_size() != 0)
+  while (a.get_length() != 0)
       std::cout << a.pop() << std::endl;
 
 //  std::cout << "max: " << a.get_max() << " last: " << a.get_last() << " top: " << a.get_top() << std::endl;
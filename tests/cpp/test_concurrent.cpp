@@ -0,0 +1,126 @@
+/*
+ * test_concurrent - A stress test of EConcurrentHeapQ.
+ * Copyright(C) 2020 Fridolin Pokorny
+ *
+ * This program is free software: you can redistribute it and / or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+/*
+ * Threads push their own items and pop or remove random ones, each item
+ * has to leave the heap exactly once and the items left are drained in
+ * order. Meant to be run under ThreadSanitizer too:
+ *
+ *   g++ -std=c++17 -O1 -g -fsanitize=thread -pthread -I fext tests/cpp/test_concurrent.cpp
+ */
+
+#include <atomic>
+#include <cstdio>
+#include <random>
+#include <thread>
+#include <vector>
+
+#include "econcurrentheapq.hpp"
+
+struct Item {
+  long key;
+  std::atomic<int> taken{0};
+};
+
+struct ItemLess {
+  bool operator()(const Item * a, const Item * b) const { return a->key < b->key; }
+};
+
+static bool run(size_t threads, size_t per_thread, unsigned seed) {
+  std::vector<Item> items(threads * per_thread);
+  EConcurrentHeapQ<Item *, ItemLess, 4> heap;
+  std::atomic<size_t> errors(0);
+  std::vector<std::thread> workers;
+
+  for (size_t i = 0; i < items.size(); i++)
+    items[i].key = long((i * 2654435761u) % 100000);
+
+  for (size_t t = 0; t < threads; t++) {
+    workers.emplace_back([&, t] {
+      std::mt19937 rng(unsigned(t * 31 + seed));
+      Item * own = &items[t * per_thread];
+      size_t pushed = 0;
+
+      for (size_t i = 0; i < per_thread * 2; i++) {
+        unsigned op = rng() % 4;
+        Item * item;
+
+        if (op < 2 && pushed < per_thread) {
+          heap.push(&own[pushed++]);
+        } else if (op == 2) {
+          if (heap.try_pop(item)) {
+            item->taken++;
+          } else {
+            // Other threads can push meanwhile, an empty heap is not an error.
+            try {
+              heap.pop()->taken++;
+            } catch (EHeapQEmpty &) {
+            }
+          }
+        } else if (pushed > 0 && op == 3) {
+          // The item can be already popped by some other thread.
+          item = &own[rng() % pushed];
+          if (heap.try_remove(item))
+            item->taken++;
+        } else if (pushed > 0) {
+          item = &own[rng() % pushed];
+          try {
+            heap.remove(item);
+            item->taken++;
+          } catch (EHeapQNotFound &) {
+          }
+        }
+      }
+
+      while (pushed < per_thread)
+        heap.push(&own[pushed++]);
+    });
+  }
+
+  for (auto & worker : workers)
+    worker.join();
+
+  Item * item;
+  long last = -1;
+  while (heap.try_pop(item)) {
+    if (item->key < last)
+      errors++;
+    last = item->key;
+    item->taken++;
+  }
+
+  for (auto & i : items) {
+    if (i.taken != 1)
+      errors++;
+  }
+
+  return errors == 0;
+}
+
+int main() {
+  for (unsigned round = 0; round < 12; round++) {
+    size_t threads = 1 + round;
+
+    if (!run(threads, 5000, round)) {
+      std::printf("FAILED with %zu threads\n", threads);
+      return 1;
+    }
+  }
+
+  std::puts("ok");
+  return 0;
+}
@@ -0,0 +1,301 @@
+/*
+ * test_policies - Tests of heap policies not reachable from Python.
+ * Copyright(C) 2020 Fridolin Pokorny
+ *
+ * This program is free software: you can redistribute it and / or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+/*
+ * The intrusive index, the SoA storage, the SIMD kernels, the pmr heap with
+ * an arena and the pairing heap are run with random operations and checked
+ * against std::multiset or std::map. Build with:
+ *
+ *   g++ -std=c++17 -O1 -g -fsanitize=address,undefined -I fext tests/cpp/test_policies.cpp
+ */
+
+#include <algorithm>
+#include <cstdio>
+#include <map>
+#include <memory>
+#include <random>
+#include <set>
+#include <stdexcept>
+#include <string>
+
+#include "eheapq.hpp"
+#include "eheapqpmr.hpp"
+#include "epairingheapq.hpp"
+
+#define CHECK(cond) \
+  do { \
+    if (!(cond)) \
+      throw std::runtime_error(std::string(__func__) + ":" + std::to_string(__LINE__) + ": " #cond); \
+  } while (0)
+
+struct Node {
+  long key;
+  size_t eheapq_position = EHEAPQ_NPOS;
+};
+
+struct NodeLess {
+  bool operator()(const Node * a, const Node * b) const { return a->key < b->key; }
+};
+
+template <size_t Arity>
+static void test_intrusive_index() {
+  std::mt19937 rng(Arity);
+  std::vector<Node> nodes(1000);
+  EHeapQ<Node *, NodeLess, Arity, EHeapQIntrusiveIndex<Node *>> heap;
+  std::set<Node *> present;
+  std::multiset<long> keys;
+
+  for (auto & node : nodes)
+    node.key = rng() % 300;
+
+  for (int i = 0; i < 50000; i++) {
+    Node * node = &nodes[rng() % nodes.size()];
+    unsigned op = rng() % 3;
+
+    if (op == 0) {
+      if (present.count(node)) {
+        try {
+          heap.push(node);
+          CHECK(false);
+        } catch (EHeapQAlreadyPresent &) {
+        }
+      } else {
+        heap.push(node);
+        present.insert(node);
+        keys.insert(node->key);
+      }
+    } else if (op == 1 && heap.get_length() > 0) {
+      Node * top = heap.pop();
+      CHECK(top->key == *keys.begin());
+      CHECK(top->eheapq_position == EHEAPQ_NPOS);
+      present.erase(top);
+      keys.erase(keys.begin());
+    } else if (present.count(node)) {
+      heap.remove(node);
+      CHECK(node->eheapq_position == EHEAPQ_NPOS);
+      present.erase(node);
+      keys.erase(keys.find(node->key));
+    } else {
+      try {
+        heap.remove(node);
+        CHECK(false);
+      } catch (EHeapQNotFound &) {
+      }
+    }
+
+    CHECK(heap.get_length() == present.size());
+  }
+
+  for (size_t i = 0; i < heap.get_length(); i++)
+    CHECK(heap.get_items()->get(i)->eheapq_position == i);
+}
+
+template <size_t Arity>
+static void test_soa_storage() {
+  typedef EHeapQPriorityItem<double, uint32_t> Item;
+  std::mt19937 rng(Arity);
+  EHeapQ<
+    Item,
+    EHeapQPriorityCompare<double, uint32_t>,
+    Arity,
+    EHeapQHashIndex<Item>,
+    EHeapQSoAStorage<double, uint32_t>
+  > heap;
+  std::map<uint32_t, double> priorities;
+
+  for (int i = 0; i < 50000; i++) {
+    uint32_t id = rng() % 100;
+    double priority = rng() % 200;
+    unsigned op = rng() % 4;
+
+    if (op == 0 && !priorities.count(id)) {
+      heap.push({priority, id});
+      priorities[id] = priority;
+    } else if (op == 1 && heap.get_length() > 0) {
+      Item top = heap.pop();
+      for (auto & entry : priorities)
+        CHECK(entry.second >= top.priority);
+      CHECK(priorities.at(top.item) == top.priority);
+      priorities.erase(top.item);
+    } else if (op == 2 && priorities.count(id)) {
+      heap.remove({0, id});
+      priorities.erase(id);
+    } else if (op == 3 && priorities.count(id)) {
+      heap.update({priority, id});
+      priorities[id] = priority;
+    }
+
+    CHECK(heap.get_length() == priorities.size());
+  }
+
+  double last = -1;
+  while (heap.get_length() > 0) {
+    Item top = heap.pop();
+    CHECK(top.priority >= last);
+    CHECK(priorities.at(top.item) == top.priority);
+    last = top.priority;
+  }
+}
+
+template <class T>
+static void test_simd_kernels(std::mt19937 & rng) {
+  std::vector<T> keys(EHEAPQ_SIMD_MAX_COUNT + 8);
+#ifdef EHEAPQ_SIMD
+  __builtin_cpu_init();
+  bool avx2 = __builtin_cpu_supports("avx2");
+  bool sse4 = __builtin_cpu_supports("sse4.2");
+#endif
+
+  for (int i = 0; i < 50000; i++) {
+    size_t count = 1 + rng() % EHEAPQ_SIMD_MAX_COUNT, offset = rng() % 8;
+    int range = 1 + rng() % 20;
+
+    for (size_t j = 0; j < count + offset; j++)
+      keys[j] = T(int(rng() % range) - range / 2);
+
+    size_t expected = eheapq_min_pos_scalar(keys.data() + offset, count);
+    CHECK(keys[offset + expected] == *std::min_element(keys.begin() + offset, keys.begin() + offset + count));
+    CHECK(eheapq_min_pos(keys.data() + offset, count) == expected);
+#ifdef EHEAPQ_SIMD
+    if (avx2 && count >= EHeapQAVX2<T>::width)
+      CHECK(eheapq_min_pos_avx2(keys.data() + offset, count) == expected);
+    if (sse4 && count >= EHeapQSSE4<T>::width)
+      CHECK(eheapq_min_pos_sse4(keys.data() + offset, count) == expected);
+#endif
+  }
+}
+
+template <class Heap>
+static void check_pmr(Heap & heap, std::mt19937 & rng) {
+  std::multiset<long> keys;
+
+  for (int i = 0; i < 20000; i++) {
+    long key = rng() % 2000;
+    unsigned op = rng() % 3;
+
+    if (op == 0 && !keys.count(key)) {
+      heap.push(key);
+      keys.insert(key);
+    } else if (op == 1 && heap.get_length() > 0) {
+      CHECK(heap.pop() == *keys.begin());
+      keys.erase(keys.begin());
+    } else if (op == 2 && keys.count(key)) {
+      heap.remove(key);
+      keys.erase(key);
+    }
+
+    CHECK(heap.get_length() == keys.size());
+  }
+}
+
+static void test_pmr_arena() {
+  std::mt19937 rng(1);
+
+  {
+    EHeapQArena arena;
+    EPmrHeapQ<long> heap(EHEAPQ_DEFAULT_SIZE, EHEAPQ_DEFAULT_ARITY, &arena);
+    check_pmr(heap, rng);
+  }
+
+  {
+    static char buffer[4096];
+    EHeapQArena arena(buffer, sizeof(buffer));
+    EPmrHeapQ<long, std::less<long>, 4> heap(EHEAPQ_DEFAULT_SIZE, 4, &arena);
+    check_pmr(heap, rng);
+  }
+}
+
+static void test_pairing() {
+  struct Less {
+    bool operator()(const std::shared_ptr<int> & a, const std::shared_ptr<int> & b) const { return *a < *b; }
+  };
+  typedef EPairingHeapQ<std::shared_ptr<int>, Less> Heap;
+
+  for (unsigned round = 0; round < 200; round++) {
+    std::mt19937 rng(round);
+    size_t size = rng() % 2 ? 1 + rng() % 30 : EHEAPQ_DEFAULT_SIZE;
+    Heap heap(size), other;
+    std::multiset<int> keys, other_keys;
+
+    for (int i = 0; i < 400; i++) {
+      unsigned op = rng() % 10;
+
+      if (op < 5) {
+        auto item = std::make_shared<int>(rng() % 100);
+        std::shared_ptr<int> evicted;
+        size_t length = heap.get_length();
+
+        if (!heap.push(item, &evicted)) {
+          CHECK(length == heap.get_size());
+          CHECK(*item <= *keys.begin());
+        } else {
+          keys.insert(*item);
+          if (length == heap.get_length()) {
+            CHECK(*evicted == *keys.begin());
+            keys.erase(keys.begin());
+          }
+        }
+      } else if (op < 8 && heap.get_length() > 0) {
+        CHECK(*heap.pop() == *keys.begin());
+        keys.erase(keys.begin());
+      } else if (op == 8) {
+        auto item = std::make_shared<int>(rng() % 100);
+        other.push(item);
+        other_keys.insert(*item);
+      } else if (op == 9) {
+        std::vector<std::shared_ptr<int>> evicted;
+        heap.merge(other, &evicted);
+        keys.insert(other_keys.begin(), other_keys.end());
+        other_keys.clear();
+        for (auto & item : evicted) {
+          CHECK(*item == *keys.begin());
+          keys.erase(keys.begin());
+        }
+        CHECK(other.get_length() == 0);
+      }
+
+      CHECK(heap.get_length() == keys.size());
+      if (!keys.empty())
+        CHECK(*heap.get_top() == *keys.begin());
+    }
+  }
+}
+
+int main() {
+  std::mt19937 rng(3);
+
+  try {
+    test_intrusive_index<2>();
+    test_intrusive_index<4>();
+    test_intrusive_index<8>();
+    test_soa_storage<2>();
+    test_soa_storage<8>();
+    test_soa_storage<16>();
+    test_simd_kernels<double>(rng);
+    test_simd_kernels<float>(rng);
+    test_simd_kernels<int32_t>(rng);
+    test_simd_kernels<int64_t>(rng);
+    test_pmr_arena();
+    test_pairing();
+  } catch (std::exception & exc) {
+    std::printf("FAILED %s\n", exc.what());
+    return 1;
+  }
+
+  std::puts("ok");
+  return 0;
+}
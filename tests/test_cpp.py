@@ -0,0 +1,43 @@
+#!/usr/bin/env python3
+# fext
+# Copyright(C) 2020 Fridolin Pokorny
+#
+# This program is free software: you can redistribute it and / or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program. If not, see <http://www.gnu.org/licenses/>.
+
+"""Run C++ tests of header-only parts of fext library not reachable from Python."""
+
+import os
+import shutil
+import subprocess
+from pathlib import Path
+
+import pytest
+
+_TESTS_DIR = Path(__file__).parent / "cpp"
+_FEXT_DIR = Path(__file__).parent.parent / "fext"
+_CXX = os.getenv("CXX") or shutil.which("g++") or shutil.which("clang++")
+
+
+@pytest.mark.skipif(_CXX is None, reason="no C++ compiler found")
+@pytest.mark.parametrize("source", sorted(_TESTS_DIR.glob("*.cpp")), ids=lambda path: path.stem)
+def test_cpp(source: Path, tmp_path: Path) -> None:
+    """Compile and run a C++ test, it prints ok on success."""
+    binary = tmp_path / source.stem
+    subprocess.run(
+        [_CXX, "-std=c++17", "-O1", "-pthread", "-I", str(_FEXT_DIR), str(source), "-o", str(binary)],
+        check=True,
+    )
+    result = subprocess.run([str(binary)], stdout=subprocess.PIPE, universal_newlines=True)
+    assert result.returncode == 0, result.stdout
+    assert result.stdout.strip().endswith("ok")
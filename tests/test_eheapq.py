@@ -17,14 +17,19 @@
 
 """Heap queue related tests for fext library."""
 
+import copy
+import pickle
 import sys
 import pytest
 import heapq
 import gc
 
 from hypothesis import given
+from hypothesis.strategies import floats
 from hypothesis.strategies import integers
 from hypothesis.strategies import lists
+from hypothesis.strategies import text
+from hypothesis.strategies import tuples
 
 from eheapq import ExtHeapQueue
 
@@ -33,6 +38,20 @@ class _A:
     """A class to mock a non-comparable object."""
 
 
+class _Fragile:
+    """A class to mock objects which fail to compare once broken."""
+
+    broken = False
+
+    def __init__(self, value: int) -> None:
+        self.value = value
+
+    def __lt__(self, other: "_Fragile") -> bool:
+        if self.broken:
+            raise TypeError("broken comparison")
+        return self.value < other.value
+
+
 class TestEHeapq:
     """Test eheapq extension."""
 
@@ -99,18 +118,42 @@ class TestEHeapq:
         assert sys.getrefcount((a)) == sys.getrefcount(b) + 1
         gc.collect()
 
+    def test_cycle_refcount(self) -> None:
+        """Test items are released once when the heap is collected as a part of a reference cycle."""
+        heap = ExtHeapQueue(lazy=True)
+        a, b, cycle = _Fragile(1), _Fragile(2), _Fragile(3)
+        cycle.heap = heap
+        refcount = sys.getrefcount(a), sys.getrefcount(b)
+
+        heap.push(a)
+        heap.push(b)
+        heap.push(cycle)
+        heap.remove(b)
+        del heap, cycle
+        gc.collect()
+
+        assert (sys.getrefcount(a), sys.getrefcount(b)) == refcount
+
     def test_pushpop_refcount(self) -> None:
         """Test manipulation with reference counter on pushpop - compare with the standard heapq."""
         heap = ExtHeapQueue()
         arr = []
 
         a, b = "foo_pushpop", "bar_pushpop"
+        c, d = "baz_pushpop", "ban_pushpop"
 
         assert sys.getrefcount(a) == sys.getrefcount(b)
 
         heap.pushpop(a)
+        heapq.heappushpop(arr, b)
+        assert sys.getrefcount(a) == sys.getrefcount(b)
+
+        heap.push(a)
         heapq.heappush(arr, b)
+        heap.pushpop(c)
+        heapq.heappushpop(arr, d)
         assert sys.getrefcount(a) == sys.getrefcount(b)
+        assert sys.getrefcount(c) == sys.getrefcount(d)
         gc.collect()
 
     def test_remove_refcount(self) -> None:
@@ -150,6 +193,11 @@ class TestEHeapq:
 
         assert sys.getrefcount(a) == sys.getrefcount(b)
         assert sys.getrefcount(c) == sys.getrefcount(d)
+
+        with pytest.raises(ValueError, match="the given item is already present in the heap"):
+            heap.replace(c)
+
+        assert sys.getrefcount(c) == sys.getrefcount(d)
         gc.collect()
 
     def test_max_refcount(self) -> None:
@@ -174,6 +222,603 @@ class TestEHeapq:
         assert len(heap) == 1
         assert heap.pop() == 1
 
+    def test_push_evict_refcount(self) -> None:
+        """Test manipulation with reference counter when pushing onto a full heap."""
+        heap = ExtHeapQueue(size=1)
+
+        a, b, c = "2_evict", "1_evict", "3_evict"
+        refcounts = [sys.getrefcount(a), sys.getrefcount(b), sys.getrefcount(c)]
+
+        heap.push(a)
+        heap.push(c)
+        heap.push(b)
+
+        assert len(heap) == 1
+        assert heap.get_top() == c
+        assert [sys.getrefcount(a), sys.getrefcount(b), sys.getrefcount(c) - 1] == refcounts
+        gc.collect()
+
+    def test_would_accept(self) -> None:
+        """Test checking whether an item would be pushed onto a full heap."""
+        heap = ExtHeapQueue(size=2)
+        assert heap.would_accept(1) is True
+
+        heap.push_many([5, 7])
+        assert heap.would_accept(3) is False
+        assert heap.would_accept(5) is False
+        assert heap.would_accept(6) is True
+
+        # Items rejected by a full heap are not looked up in the index.
+        heap.push(5)
+        assert heap.pop_many(2) == [5, 7]
+
+        with pytest.raises(ValueError, match="failed to compare Python objects"):
+            ExtHeapQueue.from_iterable([1], size=1).would_accept("a")
+
+    def test_handles(self) -> None:
+        """Test manipulation with items using handles."""
+        heap = ExtHeapQueue()
+
+        a, b, c = "foo_handle", "bar_handle", "baz_handle"
+        refcount = sys.getrefcount(a)
+
+        handle_a = heap.push_handle(a)
+        handle_b = heap.push_handle(b)
+        handle_c = heap.push_handle(c)
+        assert len({handle_a, handle_b, handle_c}) == 3
+
+        assert heap.get_item(handle_a) is a
+        assert heap.remove_handle(handle_a) is a
+        assert sys.getrefcount(a) == refcount
+
+        with pytest.raises(ValueError, match="the given item was not found in the heap"):
+            heap.get_item(handle_a)
+
+        # A new item can reuse the slot, the old handle stays invalid.
+        handle_a2 = heap.push_handle(a)
+        assert handle_a2 != handle_a
+        with pytest.raises(ValueError, match="the given item was not found in the heap"):
+            heap.remove_handle(handle_a)
+
+        heap.remove(b)
+        with pytest.raises(ValueError, match="the given item was not found in the heap"):
+            heap.get_item(handle_b)
+
+        assert heap.get_item(handle_c) is c
+        assert heap.pop() == c
+        assert heap.pop() == a
+        assert len(heap) == 0
+
+    def test_handles_not_unique(self) -> None:
+        """Test storing equal items in a heap with non-unique items."""
+        heap = ExtHeapQueue(unique=False)
+        assert heap.unique is False
+
+        a = "foo_not_unique"
+        handles = [heap.push_handle(a) for _ in range(3)]
+        heap.push(a)
+        assert len(heap) == 4
+
+        with pytest.raises(ValueError, match="can be removed only using handles"):
+            heap.remove(a)
+
+        assert heap.remove_handle(handles[1]) is a
+        assert len(heap) == 3
+        assert [heap.pop() for _ in range(3)] == [a, a, a]
+
+    def test_push_handle_full(self) -> None:
+        """Test pushing an item using handles onto a full heap."""
+        heap = ExtHeapQueue(size=1)
+
+        handle = heap.push_handle(2)
+        assert heap.push_handle(1) is None
+        assert heap.get_item(handle) == 2
+        assert heap.push_handle(3) is not None
+
+        with pytest.raises(ValueError, match="the given item was not found in the heap"):
+            heap.get_item(handle)
+
+    def test_update(self) -> None:
+        """Test restoring the heap invariant after items were changed."""
+
+        class Key:
+            def __init__(self, value: int) -> None:
+                self.value = value
+
+            def __lt__(self, other: "Key") -> bool:
+                return self.value < other.value
+
+        keys = [Key(i) for i in range(10)]
+        heap = ExtHeapQueue(arity=3)
+        handles = [heap.push_handle(key) for key in keys]
+
+        keys[0].value = 20
+        heap.update(keys[0])
+        keys[9].value = -1
+        heap.update(keys[9])
+        assert heap.get_top() is keys[9]
+        assert heap.get_max() is keys[0]
+
+        keys[0].value = 5
+        heap.update_handle(handles[0])
+        assert [heap.pop().value for _ in range(10)] == [-1, 1, 2, 3, 4, 5, 5, 6, 7, 8]
+
+        with pytest.raises(ValueError, match="the given item was not found in the heap"):
+            heap.update(keys[0])
+
+        with pytest.raises(ValueError, match="the given item was not found in the heap"):
+            heap.update_handle(handles[0])
+
+    @given(lists(integers()), integers(min_value=0, max_value=20))
+    def test_from_iterable(self, arr: list, size: int) -> None:
+        """Test building a heap from an iterable, bounded heaps keep the largest items."""
+        arr = list(dict.fromkeys(arr))
+
+        heap = ExtHeapQueue.from_iterable(arr, arity=3)
+        assert len(heap) == len(arr)
+        assert [heap.pop() for _ in range(len(arr))] == sorted(arr)
+
+        heap = ExtHeapQueue.from_iterable(iter(arr), size=size)
+        assert heap.size == size
+        assert [heap.pop() for _ in range(len(heap))] == sorted(arr)[len(arr) - min(size, len(arr)):]
+
+    def test_from_iterable_refcount(self) -> None:
+        """Test reference counts of items of a heap built from an iterable."""
+        a, b, c = "1_from_iterable", "2_from_iterable", "3_from_iterable"
+        refcount = sys.getrefcount(a)
+
+        heap = ExtHeapQueue.from_iterable([c, a, b], size=2)
+        assert sys.getrefcount(a) == refcount
+        assert sys.getrefcount(b) == refcount + 1
+        assert heap.pop() is b
+        assert sys.getrefcount(b) == refcount
+
+        with pytest.raises(ValueError, match="the given item is already present in the heap"):
+            ExtHeapQueue.from_iterable([a, b, a])
+
+        assert sys.getrefcount(a) == refcount
+        assert len(ExtHeapQueue.from_iterable([a, a], unique=False)) == 2
+
+    @given(lists(integers()), lists(integers()), integers(min_value=1, max_value=20))
+    def test_push_pop_many(self, arr1: list, arr2: list, size: int) -> None:
+        """Test pushing and popping items in batches."""
+        arr1 = list(dict.fromkeys(arr1))
+        arr2 = [item for item in dict.fromkeys(arr2) if item not in arr1]
+
+        heap = ExtHeapQueue(size=size)
+        heap.push_many(arr1)
+        heap.push_many(arr2)
+
+        expected = sorted(arr1 + arr2)[-size:]
+        assert len(heap) == len(expected)
+        assert heap.pop_many(2) == expected[:2]
+        assert heap.pop_many(len(expected)) == expected[2:]
+        assert heap.pop_many(1) == []
+
+    def test_push_pop_many_refcount(self) -> None:
+        """Test reference counts of items pushed and popped in batches."""
+        a, b, c = "1_many", "2_many", "3_many"
+        refcount = sys.getrefcount(a)
+
+        heap = ExtHeapQueue(size=2)
+        heap.push_many([b])
+        heap.push_many([a, c])
+        assert sys.getrefcount(a) == refcount
+        assert sys.getrefcount(c) == refcount + 1
+
+        with pytest.raises(ValueError, match="the given item is already present in the heap"):
+            heap.push_many([c, c])
+
+        assert heap.pop_many(5) == [b, c]
+        assert sys.getrefcount(b) == refcount
+        assert sys.getrefcount(c) == refcount
+
+        with pytest.raises(ValueError, match="count cannot be negative"):
+            heap.pop_many(-1)
+
+    def test_push_many_not_comparable(self) -> None:
+        """Test no item is added if pushing a batch fails, the heap is left as it was."""
+        a = "1_many_cmp"
+        refcount = sys.getrefcount(a)
+
+        # The batch is added using heapify.
+        heap = ExtHeapQueue()
+        heap.push_many([3, 1])
+        heap.push(2)
+        with pytest.raises(ValueError, match="failed to compare Python objects"):
+            heap.push_many([5, a, 0, 7, 9])
+
+        assert len(heap) == 3
+        assert heap.get_last() == 2
+        assert sys.getrefcount(a) == refcount
+        assert heap.pop_many(3) == [1, 2, 3]
+
+        # The batch is pushed item by item, items pushed before the failing one are removed again.
+        heap = ExtHeapQueue(size=4)
+        heap.push_many([3, 1, 2, 8, 6])
+        with pytest.raises(ValueError, match="failed to compare Python objects"):
+            heap.push_many([7, 9, a])
+
+        assert len(heap) == 4
+        assert sys.getrefcount(a) == refcount
+        assert heap.pop_many(4) == [2, 3, 6, 8]
+
+        heap = ExtHeapQueue(size=4)
+        heap.push_many([3, 1, 2, 8])
+        with pytest.raises(ValueError, match="the given item is already present in the heap"):
+            heap.push_many([7, 9, 7])
+
+        assert heap.pop_many(4) == [1, 2, 3, 8]
+
+    def test_pop_not_comparable(self) -> None:
+        """Test popping is reverted if the comparison fails."""
+        items = [_Fragile(i) for i in range(6)]
+        heap = ExtHeapQueue()
+        for item in items:
+            heap.push(item)
+
+        _Fragile.broken = True
+        try:
+            with pytest.raises(ValueError, match="failed to compare Python objects"):
+                heap.pop()
+        finally:
+            _Fragile.broken = False
+
+        assert len(heap) == 6
+        assert heap.pop_many(6) == items
+
+    @given(lists(integers(), unique=True), lists(integers(), unique=True), integers(min_value=1, max_value=40))
+    def test_merge(self, arr1: list, arr2: list, size: int) -> None:
+        """Test merging heaps, the larger heap is rebuilt and the smaller one pushed item by item."""
+        arr2 = [item for item in arr2 if item not in arr1]
+
+        heap = ExtHeapQueue(size=size)
+        heap.push_many(arr1)
+        other = ExtHeapQueue(lazy=True, compaction_threshold=1.0)
+        other.push_many(arr2)
+        for item in arr2[::3]:
+            other.remove(item)
+
+        expected = sorted(sorted(arr1)[-size:] + [item for item in arr2 if item not in arr2[::3]])[-size:]
+        heap.merge(other)
+        assert len(other) == 0
+        assert list(other) == []
+        assert len(heap) == len(expected)
+        assert heap.pop_many(len(expected)) == expected
+
+    def test_merge_refcount(self) -> None:
+        """Test reference counts of items moved and evicted by merging heaps."""
+        a, b, c = "1_merge", "2_merge", "3_merge"
+        refcount = sys.getrefcount(a)
+
+        heap = ExtHeapQueue(size=2)
+        heap.push_many([b, c])
+        other = ExtHeapQueue()
+        other.push(a)
+        heap.merge(other)
+        assert len(other) == 0
+        assert sys.getrefcount(a) == refcount
+        assert sys.getrefcount(c) == refcount + 1
+
+        other.push(b)
+        with pytest.raises(ValueError, match="the given item is already present in the heap"):
+            heap.merge(other)
+        assert list(other) == [b]
+        assert sys.getrefcount(b) == refcount + 2
+
+        heap.merge(heap)
+        with pytest.raises(TypeError):
+            heap.merge([a])
+
+        del other
+        assert heap.pop_many(5) == [b, c]
+        assert sys.getrefcount(b) == refcount
+        assert sys.getrefcount(c) == refcount
+
+    def test_merge_not_comparable(self) -> None:
+        """Test no item is moved if a comparison fails while the heap is rebuilt."""
+        a, b, c, d = "1_merge_cmp", "2_merge_cmp", "3_merge_cmp", "4_merge_cmp"
+        refcount = sys.getrefcount(a)
+
+        heap = ExtHeapQueue.from_iterable([3, 1, 2])
+        other = ExtHeapQueue.from_iterable([c, a, d, b])
+        with pytest.raises(ValueError, match="failed to compare Python objects"):
+            heap.merge(other)
+
+        assert len(heap) == 3
+        assert len(other) == 4
+        assert sys.getrefcount(a) == refcount + 1
+        assert heap.pop_many(3) == [1, 2, 3]
+        assert other.pop_many(4) == [a, b, c, d]
+        assert sys.getrefcount(a) == refcount
+
+    @given(lists(integers()), integers(min_value=0, max_value=30))
+    def test_peek_n(self, arr: list, count: int) -> None:
+        """Test retrieving top items without modifying the heap."""
+        arr = list(dict.fromkeys(arr))
+        last = max(arr, default=0) + 1
+        heap = ExtHeapQueue.from_iterable(arr, arity=3)
+        heap.push(last)
+        arr.append(last)
+
+        assert heap.peek_n(count) == sorted(arr)[:count]
+        assert len(heap) == len(arr)
+        assert heap.get_last() == last
+        assert heap.pop_many(len(arr)) == sorted(arr)
+
+    @given(lists(integers(), unique=True), lists(integers()))
+    def test_lazy_remove(self, arr: list, to_remove: list) -> None:
+        """Test removing items lazily."""
+        heap = ExtHeapQueue(lazy=True, compaction_threshold=0.3)
+        assert heap.lazy is True
+        heap.push_many(arr)
+
+        for item in dict.fromkeys(to_remove):
+            if item in arr:
+                heap.remove(item)
+                arr.remove(item)
+
+        assert len(heap) == len(arr)
+        assert heap.peek_n(3) == sorted(arr)[:3]
+        if arr:
+            assert heap.get_max() == max(arr)
+
+        heap.compact()
+        assert [heap.pop() for _ in range(len(arr))] == sorted(arr)
+
+    def test_lazy_remove_refcount(self) -> None:
+        """Test reference counts of items removed lazily."""
+        heap = ExtHeapQueue(lazy=True)
+        items = ["{}_lazy".format(i) for i in range(10)]
+        a, b, c = items[5], items[6], items[0]
+        refcount = sys.getrefcount(a)
+        handles = [heap.push_handle(item) for item in items]
+
+        heap.remove(a)
+        assert len(heap) == 9
+        assert sys.getrefcount(a) == refcount + 1
+
+        assert heap.remove_handle(handles[6]) is b
+        heap.compact()
+        assert sys.getrefcount(a) == refcount
+        assert sys.getrefcount(b) == refcount
+
+        heap.remove(c)
+        assert sys.getrefcount(c) == refcount
+        assert heap.pop_many(10) == items[1:5] + items[7:]
+
+    def test_lazy_remove_mutable(self) -> None:
+        """Test objects which can change are removed right away in the lazy mode."""
+        items = [_Fragile(i) for i in range(10)]
+        heap = ExtHeapQueue(lazy=True)
+        for item in items:
+            heap.push(item)
+
+        a = items[5]
+        refcount = sys.getrefcount(a)
+        heap.remove(a)
+        assert sys.getrefcount(a) == refcount - 1
+
+        # Pushed again and updated, no tombstone keeps the old key.
+        a.value = 100
+        heap.push(a)
+        a.value = -1
+        heap.update(a)
+        assert heap.pop_many(10) == [a] + items[:5] + items[6:]
+
+    def test_invalid_compaction_threshold(self) -> None:
+        """Test the compaction threshold has to be in (0, 1]."""
+        for threshold in (0.0, -0.5, 1.5, float("nan")):
+            with pytest.raises(ValueError, match=r"compaction threshold has to be in \(0, 1\]"):
+                ExtHeapQueue(lazy=True, compaction_threshold=threshold)
+
+            with pytest.raises(ValueError, match=r"compaction threshold has to be in \(0, 1\]"):
+                ExtHeapQueue.from_iterable([1, 2], compaction_threshold=threshold)
+
+        assert ExtHeapQueue(lazy=True, compaction_threshold=1.0).lazy is True
+
+    @given(lists(integers(), unique=True), lists(integers(), unique=True))
+    def test_copy(self, arr: list, to_push: list) -> None:
+        """Test copies of the heap are independent."""
+        heap = ExtHeapQueue(arity=4)
+        for item in arr:
+            heap.push(item)
+
+        heap_copy = copy.copy(heap)
+        assert type(heap_copy) is ExtHeapQueue
+        assert heap_copy.arity == 4
+        for item in to_push:
+            if item not in arr:
+                heap_copy.push(item)
+
+        assert [heap.pop() for _ in range(len(heap))] == sorted(arr)
+        assert [heap_copy.pop() for _ in range(len(heap_copy))] == sorted(set(arr) | set(to_push))
+
+    def test_copy_refcount(self) -> None:
+        """Test reference counts and handles of copied heaps."""
+        heap = ExtHeapQueue(lazy=True)
+        a, b, c = "a_copy", "b_copy", "c_copy"
+        refcount = sys.getrefcount(a)
+        handle_a = heap.push_handle(a)
+        heap.push(b)
+        heap.push(c)
+        heap.remove(b)
+
+        heap_copy = heap.copy()
+        assert sys.getrefcount(a) == refcount + 2
+        assert sys.getrefcount(b) == refcount + 2
+        assert heap_copy.get_item(handle_a) is a
+
+        assert heap_copy.remove_handle(handle_a) is a
+        assert heap.get_item(handle_a) is a
+        assert sys.getrefcount(a) == refcount + 1
+        assert len(heap) == len(heap_copy) + 1 == 2
+
+        del heap_copy
+        gc.collect()
+        assert sys.getrefcount(a) == refcount + 1
+        assert sys.getrefcount(b) == refcount + 1
+        assert sys.getrefcount(c) == refcount + 1
+
+        del heap
+        gc.collect()
+        assert sys.getrefcount(b) == refcount
+
+    @given(lists(integers(), unique=True), integers(min_value=0, max_value=pickle.HIGHEST_PROTOCOL))
+    def test_pickle(self, arr: list, protocol: int) -> None:
+        """Test pickling the heap."""
+        heap = ExtHeapQueue(arity=3, lazy=True)
+        for item in arr:
+            heap.push(item)
+
+        # Lazily removed items are not pickled.
+        for item in arr[::3]:
+            heap.remove(item)
+
+        restored = pickle.loads(pickle.dumps(heap, protocol=protocol))
+        assert type(restored) is ExtHeapQueue
+        assert restored.arity == 3
+        assert restored.lazy
+        assert len(restored) == len(heap)
+        if len(heap):
+            assert restored.get_last() == heap.get_last()
+
+        assert [restored.pop() for _ in range(len(restored))] == [heap.pop() for _ in range(len(heap))]
+
+    def test_pickle_state(self) -> None:
+        """Test the size and uniqueness are pickled and the heap can be deep copied."""
+        heap = ExtHeapQueue(size=2, unique=False)
+        items = ["a", "b", "c"]
+        for item in items:
+            heap.push(item)
+        heap.push("c")
+
+        restored = pickle.loads(pickle.dumps(heap))
+        assert restored.size == 2
+        assert not restored.unique
+        assert [restored.pop(), restored.pop()] == ["c", "c"]
+
+        heap_copy = copy.deepcopy(heap)
+        assert len(heap_copy) == 2
+        assert heap_copy.get_top() == "c"
+
+        with pytest.raises(ValueError, match="the heap is not empty"):
+            heap_copy.__setstate__(([], -1, True))
+
+    def test_pickle_refcount(self) -> None:
+        """Test reference counts of items restored from a pickle."""
+        heap = ExtHeapQueue()
+        a = _A()
+        heap.push(a)
+
+        items, last_pos, ordered = heap.__reduce_ex__(5)[2]
+        refcount = sys.getrefcount(a)
+
+        restored = ExtHeapQueue()
+        restored.__setstate__((items, last_pos, ordered))
+        assert sys.getrefcount(a) == refcount + 1
+        assert restored.get_last() is a
+
+        del restored
+        gc.collect()
+        assert sys.getrefcount(a) == refcount
+
+        restored = ExtHeapQueue()
+        with pytest.raises(ValueError, match="the given item is already present in the heap"):
+            restored.__setstate__(([a, a], -1, True))
+
+        assert len(restored) == 0
+        assert sys.getrefcount(a) == refcount
+
+    def test_pickle_state_checked(self) -> None:
+        """Test a state not in the heap order and a failed restore of a heap in use."""
+        heap = ExtHeapQueue()
+        for item in (3, 2.5, 7, 0.5):
+            heap.push(item)
+
+        with pytest.raises(ValueError, match="the heap is not empty"):
+            heap.__setstate__(([1], -1, True))
+
+        heap.push(1.5)
+        assert [heap.pop() for _ in range(len(heap))] == [0.5, 1.5, 2.5, 3, 7]
+
+        restored = ExtHeapQueue()
+        restored.__setstate__(([5, 4, 3, 2, 1], -1, True))
+        assert [restored.pop() for _ in range(len(restored))] == [1, 2, 3, 4, 5]
+
+    @given(lists(integers(), unique=True), integers(min_value=0, max_value=20))
+    def test_iter_sorted(self, arr: list, count: int) -> None:
+        """Test iterating over items in the sorted order without changing the heap."""
+        heap = ExtHeapQueue(arity=3, lazy=True)
+        for item in arr:
+            heap.push(item)
+
+        for item in arr[::4]:
+            heap.remove(item)
+
+        expected = sorted(set(arr) - set(arr[::4]))
+        iterator = heap.iter_sorted()
+        assert [next(iterator) for _ in range(min(count, len(expected)))] == expected[:count]
+        assert list(iterator) == expected[count:]
+        assert list(heap.iter_sorted()) == expected
+        assert sorted(heap) == expected
+        assert len(heap) == len(expected)
+
+    def test_iter(self) -> None:
+        """Test iterating over items in the heap order."""
+        heap = ExtHeapQueue()
+        a = _A()
+        refcount = sys.getrefcount(a)
+
+        heap.push(a)
+        iterator = iter(heap)
+        assert next(iterator) is a
+        assert list(iterator) == []
+        assert sys.getrefcount(a) == refcount + 1
+
+        heap.pop()
+        for item in (3, 1, 2):
+            heap.push(item)
+        assert list(heap)[0] == 1
+        assert sorted(heap) == [1, 2, 3]
+
+        for create in (iter, ExtHeapQueue.iter_sorted):
+            iterator = create(heap)
+            next(iterator)
+            heap.push(0)
+            with pytest.raises(RuntimeError, match="the heap changed during iteration"):
+                next(iterator)
+            heap.pop()
+
+        assert sys.getrefcount(a) == refcount
+
+    def test_iter_modified(self) -> None:
+        """Test iterators detect changes of the heap that keep its size."""
+        heap = ExtHeapQueue(size=5)
+        heap.push_many([1, 2, 3, 4, 5])
+
+        iterator = heap.iter_sorted()
+        assert [next(iterator), next(iterator)] == [1, 2]
+        heap.push(100)
+        with pytest.raises(RuntimeError, match="the heap changed during iteration"):
+            next(iterator)
+
+        changes = [
+            lambda: heap.replace(50),
+            lambda: heap.pushpop(60),
+            lambda: heap.update(heap.get_top()),
+            lambda: heap.push(70),
+            lambda: heap.merge(ExtHeapQueue()),
+        ]
+        for change in changes:
+            iterator = iter(heap)
+            next(iterator)
+            change()
+            with pytest.raises(RuntimeError, match="the heap changed during iteration"):
+                next(iterator)
+
+        assert len(heap) == 5
+
     def test_push_not_comparable(self) -> None:
         """Test pushing an item that raises an error on comparision."""
         heap = ExtHeapQueue()
@@ -223,6 +868,87 @@ class TestEHeapq:
 
         assert result == sorted(arr)
 
+    @given(lists(floats(allow_nan=False)))
+    def test_heap_sort_floats(self, arr) -> None:
+        """Test heap sorting of floats compared natively."""
+        heap = ExtHeapQueue()
+
+        arr = list(dict.fromkeys(arr).keys())
+        for item in arr:
+            heap.push(item)
+
+        assert [heap.pop() for _ in range(len(arr))] == sorted(arr)
+
+    @given(lists(text()))
+    def test_heap_sort_strings(self, arr) -> None:
+        """Test heap sorting of strings compared natively."""
+        heap = ExtHeapQueue()
+
+        arr = list(dict.fromkeys(arr).keys())
+        for item in arr:
+            heap.push(item)
+
+        assert [heap.pop() for _ in range(len(arr))] == sorted(arr)
+
+    @given(lists(tuples(integers(min_value=-8, max_value=8), text())))
+    def test_heap_sort_tuples(self, arr) -> None:
+        """Test heap sorting of tuples with native comparison of their first items."""
+        heap = ExtHeapQueue()
+
+        arr = list(dict.fromkeys(arr).keys())
+        for item in arr:
+            heap.push(item)
+
+        assert [heap.pop() for _ in range(len(arr))] == sorted(arr)
+
+    def test_mixed_types(self) -> None:
+        """Test falling back to rich comparison once items of different types are pushed."""
+        heap = ExtHeapQueue()
+
+        arr = [3, 1.5, 2**100, -2, 0.25, -(2**70)]
+        for item in arr:
+            heap.push(item)
+
+        assert [heap.pop() for _ in range(len(arr))] == sorted(arr)
+
+        arr = [(1, "a"), (1.0, "b"), (0, "c")]
+        for item in arr:
+            heap.push(item)
+
+        assert [heap.pop() for _ in range(len(arr))] == sorted(arr)
+
+    @pytest.mark.parametrize("arity", [2, 3, 4, 8])
+    @given(lists(integers(min_value=-65535, max_value=65535)))
+    def test_heap_sort_arity(self, arity, arr) -> None:
+        """Test heap sorting and removal with different heap arities."""
+        heap = ExtHeapQueue(arity=arity)
+        assert heap.arity == arity
+
+        arr = list(dict.fromkeys(arr).keys())
+        for item in arr:
+            heap.push(item)
+
+        if arr:
+            assert heap.get_max() == max(arr)
+
+        for item in arr[::3]:
+            heap.remove(item)
+
+        arr = [item for item in arr if item not in arr[::3]]
+        assert [heap.pop() for _ in range(len(arr))] == sorted(arr)
+
+    def test_invalid_arity(self) -> None:
+        """Test creating a heap with an invalid arity."""
+        with pytest.raises(ValueError, match="heap arity has to be at least 2"):
+            ExtHeapQueue(arity=1)
+
+        for arity in (1025, 2 ** 63, 2 ** 64 - 1):
+            with pytest.raises(ValueError, match="heap arity has to be at least 2 and at most 1024"):
+                ExtHeapQueue(arity=arity)
+
+        heap = ExtHeapQueue.from_iterable(range(3000, 0, -1), arity=1024)
+        assert heap.pop_many(3000) == list(range(1, 3001))
+
     def test_get_top(self) -> None:
         """Test manipulation with the top (the smallest) item recorded."""
         heap = ExtHeapQueue()
@@ -0,0 +1,198 @@
+#!/usr/bin/env python3
+# fext
+# Copyright(C) 2020 Fridolin Pokorny
+#
+# This program is free software: you can redistribute it and / or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program. If not, see <http://www.gnu.org/licenses/>.
+
+"""Min-max heap queue related tests for fext library."""
+
+import gc
+import sys
+import pytest
+
+from hypothesis import given
+from hypothesis.strategies import integers
+from hypothesis.strategies import lists
+
+from eheapq import ExtMinMaxHeapQueue
+
+
+class _Fragile:
+    """A class to mock objects which fail to compare once broken."""
+
+    broken = False
+
+    def __init__(self, value: int) -> None:
+        self.value = value
+
+    def __lt__(self, other: "_Fragile") -> bool:
+        if self.broken:
+            raise TypeError("broken comparison")
+        return self.value < other.value
+
+
+class TestEMinMaxHeapQueue:
+    """Test min-max heap queue implemented in eheapq extension."""
+
+    @given(lists(integers()))
+    def test_heap_sort(self, arr: list) -> None:
+        """Test popping items from both ends of the heap."""
+        arr = list(dict.fromkeys(arr))
+        heap = ExtMinMaxHeapQueue()
+        for item in arr:
+            heap.push(item)
+
+        assert len(heap) == len(arr)
+
+        arr.sort()
+        low, high = [], []
+        while len(heap) > 0:
+            assert heap.get_max() == arr[len(arr) - len(high) - 1]
+            high.append(heap.pop_max())
+            if len(heap) > 0:
+                assert heap.get_top() == arr[len(low)]
+                low.append(heap.pop())
+
+        assert low + high[::-1] == arr
+
+    @given(lists(integers()), integers(min_value=1, max_value=10))
+    def test_bounded(self, arr: list, size: int) -> None:
+        """Test the heap keeps the largest items once it is full."""
+        arr = list(dict.fromkeys(arr))
+        heap = ExtMinMaxHeapQueue(size=size)
+        for item in arr:
+            heap.push(item)
+
+        assert sorted(arr)[-size:] == [heap.pop() for _ in range(len(heap))]
+
+    def test_refcount(self) -> None:
+        """Test manipulation with reference counters."""
+        heap = ExtMinMaxHeapQueue(size=2)
+        a, b, c = "1_minmax", "2_minmax", "3_minmax"
+        refcount_a, refcount_b, refcount_c = sys.getrefcount(a), sys.getrefcount(b), sys.getrefcount(c)
+
+        heap.push(b)
+        heap.push(a)
+        heap.push(c)
+        assert sys.getrefcount(a) == refcount_a
+        assert sys.getrefcount(b) == refcount_b + 1
+        assert sys.getrefcount(c) == refcount_c + 1
+
+        assert heap.pop_max() is c
+        assert sys.getrefcount(c) == refcount_c
+        heap.remove(b)
+        assert sys.getrefcount(b) == refcount_b
+        assert len(heap) == 0
+
+    def test_cycle_refcount(self) -> None:
+        """Test items are released once when the heap is collected as a part of a reference cycle."""
+        heap = ExtMinMaxHeapQueue()
+        a, b, cycle = (1, "a_minmax"), (2, "b_minmax"), (3, [])
+        cycle[1].append(heap)
+        refcount = sys.getrefcount(a), sys.getrefcount(b)
+
+        heap.push(a)
+        heap.push(b)
+        heap.push(cycle)
+        del heap, cycle
+        gc.collect()
+
+        assert (sys.getrefcount(a), sys.getrefcount(b)) == refcount
+
+    def test_update(self) -> None:
+        """Test restoring the heap invariant after items were changed."""
+
+        class Key:
+            def __init__(self, value: int) -> None:
+                self.value = value
+
+            def __lt__(self, other: "Key") -> bool:
+                return self.value < other.value
+
+        keys = [Key(i) for i in range(10)]
+        heap = ExtMinMaxHeapQueue()
+        for key in keys:
+            heap.push(key)
+
+        keys[0].value = 20
+        heap.update(keys[0])
+        keys[9].value = -1
+        heap.update(keys[9])
+        keys[5].value = 30
+        heap.update(keys[5])
+
+        assert heap.get_top() is keys[9]
+        assert heap.get_max() is keys[5]
+        assert heap.pop_max() is keys[5]
+        assert heap.pop_max() is keys[0]
+        assert [heap.pop().value for _ in range(len(heap))] == [-1, 1, 2, 3, 4, 6, 7, 8]
+
+    def test_not_comparable(self) -> None:
+        """Test the heap is left unchanged if the comparison fails."""
+        items = [_Fragile(value) for value in (5, 1, 40, 2, 50, 3, 4, 30, 10, 20)]
+        heap = ExtMinMaxHeapQueue()
+        for item in items:
+            heap.push(item)
+
+        refcounts = [sys.getrefcount(item) for item in items]
+        other = _Fragile(0)
+        _Fragile.broken = True
+        try:
+            for operation in (
+                heap.pop,
+                heap.pop_max,
+                lambda: heap.remove(items[2]),
+                lambda: heap.replace(other),
+                lambda: heap.pushpop(other),
+                lambda: heap.update(items[4]),
+                lambda: heap.push(other),
+            ):
+                with pytest.raises(ValueError, match="failed to compare Python objects"):
+                    operation()
+
+                assert len(heap) == len(items)
+        finally:
+            _Fragile.broken = False
+
+        assert [sys.getrefcount(item) for item in items] == refcounts
+        assert heap.get_max() is items[4]
+        assert [heap.pop().value for _ in range(len(heap))] == sorted(item.value for item in items)
+
+    def test_empty(self) -> None:
+        """Test operations on an empty heap."""
+        heap = ExtMinMaxHeapQueue()
+
+        with pytest.raises(KeyError, match="the heap is empty"):
+            heap.pop()
+
+        with pytest.raises(KeyError, match="the heap is empty"):
+            heap.pop_max()
+
+        with pytest.raises(KeyError, match="the heap is empty"):
+            heap.get_max()
+
+        with pytest.raises(ValueError, match="the given item was not found in the heap"):
+            heap.remove(1)
+
+    def test_already_present(self) -> None:
+        """Test pushing an item already present in the heap."""
+        heap = ExtMinMaxHeapQueue()
+        heap.push(1)
+
+        with pytest.raises(ValueError, match="the given item is already present in the heap"):
+            heap.push(1)
+
+        assert heap.pushpop(0) == 0
+        assert heap.replace(2) == 1
+        assert heap.get_last() == 2
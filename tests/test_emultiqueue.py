@@ -0,0 +1,137 @@
+#!/usr/bin/env python3
+# fext
+# Copyright(C) 2020 Fridolin Pokorny
+#
+# This program is free software: you can redistribute it and / or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program. If not, see <http://www.gnu.org/licenses/>.
+
+"""Relaxed concurrent priority queue related tests for fext library."""
+
+import gc
+import sys
+import threading
+import pytest
+
+from hypothesis import given
+from hypothesis.strategies import floats
+from hypothesis.strategies import lists
+
+from eheapq import ExtMultiQueue
+
+
+class _A:
+    """A class to mock a non-comparable object."""
+
+
+class TestEMultiQueue:
+    """Test relaxed priority queue implemented in eheapq extension."""
+
+    @given(lists(floats(allow_nan=False)))
+    def test_single_queue_sort(self, arr: list) -> None:
+        """Test a queue with one heap pops items in the order of their priorities."""
+        queue = ExtMultiQueue(threads=1, factor=1)
+        assert queue.queues == 1
+
+        for idx, priority in enumerate(arr):
+            queue.push(priority, str(idx))
+
+        assert len(queue) == len(arr)
+        assert [queue.pop()[0] for _ in arr] == sorted(arr)
+
+    @given(lists(floats(allow_nan=False)))
+    def test_relaxed(self, arr: list) -> None:
+        """Test all the items pushed are popped from a queue with multiple heaps."""
+        queue = ExtMultiQueue(threads=4, factor=2, arity=4)
+        assert queue.queues == 8
+        assert queue.arity == 4
+
+        for idx, priority in enumerate(arr):
+            queue.push(priority, idx)
+
+        popped = [queue.pop() for _ in arr]
+        assert sorted(popped) == sorted((priority, idx) for idx, priority in enumerate(arr))
+        assert len(queue) == 0
+
+    def test_threads(self) -> None:
+        """Test concurrent producers and consumers."""
+        queue = ExtMultiQueue(threads=4)
+        popped = []
+
+        def worker(start: int) -> None:
+            for i in range(start, start + 1000):
+                queue.push(float(i % 97), i)
+                if i % 2:
+                    popped.append(queue.pop()[1])
+
+        threads = [threading.Thread(target=worker, args=(i * 1000,)) for i in range(4)]
+        for thread in threads:
+            thread.start()
+        for thread in threads:
+            thread.join()
+
+        while len(queue):
+            popped.append(queue.pop()[1])
+
+        assert sorted(popped) == list(range(4000))
+
+    def test_empty(self) -> None:
+        """Test popping from an empty queue."""
+        queue = ExtMultiQueue()
+        assert queue.queues >= 1
+
+        with pytest.raises(KeyError):
+            queue.pop()
+
+    def test_invalid(self) -> None:
+        """Test invalid arguments and priorities."""
+        with pytest.raises(ValueError):
+            ExtMultiQueue(arity=1)
+
+        with pytest.raises(ValueError):
+            ExtMultiQueue(arity=2 ** 64 - 1)
+
+        with pytest.raises(ValueError):
+            ExtMultiQueue(factor=0)
+
+        for threads, factor in ((2 ** 40, 2), (2 ** 63, 2), (4097, 1), (1, 4097)):
+            with pytest.raises(ValueError, match=r"number of heaps \(threads \* factor\) has to be at most 4096"):
+                ExtMultiQueue(threads=threads, factor=factor)
+
+        assert ExtMultiQueue(threads=2048, factor=2).queues == 4096
+
+        queue = ExtMultiQueue()
+        with pytest.raises(ValueError):
+            queue.push(float("nan"), "a")
+
+        assert len(queue) == 0
+
+    def test_refcount(self) -> None:
+        """Test manipulation with reference counters."""
+        queue = ExtMultiQueue(threads=2)
+        a, b = _A(), _A()
+        refcount_a, refcount_b = sys.getrefcount(a), sys.getrefcount(b)
+
+        queue.push(1.0, a)
+        queue.push(2.0, b)
+        queue.push(3.0, a)
+        assert sys.getrefcount(a) == refcount_a + 2
+        assert sys.getrefcount(b) == refcount_b + 1
+
+        item = queue.pop()
+        del item
+        assert sys.getrefcount(a) + sys.getrefcount(b) == refcount_a + refcount_b + 2
+
+        del queue
+        gc.collect()
+        assert sys.getrefcount(a) == refcount_a
+        assert sys.getrefcount(b) == refcount_b
@@ -0,0 +1,359 @@
+#!/usr/bin/env python3
+# fext
+# Copyright(C) 2020 Fridolin Pokorny
+#
+# This program is free software: you can redistribute it and / or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program. If not, see <http://www.gnu.org/licenses/>.
+
+"""Priority heap queue related tests for fext library."""
+
+import sys
+import os
+import pickle
+import pytest
+import gc
+import tempfile
+from array import array
+
+from hypothesis import given
+from hypothesis.strategies import floats
+from hypothesis.strategies import integers
+from hypothesis.strategies import lists
+
+from eheapq import ExtPriorityQueue
+
+
+class _A:
+    """A class to mock a non-comparable object."""
+
+
+class TestEPriorityQueue:
+    """Test priority heap queue implemented in eheapq extension."""
+
+    def test_push_pop_refcount(self) -> None:
+        """Test manipulation with reference counter on push and pop."""
+        heap = ExtPriorityQueue()
+        a = _A()
+
+        refcount = sys.getrefcount(a)
+        heap.push(1.0, a)
+        assert sys.getrefcount(a) == refcount + 1
+
+        assert heap.get_top() == (1.0, a)
+        assert sys.getrefcount(a) == refcount + 1
+
+        assert heap.pop() == (1.0, a)
+        assert sys.getrefcount(a) == refcount
+        gc.collect()
+
+    def test_cycle_refcount(self) -> None:
+        """Test items are released once when the heap is collected as a part of a reference cycle."""
+        heap = ExtPriorityQueue()
+        a, b, cycle = _A(), _A(), _A()
+        cycle.heap = heap
+        refcount = sys.getrefcount(a), sys.getrefcount(b)
+
+        heap.push(1.0, a)
+        heap.push(2.0, b)
+        heap.push(3.0, cycle)
+        del heap, cycle
+        gc.collect()
+
+        assert (sys.getrefcount(a), sys.getrefcount(b)) == refcount
+
+    def test_evict_refcount(self) -> None:
+        """Test manipulation with reference counter when items are evicted from a bounded heap."""
+        heap = ExtPriorityQueue(size=1)
+        a, b, c = _A(), _A(), _A()
+
+        refcount = sys.getrefcount(a)
+        heap.push(1.0, a)
+        heap.push(2.0, b)
+        heap.push(0.0, c)
+
+        assert len(heap) == 1
+        assert heap.get_top() == (2.0, b)
+        assert sys.getrefcount(a) == refcount
+        assert sys.getrefcount(b) == refcount + 1
+        assert sys.getrefcount(c) == refcount
+
+        heap.remove(b)
+        assert sys.getrefcount(b) == refcount
+        gc.collect()
+
+    @given(lists(floats(allow_nan=False)), integers(min_value=0, max_value=10))
+    def test_would_accept(self, arr, size) -> None:
+        """Test checking whether an item would be pushed to a bounded heap before it is built."""
+        heap = ExtPriorityQueue(size=size)
+
+        for priority in arr:
+            if len(heap) < size:
+                assert heap.admission_threshold is None
+                assert heap.would_accept(priority) is True
+            elif size == 0:
+                assert heap.admission_threshold == float("inf")
+                assert heap.would_accept(priority) is False
+            else:
+                assert heap.admission_threshold == heap.get_top()[0]
+                assert heap.would_accept(priority) is (priority > heap.get_top()[0])
+
+            heap.push(priority, _A())
+
+        expected = sorted(arr)[len(arr) - min(size, len(arr)):]
+        assert [heap.pop()[0] for _ in range(len(heap))] == expected
+
+        with pytest.raises(ValueError, match="priority cannot be NaN"):
+            heap.would_accept(float("nan"))
+
+    def test_push_rejected_refcount(self) -> None:
+        """Test an item rejected by a full heap is not checked for presence nor referenced."""
+        heap = ExtPriorityQueue(size=1)
+        a, b = _A(), _A()
+
+        refcount = sys.getrefcount(b)
+        heap.push(1.0, a)
+        heap.push(0.5, b)
+        assert sys.getrefcount(b) == refcount
+        heap.push(0.5, a)
+        assert heap.get_top() == (1.0, a)
+
+        with pytest.raises(ValueError, match="the given item is already present in the heap"):
+            heap.push(2.0, a)
+
+    @given(lists(floats(allow_nan=False)))
+    def test_heap_sort(self, arr) -> None:
+        """Test manipulation with heap on heap sorting."""
+        heap = ExtPriorityQueue()
+
+        items = [_A() for _ in arr]
+        for priority, item in zip(arr, items):
+            heap.push(priority, item)
+
+        result = [heap.pop()[0] for _ in range(len(arr))]
+        assert result == sorted(arr)
+
+    def test_push_already_present(self) -> None:
+        """Test pushing an item that is already present on heap, regardless of its priority."""
+        heap = ExtPriorityQueue()
+        a = _A()
+
+        heap.push(1, a)
+        with pytest.raises(ValueError, match="the given item is already present in the heap"):
+            heap.push(2, a)
+
+        assert len(heap) == 1
+
+    def test_push_nan(self) -> None:
+        """Test pushing an item with NaN priority."""
+        heap = ExtPriorityQueue()
+
+        with pytest.raises(ValueError, match="priority cannot be NaN"):
+            heap.push(float("nan"), _A())
+
+        assert len(heap) == 0
+
+    def test_invalid_arity(self) -> None:
+        """Test creating a queue with an invalid arity."""
+        for arity in (0, 1, 1025, 2 ** 64 - 1):
+            with pytest.raises(ValueError, match="heap arity has to be at least 2 and at most 1024"):
+                ExtPriorityQueue(arity=arity)
+
+    def test_pop_empty(self) -> None:
+        """Test pop'ing an item from empty heap produces an exception."""
+        heap = ExtPriorityQueue()
+
+        with pytest.raises(KeyError, match="the heap is empty"):
+            heap.pop()
+
+    def test_remove(self) -> None:
+        """Test remove method."""
+        heap = ExtPriorityQueue()
+        a, b, c = _A(), _A(), _A()
+
+        heap.push(3, a)
+        heap.push(1, b)
+        heap.push(2, c)
+
+        heap.remove(b)
+        assert heap.get_top() == (2, c)
+        assert heap.get_max() == (3, a)
+
+        with pytest.raises(ValueError, match="the given item was not found in the heap"):
+            heap.remove(b)
+
+    def test_update(self) -> None:
+        """Test changing priority of items."""
+        heap = ExtPriorityQueue()
+        items = [_A() for _ in range(8)]
+
+        for i, item in enumerate(items):
+            heap.push(i, item)
+
+        heap.update(-1, items[5])
+        heap.update(10, items[0])
+        assert heap.get_top() == (-1, items[5])
+        assert heap.get_max() == (10, items[0])
+
+        heap.update(3.5, items[0])
+        assert heap.get_max() == (7, items[7])
+        assert [heap.pop()[1] for _ in range(8)] == [items[i] for i in (5, 1, 2, 3, 0, 4, 6, 7)]
+
+        with pytest.raises(ValueError, match="the given item was not found in the heap"):
+            heap.update(1, items[0])
+
+        with pytest.raises(ValueError, match="priority cannot be NaN"):
+            heap.update(float("nan"), items[0])
+
+    def test_pushpop(self) -> None:
+        """Test pushpop method."""
+        heap = ExtPriorityQueue()
+        a, b, c = _A(), _A(), _A()
+
+        assert heap.pushpop(1, a) == (1, a)
+        heap.push(1, a)
+        assert heap.pushpop(0, b) == (0, b)
+        assert heap.pushpop(2, c) == (1, a)
+        assert heap.pop() == (2, c)
+
+    def test_replace(self) -> None:
+        """Test replace method."""
+        heap = ExtPriorityQueue()
+        a, b = _A(), _A()
+
+        with pytest.raises(KeyError, match="the heap is empty"):
+            heap.replace(1, a)
+
+        heap.push(1, a)
+        assert heap.replace(5, b) == (1, a)
+        assert heap.pop() == (5, b)
+
+    @given(lists(floats(allow_nan=False)))
+    def test_dump_load(self, arr) -> None:
+        """Test saving the heap to a snapshot file and loading it back."""
+        heap = ExtPriorityQueue(arity=3)
+        for i, priority in enumerate(arr):
+            heap.push(priority, f"item-{i}")
+
+        with tempfile.TemporaryDirectory() as directory:
+            path = os.path.join(directory, "heap.snapshot")
+            heap.dump(path)
+            restored = ExtPriorityQueue.load(path)
+
+        assert restored.arity == 3
+        assert len(restored) == len(arr)
+        if arr:
+            assert restored.get_last() == heap.get_last()
+            assert restored.get_max()[0] == heap.get_max()[0]
+
+        assert [restored.pop() for _ in range(len(arr))] == [heap.pop() for _ in range(len(arr))]
+
+    def test_dump_load_serializer(self, tmp_path) -> None:
+        """Test snapshots with custom serializers and the size of the heap restored."""
+        heap = ExtPriorityQueue(size=3)
+        for i in range(5):
+            heap.push(i, f"item-{i}")
+
+        path = tmp_path / "heap.snapshot"
+        heap.dump(path, serializer=str.encode)
+        restored = ExtPriorityQueue.load(path, deserializer=bytes.decode)
+
+        assert restored.size == 3
+        assert [restored.pop() for _ in range(3)] == [(2, "item-2"), (3, "item-3"), (4, "item-4")]
+
+        with pytest.raises(TypeError, match="the serializer has to return bytes"):
+            heap.dump(path, serializer=str)
+
+        # The previous snapshot is kept if saving fails.
+        assert len(ExtPriorityQueue.load(path, deserializer=bytes.decode)) == 3
+
+    def test_load_failure_refcount(self, tmp_path) -> None:
+        """Test items decoded are released when loading fails."""
+        heap = ExtPriorityQueue()
+        for i in range(10):
+            heap.push(i, i)
+
+        path = tmp_path / "heap.snapshot"
+        heap.dump(path)
+
+        a = _A()
+        refcount = sys.getrefcount(a)
+        calls = []
+
+        def deserializer(data):
+            calls.append(data)
+            if len(calls) == 5:
+                raise RuntimeError("deserialization failed")
+            return a if len(calls) == 1 else _A()
+
+        with pytest.raises(RuntimeError, match="deserialization failed"):
+            ExtPriorityQueue.load(path, deserializer=deserializer)
+
+        assert sys.getrefcount(a) == refcount
+
+        with pytest.raises(ValueError, match="the given item is already present in the heap"):
+            ExtPriorityQueue.load(path, deserializer=lambda data: a)
+
+        assert sys.getrefcount(a) == refcount
+
+    def test_load_invalid(self, tmp_path) -> None:
+        """Test loading a file that is not a snapshot."""
+        path = tmp_path / "heap.snapshot"
+
+        with pytest.raises(FileNotFoundError):
+            ExtPriorityQueue.load(path)
+
+        path.write_bytes(b"not a snapshot")
+        with pytest.raises(ValueError, match="invalid or incompatible heap snapshot"):
+            ExtPriorityQueue.load(path)
+
+    @given(lists(floats(allow_nan=False)))
+    def test_pickle(self, arr) -> None:
+        """Test pickling the heap, priorities are passed out-of-band with protocol 5."""
+        heap = ExtPriorityQueue(arity=4)
+        for i, priority in enumerate(arr):
+            heap.push(priority, f"item-{i}")
+
+        buffers = []
+        data = pickle.dumps(heap, protocol=5, buffer_callback=buffers.append)
+        assert len(buffers) == 1
+        assert buffers[0].raw().nbytes == 8 * len(arr)
+
+        restored = pickle.loads(data, buffers=buffers)
+        assert restored.arity == 4
+        if arr:
+            assert restored.get_last() == heap.get_last()
+
+        restored_copy = pickle.loads(pickle.dumps(restored, protocol=4))
+        assert [restored.pop() for _ in range(len(arr))] == [heap.pop() for _ in range(len(arr))]
+        assert [restored_copy.pop()[0] for _ in range(len(arr))] == sorted(arr)
+
+    def test_pickle_not_ordered(self) -> None:
+        """Test restoring a pickled state which is not in the heap order."""
+        heap = ExtPriorityQueue()
+        a, b, c = _A(), _A(), _A()
+        refcount = sys.getrefcount(a)
+
+        heap.__setstate__((array("d", [3.0, 1.0, 2.0]).tobytes(), [a, b, c], 0))
+        assert sys.getrefcount(a) == refcount + 1
+        assert heap.get_last() == (3.0, a)
+        assert [heap.pop()[1] for _ in range(3)] == [b, c, a]
+        assert sys.getrefcount(a) == refcount
+
+        with pytest.raises(ValueError, match="the state does not fit the heap size"):
+            heap.__setstate__((b"", [a], -1))
+
+        with pytest.raises(ValueError, match="priority cannot be NaN"):
+            heap.__setstate__((array("d", [float("nan")]).tobytes(), [a], -1))
+
+        assert len(heap) == 0
+        assert sys.getrefcount(a) == refcount
@@ -0,0 +1,168 @@
+#!/usr/bin/env python3
+# fext
+# Copyright(C) 2020 Fridolin Pokorny
+#
+# This program is free software: you can redistribute it and / or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program. If not, see <http://www.gnu.org/licenses/>.
+
+"""Radix heap queue related tests for fext library."""
+
+import gc
+import sys
+import pytest
+
+from hypothesis import given
+from hypothesis.strategies import integers
+from hypothesis.strategies import lists
+
+from eheapq import ExtRadixHeapQueue
+
+
+class TestERadixHeapQueue:
+    """Test radix heap queue implemented in eheapq extension."""
+
+    @given(lists(integers(min_value=0, max_value=2 ** 64 - 1)))
+    def test_heap_sort(self, arr: list) -> None:
+        """Test popping items in the order of their priorities."""
+        heap = ExtRadixHeapQueue()
+        for idx, priority in enumerate(arr):
+            heap.push(priority, str(idx))
+
+        assert len(heap) == len(arr)
+
+        result = []
+        while len(heap) > 0:
+            top = heap.get_top()
+            priority, item = heap.pop()
+            assert top[0] == priority
+            assert arr[int(item)] == priority
+            result.append(priority)
+
+        assert result == sorted(arr)
+
+    @given(lists(integers(min_value=0, max_value=1000), min_size=1))
+    def test_monotone(self, arr: list) -> None:
+        """Test pushing items while popping, as done by Dijkstra-like searches."""
+        heap = ExtRadixHeapQueue()
+        heap.push(0, "start")
+
+        result = []
+        for idx, step in enumerate(arr):
+            priority, _ = heap.pop()
+            result.append(priority)
+            heap.push(priority + step, idx)
+            assert heap.last_priority == priority
+
+        assert result == sorted(result)
+
+    @given(lists(integers(min_value=0, max_value=1000)), integers(min_value=1, max_value=10))
+    def test_bounded(self, arr: list, size: int) -> None:
+        """Test the heap keeps the items with the largest priorities once it is full."""
+        heap = ExtRadixHeapQueue(size=size)
+        for idx, priority in enumerate(arr):
+            heap.push(priority, idx)
+
+        assert len(heap) == min(size, len(arr))
+        assert sorted(arr)[-size:] == [heap.pop()[0] for _ in range(len(heap))]
+
+    def test_not_monotone(self) -> None:
+        """Test pushing an item with a priority smaller than the last popped one."""
+        heap = ExtRadixHeapQueue()
+        heap.push(5, "a")
+        heap.push(10, "b")
+        assert heap.pop() == (5, "a")
+
+        with pytest.raises(ValueError, match="priority is smaller than the last popped priority"):
+            heap.push(4, "c")
+
+        with pytest.raises(ValueError, match="priority is smaller than the last popped priority"):
+            heap.update(4, "b")
+
+        with pytest.raises(OverflowError):
+            heap.push(-1, "c")
+
+        heap.push(5, "c")
+        assert heap.pop() == (5, "c")
+        assert heap.pop() == (10, "b")
+
+    def test_remove_update(self) -> None:
+        """Test removing items and changing their priorities."""
+        heap = ExtRadixHeapQueue()
+        for i in range(10):
+            heap.push(i * 10, i)
+
+        heap.remove(3)
+        heap.update(1, 9)
+        heap.update(95, 0)
+
+        with pytest.raises(ValueError, match="the given item was not found in the heap"):
+            heap.remove(3)
+
+        with pytest.raises(ValueError, match="the given item is already present in the heap"):
+            heap.push(1, 9)
+
+        assert heap.get_top() == (1, 9)
+        assert [heap.pop() for _ in range(len(heap))] == [
+            (1, 9), (10, 1), (20, 2), (40, 4), (50, 5), (60, 6), (70, 7), (80, 8), (95, 0)
+        ]
+
+    def test_empty(self) -> None:
+        """Test operations on an empty heap."""
+        heap = ExtRadixHeapQueue()
+
+        with pytest.raises(KeyError, match="the heap is empty"):
+            heap.pop()
+
+        with pytest.raises(KeyError, match="the heap is empty"):
+            heap.get_top()
+
+    def test_refcount(self) -> None:
+        """Test manipulation with reference counters."""
+        heap = ExtRadixHeapQueue(size=2)
+        a, b, c = "1_radix", "2_radix", "3_radix"
+        refcount_a, refcount_b, refcount_c = sys.getrefcount(a), sys.getrefcount(b), sys.getrefcount(c)
+
+        heap.push(2, b)
+        heap.push(1, a)
+        heap.push(3, c)
+        heap.push(0, a)
+        assert sys.getrefcount(a) == refcount_a
+        assert sys.getrefcount(b) == refcount_b + 1
+        assert sys.getrefcount(c) == refcount_c + 1
+
+        heap.update(4, b)
+        assert sys.getrefcount(b) == refcount_b + 1
+
+        item = heap.pop()
+        assert sys.getrefcount(c) == refcount_c + 1
+        del item
+        assert sys.getrefcount(c) == refcount_c
+
+        heap.remove(b)
+        assert sys.getrefcount(b) == refcount_b
+        assert len(heap) == 0
+
+    def test_cycle_refcount(self) -> None:
+        """Test items are released once when the heap is collected as a part of a reference cycle."""
+        heap = ExtRadixHeapQueue()
+        a, b, cycle = "1_radix_cycle", "2_radix_cycle", []
+        cycle.append(heap)
+        refcount = sys.getrefcount(a), sys.getrefcount(b)
+
+        heap.push(2, a)
+        heap.push(300, b)
+        heap.push(1, cycle)
+        del heap, cycle
+        gc.collect()
+
+        assert (sys.getrefcount(a), sys.getrefcount(b)) == refcount